@@ -18,6 +18,10 @@
 
 #define BUFFER_META				"meta(buffer)"
 #define BUFFER_MAGIC 			1437549501
+
+/* memory of a buffer shared with the readers sliced from it, see buffer:slice() */
+struct _BufferSeg;
+
 typedef struct _Buffer {
 	uint32_t magic;
 	uint8_t *mem;
@@ -28,6 +32,7 @@ typedef struct _Buffer {
 	bool be;
 	bool rd;
 	bool wr;
+	struct _BufferSeg *seg;		/* non-NULL if 'mem' is shared */
 }Buffer;
 
 typedef struct _BufferCFunc {
@@ -50,6 +55,7 @@ typedef struct _Reader {
 	size_t memsiz;
 	size_t datasiz;
 	bool be;
+	struct _BufferSeg *seg;		/* the memory pinned by the reader, or NULL */
 }Reader;
 
 #if !STD_SELF
@@ -0,0 +1,120 @@
+--
+-- Copyright (C) spyder
+--
+
+local cjson = require 'cjson'
+
+local uptime = time.uptime
+
+local BATCH = 1000
+
+-- like a ctlserver reply or a message between services
+local MESSAGE = {
+	id = 12345,
+	cmd = 'stats',
+	err = 0,
+	retv = {'tasks', 'coroutines', 'timers', 'channels'},
+	stats = {uptime = 123456.75, tasks = 42, pooled = 256, kbytes = 10240},
+}
+local MESSAGE_FORMAT = '{id:u, cmd:s, err:i, retv:[s], stats:{uptime:d, tasks:u, pooled:u, kbytes:u}}'
+
+-- encode+decode MESSAGE 'n' times with 'fmt' in batches
+local function pack_bench(ctx, fmt)
+	local buf = buffer.new()
+	for _ = 1, ctx.n / BATCH do
+		local t0 = uptime()
+		for _ = 1, BATCH do
+			buf:pack(MESSAGE, fmt)
+			buf:unpack(fmt)
+		end
+		ctx:record(t0, BATCH)
+	end
+end
+
+-- build a 64MB response body from 8KB pieces in 'body' then write it to /dev/null, 'n' times
+local BODY_SIZE = 64 * 1024 * 1024
+local PIECE = string.rep('x', 8192)
+
+local function body_bench(ctx, body)
+	local fd = os.open('/dev/null', os.O_WRONLY)
+	for _ = 1, ctx.n do
+		local t0 = uptime()
+		for _ = 1, BODY_SIZE / #PIECE do
+			body:putstr(PIECE)
+		end
+		assert(os.writeb(fd, body) == BODY_SIZE)
+		body:reset()
+		ctx:record(t0)
+	end
+	os.close(fd)
+end
+
+return {
+	{
+		name = 'buffer',
+		desc = 'put a 64-byte string into a buffer then get it out, in batches of 1000',
+		n = 2000000,
+		run = function (ctx)
+			local buf = buffer.new()
+			local str = string.rep('x', 64)
+
+			for _ = 1, ctx.n / BATCH do
+				local t0 = uptime()
+				for _ = 1, BATCH do
+					buf:putstr(str)
+				end
+				for _ = 1, BATCH do
+					buf:getlstr(64)
+				end
+				ctx:record(t0, BATCH)
+			end
+		end,
+	},
+	{
+		name = 'buffer_pack',
+		desc = 'pack a message into a buffer then unpack it, in batches of 1000',
+		n = 500000,
+		run = function (ctx)
+			pack_bench(ctx)
+		end,
+	},
+	{
+		name = 'buffer_pack_format',
+		desc = 'the same as buffer_pack with a compiled format',
+		n = 500000,
+		run = function (ctx)
+			pack_bench(ctx, buffer.packformat(MESSAGE_FORMAT))
+		end,
+	},
+	{
+		name = 'buffer_cjson',
+		desc = 'the same as buffer_pack with cjson.encode/decode for comparison',
+		n = 500000,
+		run = function (ctx)
+			local encode, decode = cjson.encode, cjson.decode
+			for _ = 1, ctx.n / BATCH do
+				local t0 = uptime()
+				for _ = 1, BATCH do
+					decode(encode(MESSAGE))
+				end
+				ctx:record(t0, BATCH)
+			end
+		end,
+	},
+	{
+		name = 'buffer_body',
+		desc = 'build a 64MB body from 8KB pieces in a buffer and write it to /dev/null',
+		n = 20,
+		run = function (ctx)
+			body_bench(ctx, buffer.new())
+		end,
+	},
+	{
+		name = 'buffer_chain_body',
+		desc = 'the same as buffer_body with a chain(writev)',
+		n = 20,
+		run = function (ctx)
+			body_bench(ctx, buffer.chain())
+		end,
+	},
+}
@@ -0,0 +1,59 @@
+--
+-- Copyright (C) spyder
+--
+
+local uptime = time.uptime
+
+-- an application/x-www-form-urlencoded body of about 64KB, mostly plain text
+local function form_body()
+	local t = {}
+	for i = 1, 512 do
+		t[i] = 'field' .. i .. '=' .. codec.urlencode(string.rep('plain text value ', 6) .. i .. '&/?')
+	end
+	return table.concat(t, '&')
+end
+
+local BODY = form_body()
+local DECODED = codec.urldecode(BODY)
+
+return {
+	{
+		name = 'codec_urlencode',
+		desc = 'urlencode a 64KB string',
+		n = 2000,
+		run = function (ctx)
+			local urlencode = codec.urlencode
+			for _ = 1, ctx.n do
+				local t0 = uptime()
+				urlencode(DECODED)
+				ctx:record(t0)
+			end
+		end,
+	},
+	{
+		name = 'codec_urldecode',
+		desc = 'urldecode a 64KB form body',
+		n = 2000,
+		run = function (ctx)
+			local urldecode = codec.urldecode
+			for _ = 1, ctx.n do
+				local t0 = uptime()
+				urldecode(BODY)
+				ctx:record(t0)
+			end
+		end,
+	},
+	{
+		name = 'codec_parse_query',
+		desc = 'parse a 64KB form body of 512 fields into a table',
+		n = 2000,
+		run = function (ctx)
+			local parse_query = codec.parse_query
+			for _ = 1, ctx.n do
+				local t0 = uptime()
+				parse_query(BODY)
+				ctx:record(t0)
+			end
+		end,
+	},
+}
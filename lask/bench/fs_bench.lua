@@ -0,0 +1,78 @@
+--
+-- Copyright (C) spyder
+--
+
+local uptime = time.uptime
+
+-- 20 directories of 1000 empty files, like a cache directory to be cleaned
+local NUM_DIRS, NUM_FILES = 20, 1000
+
+local function mktree()
+	local root = '/tmp/lask-fs-bench-' .. os.getpid()
+	fs.mkdir(root)
+	for i = 1, NUM_DIRS do
+		local dir = root .. '/d' .. i
+		fs.mkdir(dir)
+		for j = 1, NUM_FILES do
+			os.close(os.creat(dir .. '/f' .. j, 420))
+		end
+	end
+	return root
+end
+
+local function rmtree(root)
+	os.execute('rm -rf ' .. root)
+end
+
+-- the mtimes of all the files by fs.listdir+fs.lstat
+local function listdir_walk(dir, out)
+	for _, name in ipairs(fs.listdir(dir)) do
+		local path = dir .. '/' .. name
+		local st = fs.lstat(path)
+		if stat.isdir(st.mode) then
+			listdir_walk(path, out)
+		else
+			out[path] = st.mtime
+		end
+	end
+end
+
+return {
+	{
+		name = 'fs_listdir_stat',
+		desc = 'collect the mtimes of 20000 files by fs.listdir+fs.lstat',
+		n = 20,
+		run = function (ctx)
+			local root = mktree()
+			for _ = 1, ctx.n do
+				local t0 = uptime()
+				listdir_walk(root, {})
+				ctx:record(t0)
+			end
+			rmtree(root)
+		end,
+	},
+	{
+		name = 'fs_walk',
+		desc = 'the same as fs_listdir_stat by fs.walk(getdents64+fstatat)',
+		n = 20,
+		run = function (ctx)
+			local root = mktree()
+			local DT_DIR = fs.DT_DIR
+			for _ = 1, ctx.n do
+				local t0 = uptime()
+				local out = {}
+				local w = fs.walk(root, {stat = true})
+				while w:fill() > 0 do
+					for path, type, _, mtime in w.next, w do
+						if type ~= DT_DIR then
+							out[path] = mtime
+						end
+					end
+				end
+				ctx:record(t0)
+			end
+			rmtree(root)
+		end,
+	},
+}
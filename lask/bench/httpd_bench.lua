@@ -0,0 +1,66 @@
+--
+-- Copyright (C) spyder
+--
+
+local http = require 'httpd'
+local tasklet = require 'tasklet'
+local log = require 'log'
+
+local uptime = time.uptime
+
+local REQUEST = 'GET /hello HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n'
+
+-- read a response and return its body
+local function read_response(ch)
+	local len = 0
+	while true do
+		local line, err = ch:read()
+		assert(line, errno.strerror(err or 0))
+		if line == '' then
+			break
+		end
+		local value = line:match('^[Cc]ontent%-[Ll]ength:%s*(%d+)')
+		if value then
+			len = tonumber(value)
+		end
+	end
+
+	local left = len
+	while left > 0 do
+		local data, err = ch:read(left)
+		assert(err == 0, errno.strerror(err))
+		left = left - #data
+	end
+	return len
+end
+
+return {
+	{
+		name = 'httpd',
+		desc = 'keep-alive GET requests to httpd from one connection',
+		n = 500,
+		run = function (ctx)
+			log.init({level = 'warn'})
+			local server = http.start_server({
+				addr = '127.0.0.1',
+				port = 0,
+				handler = function (req)
+					http.echo_json({hello = 'world'})
+				end,
+			})
+			local addr, port = socket.getsockname(server.ch_fd)
+
+			local ch = tasklet.stream_channel.new()
+			assert(ch:connect(addr, port) == 0)
+
+			local buf = buffer.new()
+			for _ = 1, ctx.n do
+				local t0 = uptime()
+				ch:write(buf:rewind():putstr(REQUEST))
+				assert(read_response(ch) > 0)
+				ctx:record(t0)
+			end
+			ch:close()
+		end,
+	},
+}
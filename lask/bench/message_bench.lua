@@ -0,0 +1,33 @@
+--
+-- Copyright (C) spyder
+--
+
+local tasklet = require 'tasklet.channel.message'
+
+local uptime = time.uptime
+
+return {
+	{
+		name = 'message',
+		desc = 'message_channel ping-pong between two tasks, one op is a round trip',
+		n = 200000,
+		run = function (ctx)
+			local ping = tasklet.message_channel.new()
+			local pong = tasklet.message_channel.new()
+			local n = ctx.n
+
+			tasklet.start_task(function ()
+				for _ = 1, n do
+					pong:write(ping:read())
+				end
+			end)
+
+			for i = 1, n do
+				local t0 = uptime()
+				ping:write(i)
+				assert(pong:read() == i)
+				ctx:record(t0)
+			end
+		end,
+	},
+}
@@ -0,0 +1,207 @@
+--
+-- Copyright (C) spyder
+--
+
+local help = [[
+Micro benchmarks of the tasklet runtime.
+
+lua run.lua [--json] [-n scale] [bench ...]
+
+	--json    print the results as JSON instead of a table
+	-n        multiply the iterations of every bench by 'scale', defaulted to 1
+	bench     name(or prefix, e.g. 'stream') of the benches to run, all by default
+
+The benches are defined in <module>_bench.lua, each one returns a list of
+{name=, desc=, n=, run=function (ctx) end}, 'run' is called in a task.
+
+Each bench runs in a forked process, so the RSS reported(VmHWM, the peak
+resident size in KB) is its own. Latencies are in microseconds.
+
+SAMPLE:
+	lua run.lua task_spawn message
+	make bench  # in the top directory, writes bench.json(BENCH_ARGS="-n 0.1 task" to pass arguments)
+]]
+
+package.path = './?.lua;' .. package.path
+
+require 'std'
+local cjson = require 'cjson'
+local tasklet = require 'tasklet'
+
+local uptime = time.uptime
+local floor = math.floor
+
+local MODULES = {'task', 'timer', 'message', 'service', 'buffer', 'codec', 'fs', 'stream', 'httpd'}
+
+local json = false
+local scale = 1
+local patterns = {}
+
+do
+	local i = 1
+	while arg[i] do
+		local a = arg[i]
+		if a == '--json' then
+			json = true
+		elseif a == '-n' then
+			i = i + 1
+			scale = tonumber(arg[i]) or scale
+		elseif a == 'help' or a == '-h' or a == '--help' then
+			print(help)
+			os.exit(0)
+		else
+			patterns[#patterns + 1] = a
+		end
+		i = i + 1
+	end
+end
+
+local function selected(name)
+	if #patterns == 0 then
+		return true
+	end
+	for _, p in ipairs(patterns) do
+		if name:sub(1, #p) == p then
+			return true
+		end
+	end
+	return false
+end
+
+local function read_rss()
+	local str = file_get_content('/proc/self/status') or ''
+	return tonumber(str:match('VmHWM:%s*(%d+)')) or 0
+end
+
+-- The context passed to bench.run
+--
+-- ctx.n                  number of operations to do
+-- ctx:record(t0, nops)   'nops' operations started at 't0'(time.uptime()) are
+--                        completed, each one takes (now - t0) / nops
+local context = {}
+context.__index = context
+
+function context:record(t0, nops)
+	nops = nops or 1
+	local nlat = self.nlat + 1
+	self.nlat = nlat
+	self.lat[nlat] = (uptime() - t0) / nops
+	self.weight[nlat] = nops
+end
+
+local function percentile(lat, weight, total, q)
+	local rank = q * total
+	local acc = 0
+	for i = 1, #lat do
+		acc = acc + weight[i]
+		if acc >= rank then
+			return lat[i]
+		end
+	end
+	return lat[#lat] or 0
+end
+
+local function summarize(ctx, elapsed)
+	local idx = {}
+	for i = 1, ctx.nlat do
+		idx[i] = i
+	end
+	local lat, weight = ctx.lat, ctx.weight
+	table.sort(idx, function (a, b) return lat[a] < lat[b] end)
+
+	local slat, sweight, total = {}, {}, 0
+	for i, j in ipairs(idx) do
+		slat[i] = lat[j]
+		sweight[i] = weight[j]
+		total = total + weight[j]
+	end
+
+	return {
+		ops = ctx.n,
+		seconds = elapsed,
+		ops_per_sec = floor(ctx.n / elapsed),
+		p50_us = percentile(slat, sweight, total, 0.5) * 1e6,
+		p99_us = percentile(slat, sweight, total, 0.99) * 1e6,
+		rss_kb = read_rss(),
+	}
+end
+
+-- runs in the forked process, the result is written to 'wfd' as JSON
+local function run_child(bench, wfd)
+	local ctx = setmetatable({
+		n = math.max(1, floor(bench.n * scale)),
+		nlat = 0,
+		lat = {},
+		weight = {},
+	}, context)
+
+	tasklet.start_task(function ()
+		collectgarbage()
+		local t0 = uptime()
+		local ok, err = xpcall(bench.run, debug.traceback, ctx)
+		local elapsed = uptime() - t0
+		local result
+		if ok then
+			result = summarize(ctx, elapsed)
+		else
+			result = {error = tostring(err)}
+		end
+		os.write(wfd, cjson.encode(result))
+		io.stdout:flush()
+		os.exit(ok and 0 or 1)
+	end, 'bench')
+	tasklet.loop()
+	os.exit(1)
+end
+
+local function run_bench(bench)
+	local rfd, wfd = os.pipe()
+	io.stdout:flush()
+	local pid = os.fork()
+	if pid == 0 then
+		os.close(rfd)
+		run_child(bench, wfd)
+	end
+	os.close(wfd)
+
+	local _, status = os.waitpid(pid)
+	local str = os.read(rfd)
+	os.close(rfd)
+
+	local result = str and cjson.decode(str) or {error = 'exited with status ' .. tostring(status)}
+	result.name = bench.name
+	result.desc = bench.desc
+	return result
+end
+
+local results = {}
+for _, modname in ipairs(MODULES) do
+	for _, bench in ipairs(require(modname .. '_bench')) do
+		if selected(bench.name) then
+			local result = run_bench(bench)
+			results[#results + 1] = result
+			if not json then
+				if result.error then
+					io.stderr:write(bench.name, ': ', result.error, '\n')
+				else
+					print(string.format('%-16s %10d ops %12d ops/s  p50 %9.2fus  p99 %9.2fus  rss %7dKB',
+						result.name, result.ops, result.ops_per_sec, result.p50_us, result.p99_us, result.rss_kb))
+				end
+			end
+		end
+	end
+end
+
+if json then
+	print(cjson.encode({
+		time = os.time(),
+		scale = scale,
+		results = results,
+	}))
+end
+
+for _, result in ipairs(results) do
+	if result.error then
+		os.exit(1)
+	end
+end
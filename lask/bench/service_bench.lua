@@ -0,0 +1,57 @@
+--
+-- Copyright (C) spyder
+--
+
+local tasklet = require 'tasklet.service'
+
+local uptime = time.uptime
+local request = tasklet.request
+
+local NUM_CLIENTS = 10
+
+return {
+	{
+		name = 'service',
+		desc = 'request/response to a service by 10 concurrent clients',
+		n = 200000,
+		run = function (ctx)
+			local svc = tasklet.create_service('bench', function (svc, x) return x + 1 end)
+			local n = ctx.n / NUM_CLIENTS
+
+			for _ = 1, NUM_CLIENTS do
+				tasklet.start_task(function ()
+					for i = 1, n do
+						local t0 = uptime()
+						assert(request(svc, i) == i + 1)
+						ctx:record(t0)
+					end
+				end, nil, true)
+			end
+			tasklet.join_tasks(-1)
+		end,
+	},
+	{
+		name = 'service_batch',
+		desc = 'request/response to a batch service by 10 concurrent clients',
+		n = 200000,
+		run = function (ctx)
+			local svc = tasklet.create_batch_service('bench', function (reqarr, resparr, errarr, num)
+				for i = 1, num do
+					resparr[i] = reqarr[i] + 1
+				end
+			end)
+			local n = ctx.n / NUM_CLIENTS
+
+			for _ = 1, NUM_CLIENTS do
+				tasklet.start_task(function ()
+					for i = 1, n do
+						local t0 = uptime()
+						assert(request(svc, i) == i + 1)
+						ctx:record(t0)
+					end
+				end, nil, true)
+			end
+			tasklet.join_tasks(-1)
+		end,
+	},
+}
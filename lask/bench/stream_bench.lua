@@ -0,0 +1,115 @@
+--
+-- Copyright (C) spyder
+--
+
+local tasklet = require 'tasklet.channel.streamserver'
+require 'tasklet.channel.stream'
+
+local uptime = time.uptime
+
+local MSGSIZE = 64
+
+local function echo(ch)
+	while true do
+		local data, err = ch:read(-1)
+		if err ~= 0 or not data then
+			break
+		end
+		if ch:write(data) ~= 0 then
+			break
+		end
+	end
+	ch:close()
+end
+
+-- start the echo server and return the arguments to connect to it
+local function start_server(path)
+	local server, err
+	if path then
+		server, err = tasklet.create_unserver_channel(path)
+	else
+		server, err = tasklet.create_tcpserver_channel('127.0.0.1', 0)
+	end
+	assert(server, errno.strerror(err or 0))
+
+	tasklet.start_task(function ()
+		while true do
+			local fd = server:accept()
+			if fd >= 0 then
+				local ch = tasklet.stream_channel.new(fd)
+				tasklet.start_task(function () echo(ch) end)
+			end
+		end
+	end)
+
+	if path then
+		return path
+	end
+	local addr, port = socket.getsockname(server.ch_fd)
+	return addr, port
+end
+
+local function run(ctx, addr, port)
+	local ch = tasklet.stream_channel.new()
+	assert(ch:connect(addr, port) == 0)
+
+	local buf = buffer.new()
+	local msg = string.rep('x', MSGSIZE)
+	for _ = 1, ctx.n do
+		local t0 = uptime()
+		ch:write(buf:rewind():putstr(msg))
+		local left = MSGSIZE
+		while left > 0 do
+			local data, err = ch:read(left)
+			assert(err == 0, errno.strerror(err))
+			left = left - #data
+		end
+		ctx:record(t0)
+	end
+	ch:close()
+end
+
+-- the same benches on the io_uring backend, fails if it's unavailable
+local function uring(fn)
+	return function (ctx)
+		assert(tasklet.set_backend('uring') == 'uring', 'io_uring is unavailable')
+		fn(ctx)
+	end
+end
+
+local function tcp(ctx)
+	run(ctx, start_server())
+end
+
+local function unix(ctx)
+	local path = '/tmp/lask-bench-' .. os.getpid() .. '.sock'
+	run(ctx, start_server(path))
+	fs.unlink(path)
+end
+
+return {
+	{
+		name = 'stream_tcp',
+		desc = '64-byte echo over a loopback TCP connection, one op is a round trip',
+		n = 50000,
+		run = tcp,
+	},
+	{
+		name = 'stream_unix',
+		desc = '64-byte echo over a unix domain socket, one op is a round trip',
+		n = 50000,
+		run = unix,
+	},
+	{
+		name = 'stream_tcp_uring',
+		desc = 'stream_tcp on the io_uring backend(tasklet.set_backend)',
+		n = 50000,
+		run = uring(tcp),
+	},
+	{
+		name = 'stream_unix_uring',
+		desc = 'stream_unix on the io_uring backend(tasklet.set_backend)',
+		n = 50000,
+		run = uring(unix),
+	},
+}
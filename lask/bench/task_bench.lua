@@ -0,0 +1,83 @@
+--
+-- Copyright (C) spyder
+--
+
+local tasklet = require 'tasklet'
+
+local uptime = time.uptime
+local start_task, join_tasks = tasklet.start_task, tasklet.join_tasks
+local block_task, resume_task, current_task = tasklet._block_task, tasklet._resume_task, tasklet.current_task
+
+local BATCH = 100
+
+local function nop()
+end
+
+-- recurse 'depth' levels with some locals, growing the Lua stack of the task
+-- like a request handler would
+local function recurse(depth)
+	if depth > 0 then
+		local a, b, c, d, e, f, g, h = 1, 2, 3, 4, 5, 6, 7, 8
+		return recurse(depth - 1) + a + b + c + d + e + f + g + h
+	end
+	return 0
+end
+
+local function deep()
+	recurse(30)
+end
+
+return {
+	{
+		name = 'task_spawn',
+		desc = 'start joinable tasks doing nothing and join them, in batches of 100',
+		n = 200000,
+		run = function (ctx)
+			for _ = 1, ctx.n / BATCH do
+				local t0 = uptime()
+				for _ = 1, BATCH do
+					start_task(nop, nil, true)
+				end
+				join_tasks(-1)
+				ctx:record(t0, BATCH)
+			end
+		end,
+	},
+	{
+		name = 'task_spawn_deep',
+		desc = 'like task_spawn, but each task grows its stack by a 30-level call chain',
+		n = 200000,
+		run = function (ctx)
+			for _ = 1, ctx.n / BATCH do
+				local t0 = uptime()
+				for _ = 1, BATCH do
+					start_task(deep, nil, true)
+				end
+				join_tasks(-1)
+				ctx:record(t0, BATCH)
+			end
+		end,
+	},
+	{
+		name = 'task_resume',
+		desc = 'two tasks resuming each other, one op is a round trip',
+		n = 200000,
+		run = function (ctx)
+			local main = current_task()
+			local n = ctx.n
+			local peer = start_task(function ()
+				for _ = 1, n do
+					resume_task(main)
+					block_task(-1)
+				end
+			end)
+
+			for _ = 1, n do
+				local t0 = uptime()
+				resume_task(peer)
+				block_task(-1)
+				ctx:record(t0)
+			end
+		end,
+	},
+}
@@ -0,0 +1,33 @@
+--
+-- Copyright (C) spyder
+--
+
+local tasklet = require 'tasklet'
+
+local uptime = time.uptime
+local random = math.random
+local start_task, join_tasks, sleep = tasklet.start_task, tasklet.join_tasks, tasklet.sleep
+
+local NUM_TASKS = 1000
+
+return {
+	{
+		name = 'timer',
+		desc = '1000 tasks sleeping in turn with random timeouts(1-10ms), latency is how late they wake up',
+		n = 100000,
+		run = function (ctx)
+			local n = ctx.n / NUM_TASKS
+			for _ = 1, NUM_TASKS do
+				start_task(function ()
+					for _ = 1, n do
+						local sec = 0.001 + random() * 0.009
+						local t0 = uptime() + sec
+						sleep(sec)
+						ctx:record(t0)
+					end
+				end, nil, true)
+			end
+			join_tasks(-1)
+		end,
+	},
+}
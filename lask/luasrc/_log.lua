@@ -38,6 +38,11 @@ local LEVEL_NAME = {
 	"fatal",
 }
 
+local BINARY_MAGIC = 'LASKLOG1'
+
+-- bytes of a rotated file deflated at a time
+local COMPRESS_CHUNK = 64 * 1024
+
 local LEVEL_NAME_PREFIX = {
 	'debug*** ',
 	'info *** ',
@@ -81,9 +86,34 @@ local log_withtime = true
 local log_fd = -1
 local log_flimit = -1
 local log_fsize = 0
+local log_nrotate = 1
+local log_compress = false
+local log_zpid = -1		-- the child compressing path.1
 local log_buf = buffer.new(1024)
 local log_inited = false
 
+-- with 'format=binary', records go into the file as
+--   'F' w(id) u(len) format
+--   'R' u(sec) w(msec) c(level) w(id) c(nargs) {u(len) arg}
+-- the first argument of a record is taken as the format if it's declared by
+-- M.fmt, and it's written only once(by an 'F' record) per file, otherwise
+-- the record has no format(id 0) and all the arguments are written.
+-- see tools/logdump.lua for decoding.
+local log_binary = false
+local log_fmts = {}		-- {[format] = true}, declared by M.fmt
+local log_fmtids = {}
+local log_nfmt = 0
+
+-- records are batched in 'log_buf' and written out once per loop iteration,
+-- or as soon as 'log_flushsiz' bytes are pending.
+-- records arriving while 'log_bufmax' bytes are still pending are dropped.
+local log_bufmax = 32 * 1024
+local log_flushsiz = 4096
+local log_batched = false
+local log_nrecords = 0
+local log_ndropped = 0
+local log_nflushes = 0
+
 local bak_fd = -1
 local bak_level
 local bak_type
@@ -121,6 +151,21 @@ function M.init(conf)
 			log_flimit = conf.flimit
 		end
 		log_fsize = conf.foffset or 0
+		if type(conf.rotate) == 'number' and conf.rotate > 0 then
+			log_nrotate = conf.rotate
+		end
+		if conf.compress then
+			log_compress = true
+		end
+		if conf.format == 'binary' then
+			log_binary = true
+		end
+		if type(conf.bufsize) == 'number' and conf.bufsize > 0 then
+			log_bufmax = conf.bufsize
+		end
+		if type(conf.flushsize) == 'number' and conf.flushsize > 0 then
+			log_flushsiz = conf.flushsize
+		end
 	end
 
 	if log_path then
@@ -147,19 +192,164 @@ function M.init(conf)
 		end
 	end
 
+	if log_type == TO_FILE and log_binary and log_fsize == 0 then
+		log_buf:putstr(BINARY_MAGIC)
+	end
+
 	log_inited = true
 	tasklet = package.loaded.tasklet
+	if tasklet and log_type ~= TO_NULL then
+		log_batched = true
+		table.insert(tasklet._nonevent_modules, M.flush)
+	end
+end
+
+-- gzip 'path' into 'path.gz' in a child process, so the loop never waits
+-- for the compression.
+--
+-- the file is deflated chunk by chunk, a big rotated file is never loaded
+-- into memory as a whole.
+local function compress_file(path)
+	local pid = os.fork()
+	if pid == 0 then
+		local ok, zlib = pcall(require, 'zlib')
+		local infd = ok and os.open(path, os.O_RDONLY) or -1
+		local outfd = infd >= 0 and os.creat(path .. '.gz', math.oct(644)) or -1
+		local zstream = outfd >= 0 and zlib.deflate_init()
+		if zstream then
+			local inbuf = buffer.new()
+			local outbuf = buffer.new()
+			local n, err
+			repeat
+				n, err = os.readb(infd, inbuf:rewind(), COMPRESS_CHUNK)
+				if err == 0 then
+					-- an empty chunk finishes the stream
+					err = zlib.deflate(zstream, inbuf, outbuf:rewind(), n > 0 and 1 or 0)
+					if err == 0 and #outbuf > 0 then
+						local _, werr = os.writeb(outfd, outbuf)
+						err = werr
+					end
+				end
+			until err ~= 0 or n == 0
+			zlib.deflate_end(zstream)
+			os.close(outfd)
+			fs.unlink(err == 0 and path or path .. '.gz')
+		end
+		-- the stdio buffers are the parent's, never flush them twice
+		os._exit(0)
+	end
+	return pid
+end
+
+-- whether the child compressing 'path.1' is still running
+local function compressing()
+	if log_zpid > 0 then
+		if os.waitpid(log_zpid, os.WNOHANG) == 0 then
+			return true
+		end
+		log_zpid = -1
+	end
+	return false
+end
+
+-- rename 'path.N-1' ... 'path.1' to 'path.N' ... 'path.2', 'path' to 'path.1'
+-- and start over with a new empty file.
+--
+-- only renames are involved, thus a rotation costs no more writes than
+-- the records themselves.
+local function rotate()
+	-- 'path.1' is still being compressed, rotate at a later flush
+	if log_compress and compressing() then
+		return
+	end
+
+	local ext = log_compress and '.gz' or ''
+	for i = log_nrotate - 1, 1, -1 do
+		fs.rename(log_path .. '.' .. i .. ext, log_path .. '.' .. (i + 1) .. ext)
+	end
+
+	os.close(log_fd)
+	fs.rename(log_path, log_path .. '.1')
+	log_fd = os.creat(log_path, math.oct(644))
+	log_fsize = 0
+
+	if log_binary then
+		log_fmtids = {}
+		log_nfmt = 0
+		log_buf:putstr(BINARY_MAGIC)
+	end
+
+	if log_compress then
+		log_zpid = compress_file(log_path .. '.1')
+	end
+end
+
+-- write out all the pending records.
+--
+-- a short write(EAGAIN on the capturing socket, which os.writeb reports as
+-- err 0) keeps the rest pending for the next iteration, an error discards them.
+function M.flush()
+	-- reap the compressing child once done, never leave it a zombie until
+	-- the next rotation
+	if log_zpid > 0 then
+		compressing()
+	end
+
+	local buf = log_buf
+	local len = #buf
+	if len == 0 then
+		return
+	end
+
+	local fd = log_type == TO_STDERR and 2 or log_fd
+	if fd < 0 or log_type == TO_NULL then
+		buf:rewind()
+		return
+	end
+
+	local n, err = os.writeb(fd, buf)
+	log_nflushes = log_nflushes + 1
+	log_fsize = log_fsize + n
+	if err == 0 and n < len then
+		buf:shift(n)
+	else
+		buf:rewind()
+	end
+
+	-- rotate after the write, so the records always land in the file
+	-- they were encoded for.
+	if log_type == TO_FILE and log_flimit > 0 and log_fsize >= log_flimit then
+		rotate()
+	end
+end
+
+-- {records=, dropped=, flushes=, pending=}
+function M.stats()
+	return {
+		records = log_nrecords,
+		dropped = log_ndropped,
+		flushes = log_nflushes,
+		pending = #log_buf,
+	}
 end
 
 -- reopen the logging file (for log-splitting)
 function M.reopen()
 	if log_type == TO_FILE then
+		M.flush()
 		os.close(log_fd)
 		log_fsize = 0
 		log_fd = os.open(log_path, os.O_WRONLY + os.O_APPEND)
 		if log_fd < 0 then
 			log_fd = os.creat(log_path, math.oct(644))
 		end
+		if log_binary then
+			log_fmtids = {}
+			log_nfmt = 0
+			if log_fd >= 0 and os.lseek(log_fd, 0, os.SEEK_END) == 0 then
+				log_buf:putstr(BINARY_MAGIC)
+			end
+		end
 	end
 end
 
@@ -167,6 +357,8 @@ function M.capture(sockpath, level)
 	if log_type ~= TO_SOCKET then
 		local fd = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
 		if socket.connect(fd, sockpath) == 0 then
+			M.flush()
+			os.setnonblock(fd)
 			bak_fd = log_fd
 			bak_type = log_type
 			bak_level = log_level
@@ -182,6 +374,7 @@ end
 
 function M.release()
 	if log_type == TO_SOCKET then
+		M.flush()
 		os.close(log_fd)
 		log_fd = bak_fd
 		log_level = bak_level
@@ -190,10 +383,41 @@ function M.release()
 end
 
 local buf_putstr = buffer.putstr
+local buf_putlstr = buffer.putlstr
+local buf_putlist = buffer.putlist
 local time_strftime = time.strftime
 local time = time.time
+local floor = math.floor
+local select, type = select, type
 local os = os
 
+local function _logb(buf, level, fmt, ...)
+	local id = 0
+	if log_fmts[fmt] then
+		id = log_fmtids[fmt]
+		if not id then
+			id = 0
+			if log_nfmt < 0xffff then
+				log_nfmt = log_nfmt + 1
+				id = log_nfmt
+				log_fmtids[fmt] = id
+				buf_putlist(buf, 'cw', 70, id)		-- 'F'
+				buf_putlstr(buf, fmt)
+			end
+		end
+	end
+
+	local now = tasklet and tasklet.now_unix or time()
+	local sec = floor(now)
+	if id > 0 then
+		buf_putlist(buf, 'cuwcwc', 82, sec, floor((now - sec) * 1000), level, id, select('#', ...))	-- 'R'
+		buf_putlstr(buf, ...)
+	else
+		buf_putlist(buf, 'cuwcwc', 82, sec, floor((now - sec) * 1000), level, 0, select('#', ...) + 1)
+		buf_putlstr(buf, fmt, ...)
+	end
+end
+
 local function _log(level, ...)
 	if log_type == TO_NULL then
 		return
@@ -201,6 +425,21 @@ local function _log(level, ...)
 
 	local withcolor = false
 	local buf = log_buf
+	local start = #buf
+
+	if start >= log_bufmax then
+		log_ndropped = log_ndropped + 1
+		return
+	end
+
+	if log_binary and log_type == TO_FILE then
+		_logb(buf, level, ...)
+		log_nrecords = log_nrecords + 1
+		if not log_batched or #buf >= log_flushsiz or level == LEVEL_FATAL then
+			M.flush()
+		end
+		return
+	end
 
 	if (log_type == TO_STDERR or log_type == TO_SOCKET) and log_withcolor then
 		withcolor = true
@@ -219,20 +458,25 @@ local function _log(level, ...)
 		buf_putstr(buf, COLOR_SUFFIX)
 	end
 	buf_putstr(buf, '\n')
+	log_nrecords = log_nrecords + 1
 
-	if log_type == TO_STDERR then
-		os.writeb(2, buf)
-	elseif log_fd >= 0 then
-		if log_type == TO_FILE and log_flimit > 0 then
-			if log_fsize >= log_flimit then
-				os.lseek(log_fd, 0, os.SEEK_SET)
-				log_fsize = 0
-			end
-		end
-		os.writeb(log_fd, buf)
-		log_fsize = log_fsize + #buf
+	if not log_batched or #buf >= log_flushsiz or level == LEVEL_FATAL then
+		M.flush()
 	end
-	buf:rewind()
+end
+
+-- Declare 'str' as a constant format, the first argument of a record, to be
+-- written only once per binary log file. Messages built at run time must not
+-- be declared, or each of them takes a format id.
+--
+-- Return str
+--
+-- SAMPLE:
+--	local FMT_CONN = log.fmt('connection from ')
+--	log.info(FMT_CONN, addr)
+function M.fmt(str)
+	log_fmts[str] = true
+	return str
 end
 
 function M.debug(...)
@@ -48,50 +48,46 @@ function M.start_unserver_task(path, cb)
 	end, 'unserver@' .. path)
 end
 
--- there is a simple text protocol between the ctlserver and the ctltool
--- 
--- REQUEST = 
--- 		command \r\n
--- 		number of parameters \r\n
---		length of parameter1 \r\n
---		parameter1 \r\n
---		length of parameter2 \r\n 
+-- there is a simple binary protocol between the ctlserver and the ctltool,
+-- all the integers are 32-bit unsigned in network byte order.
+--
+-- FRAME =
+--		length of the rest \
+--		id \
+--		payload
+--
+-- REQUEST payload =
+--		number of strings \
+--		length of command \
+--		command \
+--		length of parameter1 \
+--		parameter1 \
 --		...
 --		parameterN
 --
--- RESPONSE = 
---		errcode \r\n
---		number of return values \r\n
---		length of value1 \r\n
---		value1 \r\n
---		length of value2 \r\n
+-- RESPONSE payload =
+--		errcode \
+--		number of return values \
+--		length of value1 \
+--		value1 \
 --		...
---		valueN \r\n
--- 
--- take ADD(1 + 20 + 300) for example 
+--		valueN
+--
+-- The response carries the id of its request, the client may send several
+-- requests without waiting, each of them is handled in its own task and the
+-- responses are sent in the order they complete.
+--
+-- take ADD(1 + 20 + 300) with id 7 for example
 --	SEND >>>
--- 		add \r\n
---		3 \r\n
---		1 \r\n
---		1 \r\n
---		2 \r\n
---		20 \r\n
---		3 \r\n
---		300 \r\n
+--		33 7 4 3 'add' 1 '1' 2 '20' 3 '300'
 --  RECV <<<
---		0 \r\n
---		1 \r\n
---		3 \r\n
---		321 \r\n
+--		19 7 0 1 3 '321'
+local CTL_MAX_FRAME = 64 * 1024
+
 function M.start_ctlserver_task(commands, path)
 	require 'tasklet.channel.streamserver'
 	require 'tasklet.channel.stream'
 	
-	local fd = -1
-	
-	-- XXX: there may be some risk to share one write-buffer among all the connections
-	local tmpbuf = tmpbuf
-	
 	local builtin_commands = {
 		logreopen = function (argv)
 			log.reopen()
@@ -112,6 +108,113 @@ function M.start_ctlserver_task(commands, path)
 			return 0
 		end,
 		
+		logstat = function ()
+			local st = log.stats()
+			return 0, {
+				'records ' .. st.records,
+				'dropped ' .. st.dropped,
+				'flushes ' .. st.flushes,
+				'pending ' .. st.pending,
+			}
+		end,
+		
+		metrics = function (argv)
+			tasklet.collect_metrics()
+			if argv[1] == 'prometheus' then
+				return 0, metrics.prometheus(buffer.new()):str()
+			end
+			
+			local lines = {}
+			for name, m in pairs(metrics.snapshot()) do
+				if m.type == 'histogram' then
+					table.insert(lines, string.format('%s count=%d sum=%.6g p50=%.6g p99=%.6g',
+						name, m.count, m.sum, m.p50, m.p99))
+				else
+					table.insert(lines, string.format('%s %.17g', name, m.value))
+				end
+			end
+			table.sort(lines)
+			return 0, lines
+		end,
+		
+		-- profile start [interval]|stop <file>
+		profile = function (argv)
+			local op = argv[1]
+			if op == 'start' then
+				return tasklet.start_sampling(tonumber(argv[2]))
+			elseif op == 'stop' and argv[2] then
+				local err, nsamples = tasklet.stop_sampling(argv[2])
+				return err, nsamples .. ' samples written into ' .. argv[2]
+			else
+				return errno.EINVAL
+			end
+		end,
+		
+		-- taskprof start|stop|reset, or dump the stats without arguments
+		taskprof = function (argv)
+			local op = argv[1]
+			if op == 'start' or op == 'stop' then
+				tasklet.set_profiling(op == 'start')
+				return 0
+			elseif op == 'reset' then
+				tasklet.profile_reset()
+				return 0
+			elseif op then
+				return errno.EINVAL
+			end
+			
+			local names = {}
+			local stats = tasklet.profile_stats()
+			for name in pairs(stats) do
+				table.insert(names, name)
+			end
+			table.sort(names, function (a, b) return stats[a].cpu > stats[b].cpu end)
+			
+			local lines = {}
+			for _, name in ipairs(names) do
+				local entry = stats[name]
+				local line = string.format('%s resumes=%d cpu=%.6f maxcpu=%.6f', 
+					name, entry.resumes, entry.cpu, entry.maxcpu)
+				for kind, sec in pairs(entry.blocked) do
+					line = line .. string.format(' %s=%.3f', kind, sec)
+				end
+				table.insert(lines, line)
+			end
+			return 0, lines
+		end,
+		
+		-- sched [reset], dump the scheduler statistics of each priority class
+		sched = function (argv)
+			if argv[1] == 'reset' then
+				tasklet.sched_reset()
+				return 0
+			elseif argv[1] then
+				return errno.EINVAL
+			end
+			
+			local lines = {}
+			for _, st in ipairs(tasklet.sched_stats()) do
+				table.insert(lines, string.format('%s budget=%s resumed=%d deferred=%d maxwait=%.6f',
+					st.name, st.budget or 'unlimited',
+					st.resumed, st.deferred, st.maxwait))
+			end
+			return 0, lines
+		end,
+		
+		-- gc [reset], dump the statistics of the GC steps run by the loop
+		gc = function (argv)
+			if argv[1] == 'reset' then
+				tasklet.gc_reset()
+				return 0
+			elseif argv[1] then
+				return errno.EINVAL
+			end
+
+			local st = tasklet.gc_stats()
+			return 0, string.format('kbytes=%d cycles=%d idle_cycles=%d steps=%d seconds=%.6f maxstep=%.6f',
+				st.kbytes, st.cycles, st.idle_cycles, st.steps, st.seconds, st.maxstep)
+		end,
+		
 		ping = function ()
 			return 0, 'pong'
 		end,
@@ -140,91 +243,104 @@ function M.start_ctlserver_task(commands, path)
 		end
 	end
 	
+	-- return id, cmd, argv or nothing if the connection is broken
 	local function getreq(ch)
-		local cmd = ch:read()
-		local argc = ch:read()
-		argc = tonumber(argc)
-		
-		if not cmd or not argc then
+		local rd = ch:read(4)
+		local len = rd and rd:getu()
+		if not len or len < 8 or len > CTL_MAX_FRAME then
 			return
 		end
-		
-		local argv = {}
-		for i = 1, argc do 
-			local len = ch:read()
-			len = tonumber(len)
-			if not len then return end
-			
-			local rd = ch:read(len)
-			if not rd then return end
-			
-			table.insert(argv, rd:str())
-			ch:read()
+
+		rd = ch:read(len)
+		if not rd then
+			return
 		end
-		return cmd, argv
+
+		local id, argc = rd:getu(2)
+		local strs = {}
+		for i = 1, argc do
+			local n = rd:getu()
+			-- getlstr(0) returns nil
+			local str = n == 0 and '' or (n and rd:getlstr(n))
+			if not str or #str ~= n then
+				return
+			end
+			strs[i] = str
+		end
+		local cmd = table.remove(strs, 1)
+		if not cmd then
+			return
+		end
+		return id, cmd, strs
 	end
-	
-	local function putresp(ch, err, retv)
-		tmpbuf:rewind():putstr(tostring(err), '\r\n')
+
+	local function putresp(conn, id, err, retv)
+		local wbuf = conn.wbuf
+		local mark = wbuf:beginlen()
 		local rtype = type(retv)
 		if rtype == 'nil' then
-			tmpbuf:putstr('0\r\n')
+			wbuf:putu(id, err, 0)
 		elseif rtype ~= 'table' then
-			retv = tostring(retv)
-			tmpbuf:putstr('1\r\n', #retv, '\r\n', retv, '\r\n')
+			wbuf:putu(id, err, 1):putlstr(retv)
 		else
-			tmpbuf:putstr(#retv, '\r\n')
-			for _, v in ipairs(retv) do 
-				v = tostring(v)
-				tmpbuf:putstr(#v, '\r\n', v, '\r\n')
+			wbuf:putu(id, err, #retv)
+			for _, v in ipairs(retv) do
+				wbuf:putlstr(v)
 			end
 		end
-		
-		-- The following is a little bit UGLY.
-		-- 'tmpbuf' is used so we can't block the task here(and this is unlike to happen when data is transfered
-		-- through unix-domain socket), thus  we use os.writeb instread of ch:write.
-		local all = #tmpbuf
-		local done = 0
-		local count = 0
-		while done < all and count < 3 do
-			local n, err = os.writeb(ch.ch_fd, tmpbuf, done)
-			if err ~= 0 then
+		wbuf:endlen(mark)
+
+		-- the first task with a response to send writes for all the others
+		if conn.writing then
+			return
+		end
+		conn.writing = true
+		local ch = conn.ch
+		while #conn.wbuf > 0 do
+			local out = conn.wbuf
+			conn.wbuf, conn.obuf = conn.obuf, out
+			local werr = ch:write(out)
+			out:rewind()
+			if werr ~= 0 then
 				break
 			end
-			done = done + n
-			if err ~= 0 then
-				time.sleep(0.1)
-				count = count + 1
-			end
 		end
+		conn.writing = false
 	end
-	
+
 	local function ctl_loop(fd)
-		local ch = tasklet.create_stream_channel(fd, 1024)
-		local captured = false
+		local conn = {
+			ch = tasklet.create_stream_channel(fd, CTL_MAX_FRAME),
+			wbuf = buffer.new(),  -- responses not sent yet
+			obuf = buffer.new(),  -- responses being sent
+			writing = false,
+			captured = false,
+		}
+		local ch = conn.ch
 		while true do 
-			local cmd, argv = getreq(ch)
-			if not cmd then
+			local id, cmd, argv = getreq(ch)
+			if not id then
 				break
 			end
 			
-			local err, retv = errno.ENOSYS
-			if commands[cmd] then
-				err, retv = commands[cmd](argv)
-			end
-			err = err or 0
-			if err == 0 then
-				if cmd == 'logcapture' then
-					captured = true
-				elseif cmd == 'logrelease' then
-					captured = false
+			tasklet.start_task(function ()
+				local err, retv = errno.ENOSYS
+				if commands[cmd] then
+					err, retv = commands[cmd](argv)
 				end
-			end
-			
-			putresp(ch, err, retv)
+				err = err or 0
+				if err == 0 then
+					if cmd == 'logcapture' then
+						conn.captured = true
+					elseif cmd == 'logrelease' then
+						conn.captured = false
+					end
+				end
+				putresp(conn, id, err, retv)
+			end, {t_name = 'general-ctlserver-req', t_prio = tasklet.PRIO_HIGH})
 		end
 		ch:close()
-		if captured then
+		if conn.captured then
 			log.release()
 		end
 	end
@@ -233,11 +349,14 @@ function M.start_ctlserver_task(commands, path)
 	if not path:find('/') then
 		path = '/tmp/' .. path .. '.sock'
 	end
-	return M.start_unserver_task(path, function (fd)
+	-- the control plane must stay responsive however busy the application is
+	local ch_server, task = M.start_unserver_task(path, function (fd)
 		tasklet.start_task(function ()
 			ctl_loop(fd)
-		end, 'general-ctlserver-conn')
+		end, {t_name = 'general-ctlserver-conn', t_prio = tasklet.PRIO_HIGH})
 	end)
+	tasklet.set_priority(task, tasklet.PRIO_HIGH)
+	return ch_server, task
 end
 
 local function parse_flimit(value)
@@ -294,21 +413,45 @@ function M.run(opts, cb_preloop)
 	log.init({
 		path = logpath,
 		level = opts.loglevel or (DEBUG and 'debug' or 'info'),
-		flimit = opts.logflimit and parse_flimit(opts.logflimit) or 31 * 1024
+		flimit = opts.logflimit and parse_flimit(opts.logflimit) or 31 * 1024,
+		rotate = tonumber(opts.logrotate),
+		compress = opts.logcompress,
 	})
 	M.DEBUG = DEBUG
 	log.info('application started with pid ', pid)
+
+	-- I/O backend('epoll' or 'uring'), selected before cb_preloop creates channels
+	if opts.backend then
+		log.info('I/O backend: ', tasklet.set_backend(opts.backend))
+	end
+
+	-- GC tuning, e.g. {gc_idle=64} to collect garbage in idle time(see tasklet.set_gc)
+	if opts.gc_mode or opts.gc_pause or opts.gc_stepmul or opts.gc_idle then
+		local err = tasklet.set_gc({
+			mode = opts.gc_mode,
+			pause = opts.gc_pause,
+			stepmul = opts.gc_stepmul,
+			idle = opts.gc_idle,
+			after = opts.gc_idle_after,
+			slice = opts.gc_idle_slice,
+		})
+		if err ~= 0 then
+			log.error('failed to set GC mode ', opts.gc_mode, ': ', errno.strerror(err))
+		end
+	end
 	
 	-- signals 
 	signal.signal(signal.SIGTERM, function ()
 		log.info('got SIGTERM, terminating ...')
+		log.flush()
 		tasklet.term() 
 	end)
 	signal.signal(signal.SIGQUIT, function ()
 		log.info('got SIGQUIT, quitting ...')
+		log.flush()
 		tasklet.quit() 
 	end)
-	signal.signal(signal.SIGINT, function () tasklet.term() end)
+	signal.signal(signal.SIGINT, function () log.flush() tasklet.term() end)
 	
 	-- looping and cleanup
 	if cb_preloop then
@@ -330,6 +473,7 @@ function M.run(opts, cb_preloop)
 		end
 		exitcode = 1
 	end
+	log.flush()
 	fs.unlink(pidfile)
 	
 	return exitcode
@@ -13,83 +13,135 @@ local stdin = io.stdin
 local stdout = io.stdout
 local stderr = io.stderr
 
-local function putreq(cmd, argv)
-	tmpbuf:rewind():putstr(cmd, '\r\n')
+local rbuf = buffer.new()
+local last_id = 0
+
+-- responses received while waiting for another one, {[id] = {err, retv}}
+local pending = {}
+
+local function connect()
+	fd = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+	os.setnonblock(fd)
+	local err = socket.connect(fd, '/tmp/' .. appctl.APPNAME .. '.sock')
+	if err ~= 0 then
+		if err == errno.EINPROGRESS and poll.waitfd(fd, 'rw', 1) then
+			err = socket.getsocketopt(fd, socket.SO_ERROR)
+		end
+	end
+	if err ~= 0 then
+		stderr:write('failed to connect ', appctl.APPNAME, ', abort\n')
+		os.exit(1)
+	end
+end
+
+-- see the comments of app.start_ctlserver_task for the protocol
+local function putreq(id, cmd, argv)
+	local mark = tmpbuf:rewind():beginlen()
 	if argv == nil then
-		tmpbuf:putstr('0\r\n')
+		tmpbuf:putu(id, 1):putlstr(cmd)
 	elseif type(argv) ~= 'table' then
-		argv = tostring(argv)
-		tmpbuf:putstr('1\r\n', #argv, '\r\n', argv, '\r\n')
+		tmpbuf:putu(id, 2):putlstr(cmd, argv)
 	else
-		tmpbuf:putstr(#argv, '\r\n')
+		tmpbuf:putu(id, #argv + 1):putlstr(cmd)
 		for _, v in ipairs(argv) do 
-			v = tostring(v)
-			tmpbuf:putstr(#v, '\r\n', v, '\r\n')
+			tmpbuf:putlstr(v)
 		end
 	end
+	tmpbuf:endlen(mark)
 	
-	local nwritten, err = os.writeb(fd, tmpbuf)
-	return err
+	local all = #tmpbuf
+	local done = 0
+	while done < all do
+		local nwritten, err = os.writeb(fd, tmpbuf, done)
+		if err ~= 0 then
+			return err
+		end
+		done = done + nwritten
+		if done < all and not poll.waitfd(fd, 'w', 1) then
+			return errno.ETIMEDOUT
+		end
+	end
+	return 0
 end
 
-local function getresp()
-	local nread, err = os.readb(fd, tmpbuf:rewind())
-	if err ~= 0 then
+-- return id, err, retv of a complete response frame in 'rbuf' or nothing
+local function getframe()
+	if #rbuf < 4 then
 		return
 	end
-
-	local err = tonumber(tmpbuf:getline())
-	local retc = tonumber(tmpbuf:getline())
-
-	if not err or not retc then
+	local len = rbuf:reader():getu()
+	if #rbuf < 4 + len then
 		return
 	end
-	
+
+	local rd = rbuf:reader(nil, 4, len)
+	local id, err, retc = rd:getu(3)
 	local retv = {}
-	for i = 1, retc do 
-		local len = tonumber(tmpbuf:getline())
-		if not len then return end
-		
-		local ret = tmpbuf:getlstr(len)
-		if not ret then return end
-		
-		table.insert(retv, ret)
-		tmpbuf:getline()
+	for i = 1, retc or 0 do 
+		local n = rd:getu()
+		retv[i] = n == 0 and '' or (n and rd:getlstr(n))
 	end
-	return err, retv
+	rbuf:shift(4 + len)
+	return id, err, retv
 end
 
-function appctl.invoke(cmd, argv)
-	if fd < 0 then
-		fd = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-		os.setnonblock(fd)
-		local err = socket.connect(fd, '/tmp/' .. appctl.APPNAME .. '.sock')
-		if err ~= 0 then
-			if err == errno.EINPROGRESS and poll.waitfd(fd, 'rw', 1) then
-				err = socket.getsocketopt(fd, socket.SO_ERROR)
+-- return err, retv of the response to request 'id', nothing if the
+-- connection is broken or timed out
+local function getresp(id, sec)
+	local resp = pending[id]
+	if resp then
+		pending[id] = nil
+		return resp[1], resp[2]
+	end
+
+	while true do
+		local rid, err, retv = getframe()
+		if rid == id then
+			return err, retv
+		elseif rid then
+			pending[rid] = {err, retv}
+		else
+			if not poll.waitfd(fd, 'r', sec) then
+				return
+			end
+			local nread, rerr = os.readb(fd, rbuf)
+			if nread == 0 or rerr ~= 0 then
+				return
 			end
-		end
-		if err ~= 0 then
-			stderr:write('failed to connect ', appctl.APPNAME, ', abort\n')
-			os.exit(1)
 		end
 	end
-	
-	putreq(cmd, argv)
-	if not poll.waitrfd(fd, 1) then
-		stderr:write('timed out for the response, abort\n')
+end
+
+-- Send a request without waiting for its response, return the request id
+-- to be passed to appctl.recv, several requests can be in flight.
+function appctl.send(cmd, argv)
+	if fd < 0 then
+		connect()
+	end
+
+	last_id = last_id + 1
+	if putreq(last_id, cmd, argv) ~= 0 then
+		stderr:write('connection error, abort\n')
 		os.exit(1)
 	end
-	
-	local err, retv = getresp()
+	return last_id
+end
+
+-- Wait for the response to request 'id' for at most 'sec' seconds(defaulted
+-- to 1), return err, retv.
+function appctl.recv(id, sec)
+	local err, retv = getresp(id, sec or 1)
 	if not err then
-		stderr:write('connection error, abort\n')
+		stderr:write('timed out for the response or connection error, abort\n')
 		os.exit(1)
 	end
-	
 	return err, retv
 end
 
+function appctl.invoke(cmd, argv)
+	return appctl.recv(appctl.send(cmd, argv))
+end
+
 local capturing = false
 local builtin_commands = {
 	help = function () 
@@ -273,6 +273,15 @@ local function request_read_startline(req, ch, sec)
 		return -1
 	end
 	
+	-- the request object is reused on a keep-alive connection
+	local headers, params = req.headers, req.params
+	for k in pairs(headers) do
+		headers[k] = nil
+	end
+	for k in pairs(params) do
+		params[k] = nil
+	end
+
 	urlpath = urlinfo.path
 	req.method = method
 	req.urlinfo = urlinfo
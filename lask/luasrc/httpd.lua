@@ -1,5 +1,6 @@
 
 local tasklet = require 'tasklet.channel.streamserver'
+require 'tasklet.offload'
 local log = require 'log'
 local urlparse = require 'urlparse'
 local http = require 'http'
@@ -9,6 +10,7 @@ local zlib = require 'zlib'
 local type, tostring, tonumber = type, tostring, tonumber
 local strfmt = string.format
 local current_task = tasklet.current_task
+local block_task, resume_task = tasklet._block_task, tasklet._resume_task
 local reasons = http.reasons
 
 local http_close
@@ -156,17 +158,170 @@ local function send_file_content(conn, fd, fsize, zstream)
 	end
 end
 
-local function reply_file(conn, fd, fsize, mtime, mime_type)
+-- Parsed If-Modified-Since/If-Range dates, clients keep sending the same few
+-- values(the Last-Modified they got before), so strptime is done once for each.
+-- HTTP dates are in GMT, whatever the local time zone is.
+local date_cache = {}
+local date_cache_size = 0
+
+local function parse_http_date(str)
+	local tstamp = date_cache[str]
+	if tstamp == nil then
+		tstamp = time.strptime(str, '%a, %d %b %Y %H:%M:%S GMT', true) or false
+		if date_cache_size >= 256 then
+			date_cache = {}
+			date_cache_size = 0
+		end
+		date_cache[str] = tstamp
+		date_cache_size = date_cache_size + 1
+	end
+	return tstamp
+end
+
+-- Content hashes of the static files for settings.etag = 'hash',
+-- {[filepath] = {ino=, mtime=, size=, etag=}}
+local hash_cache = {}
+local hash_cache_size = 0
+
+-- {[filepath] = {task1, ...}}, the requests waiting for a file being hashed
+local hash_waiters = {}
+
+-- A file is hashed once by the offload workers, the loop keeps serving the other
+-- connections meanwhile(firmware images are hundreds of MB), the requests for
+-- the same file wait for the same hash.
+--
+-- It's read rather than mapped, a file truncated meanwhile can't SIGBUS.
+local function hash_file(filepath, filest)
+	local entry = hash_cache[filepath]
+	if not (entry and entry.ino == filest.ino and entry.mtime == filest.mtime and entry.size == filest.size) then
+		local waiters = hash_waiters[filepath]
+		if waiters then
+			local task = current_task()
+			waiters[#waiters + 1] = task
+			if block_task(-1) ~= 0 then
+				for i = 1, #waiters do
+					if waiters[i] == task then
+						table.remove(waiters, i)
+						break
+					end
+				end
+				return
+			end
+		else
+			waiters = {}
+			hash_waiters[filepath] = waiters
+			local digest = tasklet.offload('hashfile', filepath, 'xxh64')
+			hash_waiters[filepath] = nil
+
+			if digest then
+				if hash_cache_size >= 128 then
+					hash_cache = {}
+					hash_cache_size = 0
+				end
+				hash_cache[filepath] = {ino = filest.ino, mtime = filest.mtime, size = filest.size, etag = '"' .. digest .. '"'}
+				hash_cache_size = hash_cache_size + 1
+			end
+			for _, task in ipairs(waiters) do
+				resume_task(task)
+			end
+		end
+
+		entry = hash_cache[filepath]
+		if not (entry and entry.ino == filest.ino and entry.mtime == filest.mtime and entry.size == filest.size) then
+			return
+		end
+	end
+	return entry.etag
+end
+
+-- ETag of a static file according to settings.etag:
+--	false       no ETag
+--	'hash'      hash of the content(cached until the file changes)
+--	others/nil  inode, mtime and size
+-- It's weak if the file is sent gzipped.
+local function file_etag(mode, filepath, filest, gzip)
+	local etag
+	if mode == false then
+		return
+	elseif mode == 'hash' then
+		etag = hash_file(filepath, filest)
+	else
+		etag = strfmt('"%x-%x-%x"', filest.ino, filest.mtime, filest.size)
+	end
+	if etag and (gzip or mode == 'weak') then
+		etag = 'W/' .. etag
+	end
+	return etag
+end
+
+-- Whether If-None-Match matches 'etag'(weak comparison)
+local function etag_match(value, etag)
+	if value:match('^%s*%*%s*$') then
+		return true
+	end
+	etag = etag:match('^W/(.*)$') or etag
+	for tag in value:gmatch('"[^"]*"') do
+		if tag == etag then
+			return true
+		end
+	end
+	return false
+end
+
+-- Parse a single 'bytes' range of a file of 'size' bytes, return
+--	first, last  the range
+--	nil          not supported(multiple ranges, other units) or malformed, ignored
+--	false        not satisfiable
+local function parse_range(value, size)
+	local first, last = value:match('^%s*bytes%s*=%s*(%d*)%s*%-%s*(%d*)%s*$')
+	if not first or (first == '' and last == '') then
+		return nil
+	end
+
+	if first == '' then
+		-- the last N bytes
+		local n = tonumber(last)
+		if n == 0 or size == 0 then
+			return false
+		end
+		return size > n and size - n or 0, size - 1
+	end
+
+	first = tonumber(first)
+	last = last == '' and size - 1 or tonumber(last)
+	if first >= size then
+		return false
+	elseif last < first then
+		return nil
+	end
+	return first, last < size and last or size - 1
+end
+
+-- 'first' and 'last' are given for a 206 response
+local function reply_file(conn, fd, fsize, mtime, mime_type, first, last)
 	local headers = conn.headers
-	local zstream = fd >= 0 and mime_type:find('^text')
+	local zstream = fd >= 0 and not first and mime_type:find('^text')
 
 	headers['Content-Type'] = mime_type
-	headers['Date'] = time.strftime("%a, %d %b %Y %H:%M:%S GMT", time.time())
-	headers['Last-Modified'] = time.strftime("%a, %d %b %Y %H:%M:%S GMT", mtime)
+	headers['Date'] = time.strftime("%a, %d %b %Y %H:%M:%S GMT", time.time(), true)
+	headers['Last-Modified'] = time.strftime("%a, %d %b %Y %H:%M:%S GMT", mtime, true)
 
 	if zstream then
 		zstream = zlib.deflate_init()
 		conn.zstream = zstream
+	else
+		headers['Accept-Ranges'] = 'bytes'
+	end
+	if first then
+		headers['Content-Range'] = strfmt('bytes %d-%d/%d', first, last, fsize)
+		fsize = last - first + 1
+		if first > 0 then
+			local _, err = os.lseek(fd, first, os.SEEK_SET)
+			if err ~= 0 then
+				http_error(conn, 500, 'failed to seek file:' .. errno.strerror(err))
+				return
+			end
+		end
 	end
 	if not zstream then
 		headers['Content-Length'] = fsize
@@ -175,13 +330,15 @@ local function reply_file(conn, fd, fsize, mtime, mime_type)
 	send_headers(conn)
 	if fd >= 0 then
 		send_file_content(conn, fd, fsize, zstream)
-		zlib.deflate_end(zstream)
-		conn.zstream = false
+		if zstream then
+			zlib.deflate_end(zstream)
+			conn.zstream = false
+		end
 		conn.body = -1
 	end
 end
 
-local function serve_static(conn, doc_root, doc_path, follow_link, if_modified_since)
+local function serve_static(conn, doc_root, doc_path, follow_link)
 	local filepath = doc_path and fs.realpath(doc_root .. doc_path)
 	local status = 200
 	local filest
@@ -216,8 +373,28 @@ local function serve_static(conn, doc_root, doc_path, follow_link, if_modified_s
 		end
 	end
 
-	if status == 200 and if_modified_since then
-		local tstamp = time.strptime(if_modified_since, '%a, %d %b %Y %H:%M:%S %Z')
+	if status ~= 200 then
+		http_error(conn, status)
+		return
+	end
+
+	local req_headers = conn.req.headers
+	local mime_type = http.get_content_type(filepath)
+	local gzip = mime_type:find('^text') ~= nil
+	local etag = file_etag(conn.settings.etag, filepath, filest, gzip)
+	if etag then
+		conn.headers['ETag'] = etag
+	end
+
+	-- If-None-Match takes precedence over If-Modified-Since
+	local if_none_match = req_headers['if-none-match']
+	local if_modified_since = req_headers['if-modified-since']
+	if if_none_match then
+		if etag and etag_match(if_none_match, etag) then
+			status = 304
+		end
+	elseif if_modified_since then
+		local tstamp = parse_http_date(if_modified_since)
 		if not tstamp then
 			http_error(conn, 400, 'malformed value for If-Modified-Since header: ' .. if_modified_since)
 			return
@@ -227,26 +404,50 @@ local function serve_static(conn, doc_root, doc_path, follow_link, if_modified_s
 		end
 	end
 
-	if status == 200 or status == 304 then
-		local fd = -1
-		if status == 200 then
-			local err
-			fd, err = os.open(filepath, os.O_RDONLY)
-			if fd < 0 then
-				http_error(conn, 500, 'failed to open file:' .. errno.strerror(err))
+	-- a single range of files not gzipped, if the validator in If-Range(if any) still holds
+	local first, last
+	local range = status == 200 and not gzip and req_headers['range']
+	if range then
+		local if_range = req_headers['if-range']
+		local valid = true
+		if if_range then
+			if if_range:find('"') then
+				valid = etag ~= nil and not etag:find('^W/') and if_range == etag
+			else
+				valid = parse_http_date(if_range) == filest.mtime
+			end
+		end
+		if valid then
+			first, last = parse_range(range, filest.size)
+			if first == false then
+				conn.status = 416
+				conn.headers['Content-Range'] = 'bytes */' .. filest.size
+				conn.headers['Content-Length'] = 0
+				send_headers(conn)
+				conn.body = -1
 				return
+			elseif first then
+				status = 206
 			end
-			conn.fd = fd
 		end
+	end
 
-		conn.status = status
-		reply_file(conn, fd, filest.size, filest.mtime, http.get_content_type(filepath))
-		if fd >= 0 then
-			os.close(fd)
-			conn.fd = -1
+	local fd = -1
+	if status ~= 304 then
+		local err
+		fd, err = os.open(filepath, os.O_RDONLY)
+		if fd < 0 then
+			http_error(conn, 500, 'failed to open file:' .. errno.strerror(err))
+			return
 		end
-	else
-		http_error(conn, status)
+		conn.fd = fd
+	end
+
+	conn.status = status
+	reply_file(conn, fd, filest.size, filest.mtime, mime_type, first, last)
+	if fd >= 0 then
+		os.close(fd)
+		conn.fd = -1
 	end
 end
 
@@ -254,7 +455,7 @@ function M.serve_static(doc_root, doc_path, follow_link)
 	local conn = current_task()
 	local req = conn.req
 	doc_path = doc_path or req.urlinfo.path
-	serve_static(conn, doc_root or conn.settings.doc_root, doc_path, follow_link, req.headers['if-modified-since'])
+	serve_static(conn, doc_root or conn.settings.doc_root, doc_path, follow_link)
 end
 
 function M.redirect(url, params)
@@ -336,6 +537,21 @@ function M.echo_json(val)
 	http_close(conn, 0)
 end
 
+-- Reply all the metrics(see metrics.prometheus) in the Prometheus text format
+function M.serve_metrics()
+	local conn = current_task()
+	if conn.sent_headers then
+		http_close(conn, -1)
+	end
+
+	tasklet.collect_metrics()
+	conn.headers['Content-Type'] = 'text/plain; version=0.0.4'
+	conn.body = metrics.prometheus(buffer.new()):str()
+	send_headers(conn)
+	send_body(conn)
+	http_close(conn, 0)
+end
+
 local function flush(conn)
 	local status = conn.status
 	if status < 200 or (status >= 300 and status < 400) then
@@ -428,10 +644,14 @@ local function conn_loop()
 		end
 		ok, errmsg = xpcall(function ()
 			local path = req.urlinfo.path
+			if path == settings.metrics_path then
+				M.serve_metrics()
+				return
+			end
 			if settings.doc_root then
 				local doc_path = settings.doc_pattern and path:match(settings.doc_pattern)
 				if doc_path then
-					serve_static(conn, settings.doc_root, doc_path, settings.follow_link, req.headers['if-modified-since'])
+					serve_static(conn, settings.doc_root, doc_path, settings.follow_link)
 					return
 				end
 			end
@@ -476,6 +696,8 @@ settings = {
 	doc_pattern = '^/static/(.*)',
 	auto_index = false,
 	follow_link = true,
+	etag = 'hash',  -- false, 'weak', 'hash' or inode+mtime+size by default
+	metrics_path = '/metrics',  -- serve the metrics for Prometheus
 }
 ]]
 function M.start_server(settings)
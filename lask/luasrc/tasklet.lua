@@ -21,11 +21,28 @@ local NULL = NULL
 
 local TERM = 3
 
+local metrics_observe = metrics.observe
+local M_BUSY = metrics.histogram('tasklet_loop_busy_seconds', 'Time spent between two polls', 1e-6)
+local M_WAIT = metrics.histogram('tasklet_poll_wait_seconds', 'Time blocked in polling', 1e-6)
+local M_DISPATCH = metrics.histogram('tasklet_dispatch_seconds', 'Time spent in event handlers and the tasks they resumed', 1e-6)
+local M_RESUMED = metrics.histogram('tasklet_resumed_tasks', 'Tasks resumed per loop iteration')
+local M_TIMERS = metrics.gauge('tasklet_timers', 'Tasks blocked with a timeout')
+
 -------------------------------------------------------------------------------
 -- variables {
 
 local poll_fd = -1
 
+-- The io_uring ring if the 'uring' backend is selected(see M.set_backend)
+local ring = false
+
+-- {[slot] = obj} and {[slot] = callback} for the in-flight io_uring operations
+local uring_objs = {}
+local uring_cbs = {}
+
+-- The io_uring slot polling poll_fd, so handlers added by add_handler work as usual
+local poll_slot = false
+
 -- {[fd]=handler} for all the registered file descriptors.
 local handler_set = {}
 
@@ -35,14 +52,76 @@ local rb_timer = rbtree.new()
 -- The current task running
 local current
 
--- Tasks that are ready to be resumed.
-local ready_list = false
+-- Priority classes, a smaller value is a higher priority
+local PRIO_HIGH = 1
+local PRIO_NORMAL = 2
+local PRIO_LOW = 3
+local PRIO_NAMES = {'high', 'normal', 'low'}
+
+-- Tasks that are ready to be resumed, one list for each priority class.
+local ready_lists = {false, false, false}
+
+-- Max resumes of each class per loop iteration(see M.set_budget), and what is
+-- left of them in the current iteration.
+local UNLIMITED = 0x7fffffff
+local budgets = {UNLIMITED, 1024, 256}
+local budget_left = {UNLIMITED, 1024, 256}
+
+-- Scheduler statistics of each class(see M.sched_stats)
+--	resumed: tasks resumed(accumulated when the budgets are refilled)
+--	deferred: loop iterations polling with tasks of the class still ready,
+--		that is, the budget was exhausted
+--	maxwait: max seconds the class had been deferred in a row
+local sched_resumed = {0, 0, 0}
+local sched_deferred = {0, 0, 0}
+local sched_maxwait = {0, 0, 0}
+
+-- When each class started to be deferred in a row, or false
+local deferred_since = {false, false, false}
 
 -- Running state
 local state = 0
 
 local cb_updatedtime = false
 
+-- Tasks resumed in the current loop iteration
+local nresumed = 0
+
+-- Per-task profiling(see M.set_profiling)
+-- {[t_name] = {resumes=, cpu=, maxcpu=, blocked={[kind]=sec}}}
+local profiling = false
+local profile = {}
+local clock_gettime, CPUTIME = time.clock_gettime, time.CLOCK_THREAD_CPUTIME_ID
+local uptime = time.uptime
+
+-- Sampling profiler(see M.start_sampling)
+local sampling = false
+local prof_enter, prof_leave = profiler.enter, profiler.leave
+
+-- Cooperative preemption(see M.set_preemption)
+local preempting = false
+local preempt_count, preempt_sec = 0, 0
+local preempt_arm = preempt.arm
+local preempt_fired = preempt.fired
+local M_PREEMPTED = metrics.counter('tasklet_preemptions', 'Tasks force-yielded for running out of the budget')
+
+-- Coroutines parked after their tasks finished, reused by start_task(see M.set_pool_size)
+local co_pool = {}
+local co_pool_num, co_pool_max = 0, 256
+local PARKED = {}  -- yielded by a coroutine going back to the pool
+local M_POOLED = metrics.gauge('tasklet_pooled_coroutines', 'Coroutines parked for reuse')
+local M_REUSED = metrics.counter('tasklet_reused_coroutines', 'Tasks started on a parked coroutine')
+
+-- Idle GC(see M.set_gc)
+local gc_idle_step = 0  -- KB passed to collectgarbage('step'), 0 means disabled
+local gc_idle_after = 0.005  -- only if the loop is going to wait longer than this
+local gc_idle_slice = 0.001  -- max seconds spent before each poll
+local gc_floor = 0  -- KB in use when the last idle cycle finished
+local gc_steps, gc_seconds, gc_maxstep = 0, 0, 0
+local gc_idle_cycles, gc_cycles = 0, 0
+local gc_counting = false
+local M_GC_STEP = metrics.histogram('tasklet_gc_step_seconds', 'Time spent in each idle GC step', 1e-6)
+
 -- Modules not driven by I/O events.
 -- Each element in the array is a callback function invoked before each I/O polling.
 local nonevent_modules = {}
@@ -61,20 +140,22 @@ local M = {
 -- } variables
 ------------------------------------------------------------------------------
 
--- Push a task into ready_list (and will be resumed later)
+-- Push a task into the ready list of its priority class (and will be resumed later)
 local function push_ready(task, err)
 	if task.t_prev then return end
 
 	-- append it into the ready list
 	task.t_err = err or 0
-	if ready_list then
-		local tail = ready_list.t_prev
+	local prio = task.t_prio or 2 -- PRIO_NORMAL
+	local head = ready_lists[prio]
+	if head then
+		local tail = head.t_prev
 		task.t_prev = tail
 		tail.t_next = task
-		ready_list.t_prev = task
+		head.t_prev = task
 	else
 		task.t_prev = task
-		ready_list = task
+		ready_lists[prio] = task
 	end
 	task.t_next = false
 
@@ -87,6 +168,33 @@ local function push_ready(task, err)
 end
 
 
+local function profile_entry(task)
+	local name = task.t_name or 'unnamed'
+	local entry = profile[name]
+	if not entry then
+		entry = {resumes = 0, cpu = 0, maxcpu = 0, blocked = {}}
+		profile[name] = entry
+	end
+	return entry
+end
+
+-- What the task is blocked by: 'channel', 'service', 'fd', 'timer' or 'other'
+local function block_kind(blockedby, sec)
+	local tby = type(blockedby)
+	if tby == 'table' then
+		if blockedby.svc_owner ~= nil then
+			return 'service'
+		elseif blockedby.ch_fd ~= nil or blockedby.ch_rtaskq ~= nil then
+			return 'channel'
+		end
+	elseif tby == 'number' then
+		return 'fd'
+	elseif not blockedby and sec and sec >= 0 then
+		return 'timer'
+	end
+	return 'other'
+end
+
 local function do_yield(sec, accept_eintr)
 	local basetime = M.now
 	local tm_elapsed
@@ -116,7 +224,14 @@ local function do_yield(sec, accept_eintr)
 			rb_timer:insert(current)
 		end
 
-		err = co_yield() or 0
+		if profiling then
+			local task, kind, tm_start = current, block_kind(current.t_blockedby, sec), uptime()
+			err = co_yield(true) or 0
+			local blocked = profile_entry(task).blocked
+			blocked[kind] = (blocked[kind] or 0) + uptime() - tm_start
+		else
+			err = co_yield(true) or 0  -- true tells do_resume it's not preempted
+		end
 		sig = current.t_sig
 		if sig then
 			current.t_sig = false
@@ -139,11 +254,41 @@ local function do_resume(task)
 	if not co then return end
 
 	current = task
-	local ok, msg = co_resume(co, task.t_err)
+	nresumed = nresumed + 1
+	if preempting then
+		preempt_arm(co, preempt_count, preempt_sec)
+	end
+	local sampled = sampling
+	if sampled then
+		prof_enter(co, task.t_name)
+	end
+
+	local ok, msg
+	if profiling then
+		local cpu = clock_gettime(CPUTIME)
+		ok, msg = co_resume(co, task.t_err)
+		cpu = clock_gettime(CPUTIME) - cpu
+
+		local entry = profile_entry(task)
+		entry.resumes = entry.resumes + 1
+		entry.cpu = entry.cpu + cpu
+		if cpu > entry.maxcpu then
+			entry.maxcpu = cpu
+		end
+	else
+		ok, msg = co_resume(co, task.t_err)
+	end
+	if sampled then
+		prof_leave()
+	end
 	current = nil
 
-	if co_status(co) == 'dead' then
+	if msg == PARKED or co_status(co) == 'dead' then
 		task.t_co = false
+		if msg == PARKED and co_pool_num < co_pool_max then
+			co_pool_num = co_pool_num + 1
+			co_pool[co_pool_num] = co
+		end
 		local parent = task.t_parent
 		if parent then
 			local nsubs = parent.t_nsubs
@@ -158,6 +303,19 @@ local function do_resume(task)
 				parent.t_nsubs = nsubs
 			end
 		end
+	elseif preempting and ok and preempt_fired(co) then
+		-- force-yielded by the preemption hook, it's still ready to run
+		local n = (task.t_npreempted or 0) + 1
+		task.t_npreempted = n
+		metrics.add(M_PREEMPTED)
+		if n == 1 or n == 10 or n == 100 or n % 1000 == 0 then
+			require('log').warn('task ', task.t_name or tostring(task), ' preempted(', n,
+				' times) for running out of the budget')
+		end
+		push_ready(task)
+
+		-- the iteration has taken long enough, poll before resuming more tasks of this class
+		budget_left[task.t_prio or PRIO_NORMAL] = 0
 	end
 
 	if not ok and not task.t_sig then
@@ -169,29 +327,116 @@ local function do_resume(task)
 	end
 end
 
--- Resume all tasks in ready_list
+-- Whether any class has ready tasks and budget left
+local function runnable()
+	return (ready_lists[PRIO_HIGH] and budget_left[PRIO_HIGH] > 0)
+		or (ready_lists[PRIO_NORMAL] and budget_left[PRIO_NORMAL] > 0)
+		or (ready_lists[PRIO_LOW] and budget_left[PRIO_LOW] > 0)
+end
+
+-- Resume the ready tasks, the higher priority class first, until no class
+-- with ready tasks has budget left in the current loop iteration.
+--
+-- The classes are indexed by literals(1=PRIO_HIGH, 2=PRIO_NORMAL, 3=PRIO_LOW)
+-- in this hot path, upvalues would cost extra instructions.
 local function resume_list()
-	local task = ready_list
-	ready_list = false
+	local task, next, prio
+	while true do
+		prio = 1
+		task = ready_lists[1]
+		if not task or budget_left[1] <= 0 then
+			prio = 2
+			task = ready_lists[2]
+			if not task or budget_left[2] <= 0 then
+				prio = 3
+				task = ready_lists[3]
+				if not task or budget_left[3] <= 0 then
+					return
+				end
+			end
+		end
 
-	local next
-	while task do
-		while task and not quit do
-			next = task.t_next
-			task.t_prev = false
+		next = task.t_next
+		if next then
+			next.t_prev = task.t_prev
+		end
+		ready_lists[prio] = next
+		task.t_prev = false
+		budget_left[prio] = budget_left[prio] - 1
 
-			do_resume(task)
+		do_resume(task)
 
-			task = next
+		if state ==	TERM then return end
+	end
+end
 
-			if state ==	TERM then return end
-		end
+-- Refill the budgets at the beginning of a loop iteration
+local function reset_budgets()
+	for prio = PRIO_HIGH, PRIO_LOW do
+		sched_resumed[prio] = sched_resumed[prio] + budgets[prio] - budget_left[prio]
+		budget_left[prio] = budgets[prio]
+	end
+end
 
-		task = ready_list
-		ready_list = false
+-- The body of every task coroutine.
+-- Runs the 't_cb' of the task being resumed and parks the coroutine after it
+-- returns, so start_task can hand it to another task instead of creating a new
+-- one(and a new Lua stack). A task ending by an error kills its coroutine.
+local function trampoline(err)
+	while true do
+		local task = current
+		local cb = task.t_cb
+		task.t_cb = false
+		task = nil
+		cb(err)
+		cb = nil
+		err = co_yield(PARKED)
 	end
 end
 
+-- Count every finished GC cycle, idle or not, by a finalizer re-arming itself
+local function gc_sentinel()
+	setmetatable({}, {__gc = function ()
+		gc_cycles = gc_cycles + 1
+		gc_sentinel()
+	end})
+end
+
+-- Run incremental GC steps for at most gc_idle_slice seconds, before polling
+-- with nothing to do for 'wait_sec' seconds.
+--
+-- Return the time left to wait.
+local function gc_idle(wait_sec)
+	local kb = collectgarbage('count')
+	if kb - gc_floor < gc_idle_step then
+		-- little allocated since the last cycle finished
+		return wait_sec
+	end
+
+	local t0 = uptime()
+	local t, t1 = t0
+	repeat
+		local done = collectgarbage('step', gc_idle_step)
+		t1 = uptime()
+		local step = t1 - t
+		metrics_observe(M_GC_STEP, step)
+		if step > gc_maxstep then
+			gc_maxstep = step
+		end
+		gc_steps = gc_steps + 1
+		t = t1
+		if done then
+			gc_idle_cycles = gc_idle_cycles + 1
+			gc_floor = collectgarbage('count')
+			break
+		end
+	until t - t0 >= gc_idle_slice
+
+	gc_seconds = gc_seconds + (t - t0)
+	wait_sec = wait_sec - (t - t0)
+	return wait_sec > 0 and wait_sec or 0
+end
+
 -- Get the current task
 function M.current_task()
 	return current
@@ -202,7 +447,10 @@ end
 -- However, all tasks will be executed in the order they are created
 --
 -- 'cb' is the callback function.
--- 'obj' is the prototype object of task or nil
+-- 'obj' is the prototype object of task or nil, the scheduler fields(t_*,
+-- rb_key and the sighandler set by reap_task) are reset in place, so the
+-- object of a finished or reaped task can be started again.
+-- The task runs on a parked coroutine if any(see M.set_pool_size).
 --
 -- Return the modified/created task object.
 function M.start_task(cb, obj, joinable)
@@ -216,9 +464,20 @@ function M.start_task(cb, obj, joinable)
 	if joinable and current then
 		task.t_parent = current		-- parent task
 		current.t_nsubs = current.t_nsubs + 1
+	else
+		task.t_parent = false
 	end
 	task.t_nsubs = 0			-- number of children
-	task.t_co = coroutine.create(cb)  -- the lua-coroutine handle
+	task.t_prio = task.t_prio or PRIO_NORMAL	-- priority class
+	task.t_cb = cb
+	if co_pool_num > 0 then
+		task.t_co = co_pool[co_pool_num]  -- the lua-coroutine handle
+		co_pool[co_pool_num] = nil
+		co_pool_num = co_pool_num - 1
+		metrics.add(M_REUSED)
+	else
+		task.t_co = co_create(trampoline)
+	end
 	task.t_prev = false
 	task.t_next = false
 	task.t_sig = false
@@ -226,6 +485,13 @@ function M.start_task(cb, obj, joinable)
 	task.t_svcreq = false
 	task.t_svcresp = false
 	task.t_svcreqtime = false
+	task.t_err = 0
+	task.t_npreempted = 0
+	task.rb_key = false
+	-- the handler installed by reap_task, not one given by the prototype
+	if task.sighandler == M.exit then
+		task.sighandler = nil
+	end
 	push_ready(task)
 	return task
 end
@@ -297,6 +563,65 @@ end
 
 M._resume_task = push_ready
 
+M.PRIO_HIGH = PRIO_HIGH
+M.PRIO_NORMAL = PRIO_NORMAL
+M.PRIO_LOW = PRIO_LOW
+
+-- Set the priority class of a task(the current task if 'task' is nil).
+--
+-- Ready tasks of a higher class are always resumed first, e.g. PRIO_HIGH for
+-- the control-plane tasks(ctlserver, health checks) so a flood of I/O-ready
+-- tasks can't starve them, and PRIO_LOW for background jobs.
+-- Tasks are PRIO_NORMAL by default, it can also be preset as 't_prio' of the
+-- object passed to start_task.
+function M.set_priority(task, prio)
+	task = task or current
+	assert(PRIO_NAMES[prio], 'invalid priority class')
+	task.t_prio = prio
+end
+
+-- Set the max number of tasks of a class resumed per loop iteration, nil or 0
+-- means unlimited.
+--
+-- When a class runs out of its budget, its ready tasks are deferred to the next
+-- iteration, after polling(without waiting) for I/O events and expiring timers,
+-- which keeps the loop responsive however many tasks are ready.
+-- Defaulted to unlimited/1024/256 for PRIO_HIGH/PRIO_NORMAL/PRIO_LOW.
+function M.set_budget(prio, n)
+	assert(PRIO_NAMES[prio], 'invalid priority class')
+	if not n or n <= 0 or n > UNLIMITED then
+		n = UNLIMITED
+	end
+	sched_resumed[prio] = sched_resumed[prio] + budgets[prio] - budget_left[prio]
+	budgets[prio] = n
+	budget_left[prio] = n
+end
+
+-- Return {{name=, budget=, resumed=, deferred=, maxwait=}, ...} indexed by
+-- priority class, budget is false if unlimited, see the comments of
+-- sched_resumed for the others.
+function M.sched_stats()
+	local stats = {}
+	for prio, name in ipairs(PRIO_NAMES) do
+		stats[prio] = {
+			name = name,
+			budget = budgets[prio] ~= UNLIMITED and budgets[prio],
+			resumed = sched_resumed[prio] + budgets[prio] - budget_left[prio],
+			deferred = sched_deferred[prio],
+			maxwait = sched_maxwait[prio],
+		}
+	end
+	return stats
+end
+
+function M.sched_reset()
+	for prio = PRIO_HIGH, PRIO_LOW do
+		sched_resumed[prio] = budget_left[prio] - budgets[prio]
+		sched_deferred[prio] = 0
+		sched_maxwait[prio] = 0
+	end
+end
+
 
 -- Register an event handler
 --
@@ -327,6 +652,34 @@ function M.del_handler(fd)
 	handler_set[fd + 1] = false
 end
 
+-- Select the I/O backend: 'epoll'(the default) or 'uring'
+--
+-- Should be called before any channel is created, channels created afterwards
+-- submit their reads/writes/accepts/connects to the io_uring ring, while
+-- handlers registered by add_handler keep working as usual.
+--
+-- Return the selected backend, it falls back to 'epoll' if io_uring is
+-- unavailable(old kernel, disabled by seccomp ...).
+function M.set_backend(name)
+	if name == 'uring' then
+		if not ring and uring then
+			ring = uring.create()
+		end
+	elseif ring and not next(uring_cbs) then
+		ring:destroy()
+		ring = false
+	end
+	M.uring = ring
+	return ring and 'uring' or 'epoll'
+end
+
+-- Watch the completion of an io_uring operation, 'cb(obj, slot, res)' is invoked
+-- once it completes, and the callback is responsible for releasing the slot.
+function M._uring_watch(slot, obj, cb)
+	uring_objs[slot] = obj
+	uring_cbs[slot] = cb
+end
+
 M.quit = os.exit
 M.term = os.exit
 
@@ -355,12 +708,9 @@ local function resume_timedout()
 		end
 		rb_timer:delete(task)
 		task.rb_key = false
-		task.t_err = ETIMEDOUT
-		do_resume(task)
-	end
-	if ready_list then
-		resume_list()
+		push_ready(task, ETIMEDOUT)
 	end
+	resume_list()
 end
 
 local function calc_waittime()
@@ -385,8 +735,208 @@ local function calc_waittime()
 	return tm_wait
 end
 
+local function dispatch_events(wait_ret)
+	for fd, revents in pairs(wait_ret) do
+		local handler = handler_set[fd + 1]
+		if handler then
+			handler(fd, revents)
+		end
+	end
+end
+
+local function uring_wait(sec)
+	if not poll_slot then
+		poll_slot = ring:poll(poll_fd, READ)
+	end
+	return ring:wait(sec)
+end
+
+local function dispatch_completions(completions)
+	for slot, res in pairs(completions) do
+		if slot == poll_slot then
+			ring:release(slot)
+			poll_slot = false
+			local wait_ret = poll.wait(poll_fd, 0)
+			if wait_ret then
+				dispatch_events(wait_ret)
+			end
+		else
+			local cb = uring_cbs[slot]
+			local obj = uring_objs[slot]
+			uring_cbs[slot] = nil
+			uring_objs[slot] = nil
+			if cb then
+				cb(obj, slot, res)
+			else
+				ring:release(slot)
+			end
+		end
+	end
+end
+
+-- Turn the per-task profiler on/off.
+--
+-- While it's on, CPU time spent in each resume and the time blocked by each
+-- kind of object(see block_kind) are accumulated by task name(t_name).
+function M.set_profiling(on)
+	profiling = on and true or false
+end
+
+-- Return {[t_name] = {resumes=, cpu=, maxcpu=, blocked={[kind]=sec}}}
+function M.profile_stats()
+	return profile
+end
+
+function M.profile_reset()
+	profile = {}
+end
+
+-- Start the sampling profiler, the Lua stack is sampled every 'interval'
+-- seconds of CPU time and the samples are rooted by task name(t_name).
+--
+-- Return err
+function M.start_sampling(interval)
+	local err = profiler.start(interval)
+	if err == 0 then
+		sampling = true
+	end
+	return err
+end
+
+-- Stop the sampling profiler and write the samples into 'path' in the folded
+-- format(feed it to flamegraph.pl), if 'path' is given.
+--
+-- Return err, nsamples
+function M.stop_sampling(path)
+	local nsamples = profiler.stop()
+	sampling = false
+	return path and profiler.dump(path) or 0, nsamples
+end
+
+-- Turn on cooperative preemption: a task running longer than 'sec' seconds in
+-- one resume is force-yielded back to the ready list, so a task that never
+-- blocks can't hold up polling and timers. The clock is checked every 'count'
+-- VM instructions(defaulted to 10000).
+--
+-- If 'sec' is 0 or nil while 'count' is given, the budget is 'count'
+-- instructions per resume. Both nil turns it off.
+--
+-- Tasks are only preempted in their own code, never in the scheduler or the
+-- channels(see preempt.protect), nor in callbacks called from C functions, nor
+-- in the coroutines they create. Preempted tasks are logged with their t_name.
+function M.set_preemption(sec, count)
+	if not sec and not count then
+		preempting = false
+		preempt.disable()
+		return
+	end
+
+	preempt_sec = sec or 0
+	preempt_count = count or 10000
+	if not preempting then
+		-- the scheduler: this file, tasklet/*.lua and the timer tree, not the
+		-- applications installed by its side
+		local src = debug.getinfo(1, 'S').source
+		local dir = src:match('^(@.*/)[^/]+$') or '@'
+		preempt.protect(src)
+		preempt.protect(dir .. 'tasklet/')
+		preempt.protect(dir .. 'rbtree.lua')
+		preempting = true
+	end
+end
+
+-- Set the max number of coroutines parked for reuse, defaulted to 256, 0
+-- turns off the reuse.
+--
+-- A task finishing normally leaves its coroutine to the pool, start_task takes
+-- one from there before creating a new one, which saves the allocation(and
+-- collection) of a coroutine with its Lua stack for connection-per-task servers.
+function M.set_pool_size(n)
+	co_pool_max = n
+	while co_pool_num > n do
+		co_pool[co_pool_num] = nil
+		co_pool_num = co_pool_num - 1
+	end
+end
+
+-- Tune the Lua GC, 'opts' is a table of
+--
+--	mode     'incremental' or 'generational'(Lua 5.4 only)
+--	pause    the GC pause in percent, see collectgarbage('setpause')
+--	stepmul  the GC step multiplier in percent, see collectgarbage('setstepmul')
+--	idle     KB collected per incremental step run by the loop before polling,
+--	         0 turns it off(defaulted)
+--	after    only if the loop is going to wait longer than 'after' seconds,
+--	         i.e. no timer expires soon, defaulted to 0.005
+--	slice    max seconds of idle steps before each poll, defaulted to 0.001
+--
+-- The automatic collection is kept, the idle steps just move most of the
+-- work out of the request handlers, a larger 'pause' leaves more of it to them.
+--
+-- Return 0 or errno.
+function M.set_gc(opts)
+	local mode = opts.mode
+	if mode then
+		if mode ~= 'incremental' and mode ~= 'generational' then
+			return errno.EINVAL
+		end
+		-- Lua 5.3 has no such options and is always incremental
+		if not pcall(collectgarbage, mode) and mode ~= 'incremental' then
+			return errno.ENOSYS
+		end
+	end
+	if opts.pause then
+		collectgarbage('setpause', tonumber(opts.pause))
+	end
+	if opts.stepmul then
+		collectgarbage('setstepmul', tonumber(opts.stepmul))
+	end
+
+	gc_idle_step = tonumber(opts.idle) or gc_idle_step
+	gc_idle_after = tonumber(opts.after) or gc_idle_after
+	gc_idle_slice = tonumber(opts.slice) or gc_idle_slice
+	if gc_idle_step > 0 and not gc_counting then
+		gc_counting = true
+		gc_sentinel()
+	end
+	return 0
+end
+
+-- Return {kbytes=, cycles=, idle_cycles=, steps=, seconds=, maxstep=}
+--
+--	kbytes       memory in use
+--	cycles       GC cycles finished since idle steps are enabled
+--	idle_cycles  those finished by the idle steps, the others are by the
+--	             automatic collection in the tasks
+--	steps        number of idle steps
+--	seconds      time spent in idle steps
+--	maxstep      the longest idle step in seconds
+function M.gc_stats()
+	return {
+		kbytes = math.floor(collectgarbage('count')),
+		cycles = gc_cycles,
+		idle_cycles = gc_idle_cycles,
+		steps = gc_steps,
+		seconds = gc_seconds,
+		maxstep = gc_maxstep,
+	}
+end
+
+function M.gc_reset()
+	gc_steps, gc_seconds, gc_maxstep = 0, 0, 0
+	gc_idle_cycles, gc_cycles = 0, 0
+end
+
+-- Update the gauges which are not maintained on the fly, call it before
+-- reading metrics(metrics.snapshot/metrics.prometheus).
+function M.collect_metrics()
+	metrics.set(M_TIMERS, rb_timer.count)
+	metrics.set(M_POOLED, co_pool_num)
+end
+
 function M.loop()
 	local wait_ret
+	local tm_poll, tm_polled
 
 	if poll_fd < 0 then
 		poll_fd = poll.create()
@@ -396,16 +946,17 @@ function M.loop()
 	time.setitimer(time.ITIMER_PROF, 0.01, 0.01)
 	signal.signal(signal.SIGPROF, update_time)
 	
-	if ready_list then
-		resume_list()
-	end
-
 	local nemod = M._nonevent_modules
+	tm_polled = M.now
 	while state < TERM do
+		-- resume the tasks deferred from the previous iteration first
+		reset_budgets()
+		resume_list()
+
 		-- exhaust all nonevent-blocked tasks until they are events-blocked or timer-blocked.
 		for _, module in pairs(nemod) do
 			module()
-			while ready_list do
+			while runnable() do
 				resume_list()
 				module()
 			end
@@ -415,17 +966,53 @@ function M.loop()
 
 		-- schedule by events
 		update_time()
-		wait_ret = poll.wait(poll_fd, calc_waittime())
-		update_time()
-		if wait_ret then
-			for fd, revents in pairs(wait_ret) do
-				local handler = handler_set[fd + 1]
-				if handler then
-					handler(fd, revents)
+		local wait_sec = calc_waittime()
+
+		-- don't wait if some classes ran out of their budgets
+		for prio = PRIO_HIGH, PRIO_LOW do
+			if ready_lists[prio] then
+				local since = deferred_since[prio]
+				if since then
+					if M.now - since > sched_maxwait[prio] then
+						sched_maxwait[prio] = M.now - since
+					end
+				else
+					deferred_since[prio] = M.now
 				end
+				sched_deferred[prio] = sched_deferred[prio] + 1
+				wait_sec = 0
+			else
+				deferred_since[prio] = false
+			end
+		end
+
+		-- collect garbage now rather than in the middle of handling requests
+		if gc_idle_step > 0 and wait_sec > gc_idle_after then
+			wait_sec = gc_idle(wait_sec)
+		end
+		tm_poll = M.now
+		metrics_observe(M_BUSY, tm_poll - tm_polled)
+		if ring then
+			wait_ret = uring_wait(wait_sec)
+			update_time()
+			tm_polled = M.now
+			if wait_ret then
+				dispatch_completions(wait_ret)
 			end
+		else
+			wait_ret = poll.wait(poll_fd, wait_sec)
+			update_time()
+			tm_polled = M.now
+			if wait_ret then
+				dispatch_events(wait_ret)
+			end
+		end
+		if wait_ret then
 			resume_list()
 		end
+		metrics_observe(M_WAIT, tm_polled - tm_poll, M_DISPATCH, time.uptime() - tm_polled,
+			M_RESUMED, nresumed)
+		nresumed = 0
 
 		if state == TERM then break end
 
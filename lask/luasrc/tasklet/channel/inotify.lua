@@ -0,0 +1,312 @@
+--
+-- Copyright (C) spyder
+--
+
+-- Channel to watch files and directories by inotify(7).
+--
+-- Events are read in batches into a buffer and decoded by inotify.read, then merged
+-- per path until a task reads them: a burst of writes to a file within a loop
+-- iteration is read as one event whose mask is the OR of the burst.
+--
+-- A recursive watch follows the directories created or moved into it, and the
+-- entries found in such a directory are reported as IN_CREATE, so nothing created
+-- before its watch was added is missed.
+--
+-- SAMPLE:
+--	local ch = tasklet.inotify_channel.new()
+--	ch:watch('/etc/myapp', nil, true)
+--	while true do
+--		local events = ch:read()
+--		for path, mask in pairs(events) do
+--			cache[path] = nil
+--		end
+--	end
+
+local tasklet = require 'tasklet'
+local block_task, resume_task, current_task = tasklet._block_task, tasklet._resume_task, tasklet.current_task
+local READ = tasklet.EVT_READ
+
+local inotify, fs, os, errno = inotify, fs, os, errno
+
+-- still use bit32 functions so this code runs on lua version < 5.3
+local band, bor, btest = bit32.band, bit32.bor, bit32.btest
+
+local ETIMEDOUT, EBADF, ENOENT = errno.ETIMEDOUT, errno.EBADF, errno.ENOENT
+local DT_DIR = fs.DT_DIR
+
+local IN_ISDIR, IN_IGNORED = inotify.IN_ISDIR, inotify.IN_IGNORED
+local IN_CREATE, IN_MOVED_FROM, IN_MOVED_TO = inotify.IN_CREATE, inotify.IN_MOVED_FROM, inotify.IN_MOVED_TO
+
+-- watched if no mask is given
+local DEFAULT_MASK = inotify.IN_MODIFY + inotify.IN_ATTRIB + inotify.IN_CLOSE_WRITE +
+		IN_CREATE + inotify.IN_DELETE + inotify.IN_MOVE + inotify.IN_DELETE_SELF + inotify.IN_MOVE_SELF
+
+-- reported whatever the mask is
+local KERNEL_MASK = IN_ISDIR + IN_IGNORED + inotify.IN_UNMOUNT + inotify.IN_Q_OVERFLOW
+
+-- watched in addition to the mask of a recursive watch, to follow its subdirectories
+local SUBDIR_MASK = IN_CREATE + IN_MOVED_FROM + IN_MOVED_TO
+
+local function normpath(path)
+	if #path > 1 and path:sub(-1) == '/' then
+		path = path:gsub('/+$', '')
+		if path == '' then
+			path = '/'
+		end
+	end
+	return path
+end
+
+-- merge an event into the pending ones
+local function ch_post(self, path, mask)
+	if mask ~= 0 and mask ~= IN_ISDIR then
+		local pending = self.ch_pending
+		if not pending then
+			pending = {}
+			self.ch_pending = pending
+		end
+		pending[path] = bor(pending[path] or 0, mask)
+	end
+end
+
+local function ch_addwatch(self, path, mask, recursive)
+	local wd, err = inotify.add_watch(self.ch_fd, path, recursive and bor(mask, SUBDIR_MASK) or mask)
+	if wd < 0 then
+		return err
+	end
+
+	-- the same inode always gets the same wd
+	local old = self.ch_watches[wd]
+	if old and old.w_path ~= path then
+		self.ch_wds[old.w_path] = nil
+	end
+	self.ch_watches[wd] = {w_path = path, w_mask = mask, w_recursive = recursive}
+	self.ch_wds[path] = wd
+	return 0
+end
+
+-- watch the subdirectories under 'root', and report the entries found if 'report'
+local function ch_addtree(self, root, mask, report)
+	local walker = fs.walk(root)
+	if not walker then
+		return
+	end
+	report = report and btest(mask, IN_CREATE)
+	while walker:fill() > 0 do
+		for path, type in walker.next, walker do
+			if type == DT_DIR then
+				ch_addwatch(self, path, mask, true)
+			end
+			if report then
+				ch_post(self, path, type == DT_DIR and IN_CREATE + IN_ISDIR or IN_CREATE)
+			end
+		end
+	end
+	walker:close()
+end
+
+-- remove the watches of 'root' and everything under it
+local function ch_rmtree(self, root)
+	local prefix = root == '/' and root or root .. '/'
+	local watches, wds = self.ch_watches, self.ch_wds
+	for wd, w in pairs(watches) do
+		local path = w.w_path
+		if path == root or path:sub(1, #prefix) == prefix then
+			inotify.rm_watch(self.ch_fd, wd)
+			watches[wd] = nil
+			wds[path] = nil
+		end
+	end
+end
+
+local function ch_onevents(self)
+	local evs = self.ch_evs
+	local n, err = inotify.read(self.ch_fd, self.ch_rbuf, evs)
+	local watches = self.ch_watches
+
+	for i = 1, n * 3, 3 do
+		local wd, mask, name = evs[i], evs[i + 1], evs[i + 2]
+		local w = watches[wd]
+		if w then
+			local path = name == '' and w.w_path or w.w_path .. '/' .. name
+
+			-- a subdirectory moved away and another one moved/created in its place is
+			-- coalesced into one event, so remove the watches before adding them.
+			if w.w_recursive and name ~= '' and btest(mask, IN_ISDIR) then
+				if btest(mask, IN_MOVED_FROM) then
+					ch_rmtree(self, path)
+				end
+				if btest(mask, IN_CREATE + IN_MOVED_TO) and ch_addwatch(self, path, w.w_mask, true) == 0 then
+					ch_addtree(self, path, w.w_mask, true)
+				end
+			end
+
+			-- the watch is removed: rm_watch, the object is deleted or unmounted
+			if name == '' and btest(mask, IN_IGNORED) then
+				watches[wd] = nil
+				if self.ch_wds[w.w_path] == wd then
+					self.ch_wds[w.w_path] = nil
+				end
+			end
+
+			ch_post(self, path, band(mask, w.w_mask + KERNEL_MASK))
+		elseif wd == -1 then
+			-- IN_Q_OVERFLOW: events are lost
+			ch_post(self, '', mask)
+		end
+	end
+	self.ch_rbuf:rewind()
+
+	if err ~= 0 then
+		self.ch_err = err
+	end
+	local task = self.ch_rtask
+	if task and (self.ch_pending or err ~= 0) then
+		resume_task(task)
+	end
+end
+
+local inotify_channel = {}
+inotify_channel.__index = inotify_channel
+local inotify_channel_meta = {
+	__index = inotify_channel,
+	__call = ch_onevents,
+}
+
+-- Create a channel by inotify.init
+--
+-- Return ch, err
+function inotify_channel.new()
+	local fd, err = inotify.init(inotify.IN_NONBLOCK + inotify.IN_CLOEXEC)
+	if fd < 0 then
+		return nil, err
+	end
+
+	local ch = setmetatable({
+		ch_fd = fd,
+		ch_rbuf = buffer.new(),
+		ch_evs = {},
+		ch_watches = {},		-- {[wd] = {w_path, w_mask, w_recursive}}
+		ch_wds = {},			-- {[path] = wd}
+		ch_pending = false,		-- {[path] = mask}
+		ch_err = 0,
+		ch_rtask = false,
+	}, inotify_channel_meta)
+
+	tasklet.add_handler(fd, READ, ch)
+	return ch, 0
+end
+
+-- Watch a file or directory for the events in 'mask'(inotify.IN_xxx, see DEFAULT_MASK
+-- if nil), watching again replaces the mask.
+--
+-- If 'recursive', all the directories under it are watched with the same mask.
+--
+-- Return err
+function inotify_channel:watch(path, mask, recursive)
+	if self.ch_fd < 0 then
+		return EBADF
+	end
+
+	path = normpath(path)
+	mask = mask or DEFAULT_MASK
+	recursive = recursive or false
+
+	local err = ch_addwatch(self, path, mask, recursive)
+	if err == 0 and recursive then
+		ch_addtree(self, path, mask, false)
+	end
+	return err
+end
+
+-- Stop watching a path given to watch(), and everything under it if it was recursive.
+--
+-- Return err(0 or ENOENT if the path is not watched)
+function inotify_channel:unwatch(path)
+	path = normpath(path)
+	local wd = self.ch_wds[path]
+	if not wd then
+		return ENOENT
+	end
+
+	if self.ch_watches[wd].w_recursive then
+		ch_rmtree(self, path)
+	else
+		inotify.rm_watch(self.ch_fd, wd)
+		self.ch_watches[wd] = nil
+		self.ch_wds[path] = nil
+	end
+	return 0
+end
+
+-- Wait for the events
+--
+-- Return events, err
+--	events: {[path] = mask}, masks of a path are OR-ed since the last read.
+--		IN_Q_OVERFLOW is reported by the path '', the events after the last read are
+--		partially lost, rescan what is watched.
+--	err: 0, EBADF, ETIMEDOUT, or the error of reading inotify
+function inotify_channel:read(sec)
+	if self.ch_fd < 0 then
+		return nil, EBADF
+	end
+
+	if self.ch_rtask then
+		error('another task is reading-blocked on this inotify channel')
+	end
+
+	sec = sec or -1
+	local task = current_task()
+	local tm_start = tasklet.now
+	while not self.ch_pending do
+		local err = self.ch_err
+		if err ~= 0 then
+			self.ch_err = 0
+			return nil, err
+		end
+
+		local wait_sec = -1
+		if sec == 0 then
+			return nil, ETIMEDOUT
+		elseif sec > 0 then
+			local elapsed = tasklet.now - tm_start
+			if elapsed >= sec then
+				return nil, ETIMEDOUT
+			end
+			wait_sec = sec - elapsed
+		end
+
+		self.ch_rtask = task
+		task.t_blockedby = self
+		err = block_task(wait_sec)
+		self.ch_rtask = false
+		if err ~= 0 then
+			return nil, err
+		end
+		if self.ch_fd < 0 then
+			return nil, EBADF
+		end
+	end
+
+	local events = self.ch_pending
+	self.ch_pending = false
+	return events, 0
+end
+
+function inotify_channel:close()
+	local fd = self.ch_fd
+	if fd >= 0 then
+		tasklet.del_handler(fd)
+		os.close(fd)
+		self.ch_fd = -1
+		self.ch_watches = {}
+		self.ch_wds = {}
+		self.ch_pending = false
+		if self.ch_rtask then
+			resume_task(self.ch_rtask, EBADF)
+		end
+	end
+end
+
+tasklet.inotify_channel = inotify_channel
+return tasklet
@@ -7,18 +7,25 @@
 local tasklet = require 'tasklet.channel._stream'
 local os, errno, socket = os, errno, socket
 
-local ETIMEDOUT, EBADF = errno.ETIMEDOUT, errno.EBADF
+local ETIMEDOUT, EBADF, ECANCELED = errno.ETIMEDOUT, errno.EBADF, errno.ECANCELED
 
 local block_task, resume_task, current_task = tasklet._block_task, tasklet._resume_task, tasklet.current_task
 local add_handler, mod_handler, del_handler = tasklet.add_handler, tasklet.mod_handler, tasklet.del_handler
 local READ, WRITE, EDGE = tasklet.EVT_READ, tasklet.EVT_WRITE, tasklet.EVT_EDGE
 local HUP = poll.HUP
+local uring_watch = tasklet._uring_watch
+local URING_MAX_WRITE = uring.MAX_WRITE
+local min = math.min
 
 -- still use bit32 functions so this code runs on lua version < 5.3
 local btest = bit32.btest
 
 local CONF_RBUFSIZ = 4096
 
+local metrics_observe = metrics.observe
+local M_RBYTES = metrics.histogram('stream_read_bytes', 'Bytes per read syscall on stream channels')
+local M_WBYTES = metrics.histogram('stream_write_bytes', 'Bytes per write syscall on stream channels')
+
 -------------------------------------------------------------------------------
 -- channel states {
 
@@ -112,6 +119,10 @@ local function new_stream_channel(fd, rbufsiz)
 		ch_wtask = false,
 		ch_events = READ + EDGE,
 		ch_line = false,
+		ch_uring = tasklet.uring or false,
+		ch_rslot = false,
+		ch_wslot = false,
+		ch_wleft = 0,
 	}, stream_channel_meta)
 	return ch
 end
@@ -149,9 +160,11 @@ local function create_execl_channel(cmd, rbufsiz)
 		os.exit(0)
 	else
 		os.close(wfd)
-		os.setnonblock(rfd)
 		local ch = new_stream_channel(rfd, rbufsiz)
-		add_handler(rfd, ch.ch_events, ch)
+		if not ch.ch_uring then
+			os.setnonblock(rfd)
+			add_handler(rfd, ch.ch_events, ch)
+		end
 		return ch, 0
 	end
 end
@@ -169,8 +182,13 @@ local function create_stream_channel(fd, rbufsiz)
 	fd = fd or -1
 	local ch = new_stream_channel(fd, rbufsiz)
 	if fd >= 0 then
-		os.setnonblock(fd)
-		add_handler(fd, ch.ch_events, ch)
+		if ch.ch_uring then
+			-- io_uring waits for blocking file descriptors without occupying threads
+			fcntl.delfl(fd, os.O_NONBLOCK)
+		else
+			os.setnonblock(fd)
+			add_handler(fd, ch.ch_events, ch)
+		end
 	end
 	return ch
 end
@@ -185,6 +203,257 @@ function stream_channel.new(value, rbufsiz)
 end
 
 
+-------------------------------------------------------------------------------
+-- io_uring backend {
+
+-- Completions of operations canceled by close/connect are simply released.
+
+local function uring_onread(self, slot, res)
+	local ring = self.ch_uring
+	if self.ch_rslot ~= slot then
+		ring:release(slot)
+		return
+	end
+	self.ch_rslot = false
+
+	if res > 0 then
+		metrics_observe(M_RBYTES, res)
+		ring:fetch(slot, self.ch_rbuf)
+		self.ch_state = CH_ESTABLISHED
+	else
+		ring:release(slot)
+		if res == 0 then
+			self.ch_state = CH_HALFCLOSED
+		elseif -res ~= ECANCELED then
+			self.ch_rreqsiz = 0
+			self.ch_nshift = 0
+			self.ch_state = CH_ERRORED
+			self.ch_err = -res
+			if self.ch_wtask then
+				resume_task(self.ch_wtask, -res)
+			end
+		end
+	end
+
+	if self.ch_rtask then
+		resume_task(self.ch_rtask)
+	end
+end
+
+-- A write is owned by the channel once submitted, short writes are completed
+-- and errors are recorded here, whether the writing task is still waiting or not.
+local function uring_onwrite(self, slot, res)
+	local ring = self.ch_uring
+	if self.ch_wslot ~= slot then
+		ring:release(slot)
+		return
+	end
+
+	if res >= 0 then
+		metrics_observe(M_WBYTES, res)
+		local left = self.ch_wleft - res
+		self.ch_wleft = left
+		if left > 0 then
+			local err = ring:rewrite(slot, self.ch_fd)
+			if err == 0 then
+				uring_watch(slot, self, uring_onwrite)
+				return
+			end
+			res = -err
+		end
+	end
+	ring:release(slot)
+	self.ch_wslot = false
+	self.ch_wleft = 0
+
+	if res < 0 and -res ~= ECANCELED then
+		self.ch_state = CH_ERRORED
+		self.ch_err = -res
+		if self.ch_rtask then
+			resume_task(self.ch_rtask, -res)
+		end
+	end
+	if self.ch_wtask then
+		resume_task(self.ch_wtask)
+	end
+end
+
+-- A write still in flight when the channel is closed goes on, the fd is closed
+-- once it's done.
+local function uring_onlinger(linger, slot, res)
+	local ring = linger.ring
+	if res >= 0 and res < linger.left then
+		linger.left = linger.left - res
+		if ring:rewrite(slot, linger.fd) == 0 then
+			uring_watch(slot, linger, uring_onlinger)
+			return
+		end
+	end
+	ring:release(slot)
+	os.close(linger.fd)
+end
+
+local function uring_onconnect(self, slot, res)
+	self.ch_uring:release(slot)
+	if self.ch_wslot ~= slot then
+		return
+	end
+	self.ch_wslot = false
+	self.ch_err = -res
+	if self.ch_rtask then
+		resume_task(self.ch_rtask)
+	end
+end
+
+-- Submit a read filling the free space of rbuf unless there is one in flight.
+local function uring_read(self)
+	if not self.ch_rslot then
+		local siz = self.ch_rbufsiz - #self.ch_rbuf
+		if siz > 0 then
+			local slot = self.ch_uring:read(self.ch_fd, siz)
+			if slot then
+				self.ch_rslot = slot
+				uring_watch(slot, self, uring_onread)
+			end
+		end
+	end
+end
+
+-- cancel the pending operations, and submit the cancels at once: a read still
+-- queued in the ring must not reach the kernel after the fd is closed, it
+-- would hit whatever file reuses the fd number.
+--
+-- A write in flight has been reported as written, it lingers instead(see
+-- uring_onlinger), return true if so and the fd must be left open.
+local function uring_cancel(self)
+	local ring = self.ch_uring
+	local cancelled, lingering = false, false
+	if self.ch_rslot then
+		ring:cancel(self.ch_rslot)
+		self.ch_rslot = false
+		cancelled = true
+	end
+	local wslot = self.ch_wslot
+	if wslot then
+		if self.ch_wleft > 0 then
+			uring_watch(wslot, {ring = ring, fd = self.ch_fd, left = self.ch_wleft}, uring_onlinger)
+			lingering = true
+		else
+			ring:cancel(wslot)
+			cancelled = true
+		end
+		self.ch_wslot = false
+		self.ch_wleft = 0
+	end
+	if cancelled then
+		ring:submit()
+	end
+	return lingering
+end
+
+local function uring_connect(self, addr, port, sec, localip)
+	uring_cancel(self)
+
+	local family = port and (addr:find(':') and socket.AF_INET6 or socket.AF_INET) or socket.AF_UNIX
+	local fd, err = socket.socket(family, socket.SOCK_STREAM)
+	if fd < 0 then
+		return err
+	end
+	if localip then
+		err = socket.bind(fd, localip, 0)
+		if err ~= 0 then
+			os.close(fd)
+			return err
+		end
+	end
+
+	local slot
+	slot, err = self.ch_uring:connect(fd, addr, port)
+	if not slot then
+		os.close(fd)
+		return err
+	end
+
+	self.ch_fd = fd
+	self.ch_state = CH_CONNECTING
+	self.ch_wslot = slot
+	self.ch_err = 0
+	uring_watch(slot, self, uring_onconnect)
+
+	local task = current_task()
+	task.t_blockedby = self
+	self.ch_rtask = task
+	err = block_task(sec or -1)
+	self.ch_rtask = false
+
+	if err == 0 then
+		err = self.ch_err
+	end
+	if err == 0 then
+		self.ch_state = CH_ESTABLISHED
+	else
+		self:close()
+	end
+	return err
+end
+
+-- The data is written by at most uring.MAX_WRITE bytes a time, one write in
+-- flight at a time so the data is never reordered. A submitted write is owned
+-- by the channel(see uring_onwrite), thus it times out only if some data is
+-- not submitted yet.
+local function uring_write(self, data, sec)
+	local task = current_task()
+	local tm_start = tasklet.now
+	local datasiz = #data
+	local offset = 0
+
+	sec = sec or -1
+	while true do
+		if self.ch_state < 0 then
+			return self.ch_err, offset
+		end
+
+		if not self.ch_wslot then
+			if offset >= datasiz then
+				return 0, offset
+			end
+			local slot, err = self.ch_uring:write(self.ch_fd, data, offset, datasiz - offset)
+			if not slot then
+				return err, offset
+			end
+			local len = min(datasiz - offset, URING_MAX_WRITE)
+			self.ch_wslot = slot
+			self.ch_wleft = len
+			uring_watch(slot, self, uring_onwrite)
+			offset = offset + len
+		end
+
+		local wait_sec = -1
+		if sec == 0 then
+			return offset >= datasiz and 0 or ETIMEDOUT, offset
+		elseif sec > 0 then
+			local elapsed = tasklet.now - tm_start
+			if elapsed >= sec then
+				return offset >= datasiz and 0 or ETIMEDOUT, offset
+			end
+			wait_sec = sec - elapsed
+		end
+
+		self.ch_wtask = task
+		task.t_blockedby = self
+		local err = block_task(wait_sec)
+		self.ch_wtask = false
+		if err == ETIMEDOUT then
+			return offset >= datasiz and 0 or ETIMEDOUT, offset
+		elseif err ~= 0 then
+			return err, offset
+		end
+	end
+end
+
+-- } io_uring backend
+------------------------------------------------------------------------------
+
 -- Start connecting with a remote peer.
 --
 -- Return 0 if succeed, otherwise a standard errno code.
@@ -197,11 +466,17 @@ function stream_channel:connect(addr, port, sec, localip)
 	local fd = self.ch_fd
 
 	if fd >= 0 then
-		os.close(fd)
+		if not (self.ch_uring and uring_cancel(self)) then
+			os.close(fd)
+		end
 		fd = -1
 		self.ch_fd = -1
 	end
 
+	if self.ch_uring then
+		return uring_connect(self, addr, port, sec, localip)
+	end
+
 	local err
 	local family = port and (addr:find(':') and socket.AF_INET6 or socket.AF_INET) or socket.AF_UNIX
 	fd, err = socket.async_connect(addr, port, family, localip)
@@ -259,6 +534,7 @@ local function stream_channel_read(self, siz)
 	siz = siz or (self.ch_rbufsiz - #rbuf)
 	if siz > 0 then
 		local nread, err = os.readb(fd, rbuf, siz)
+		metrics_observe(M_RBYTES, nread)
 		if nread > 0 then
 			--os.writeb(1, rbuf, #rbuf - nread, nread)
 			if nread < siz then
@@ -383,7 +659,14 @@ function stream_channel:read(bytes, sec)
 		end
 
 		local err = 0
-		if state ~= CH_READABLE or not stream_channel_read(self) then
+		local filled = false
+		if self.ch_uring then
+			uring_read(self)
+		elseif state == CH_READABLE then
+			filled = stream_channel_read(self)
+		end
+
+		if not filled then
 			if sec == 0 then
 				return nil, ETIMEDOUT
 			end
@@ -412,16 +695,33 @@ function stream_channel:read(bytes, sec)
 	end
 end
 
+-- The same as read(bytes, sec), but the reader returned pins its bytes(see buffer:slice):
+-- it stays valid after the following reads and can be handed to other tasks, nothing
+-- is copied.
+function stream_channel:read_slice(bytes, sec)
+	assert(bytes, 'read_slice() reads bytes, not lines')
+	local rd, err = self:read(bytes, sec)
+	if rd then
+		-- what read() returns is at the head of rbuf, to be shifted by the next read
+		rd = self.ch_rbuf:slice(#rd)
+		self.ch_nshift = 0
+	end
+	return rd, err
+end
+
 -- Write data through the channel
 --
--- 'data' is of binary format(userdata<buffer> or userdata<reader>)
+-- 'data' is of binary format(userdata<buffer>, userdata<reader> or userdata<chain>)
 --
--- Return err(0 or the posix errno)
+-- Return err, nbytes
+--	err: 0 or the posix errno
+--	nbytes: bytes taken by the channel, the rest is not written if err ~= 0, e.g.
+--		ETIMEDOUT(with io_uring, the taken bytes are still being written).
 function stream_channel:write(data, sec)
 	local state = self.ch_state
 
 	if state == CH_CLOSED then
-		return EBADF
+		return EBADF, 0
 	end
 
 	if self.ch_wtask then
@@ -429,7 +729,11 @@ function stream_channel:write(data, sec)
 	end
 
 	if state == CH_ERRORED then
-		return self.ch_err
+		return self.ch_err, 0
+	end
+
+	if self.ch_uring then
+		return uring_write(self, data, sec)
 	end
 
 	sec = sec or -1
@@ -439,6 +743,7 @@ function stream_channel:write(data, sec)
 	local offset = 0
 	while datasiz > 0 do
 		local nwritten, err = os.writeb(self.ch_fd, data, offset, datasiz)
+		metrics_observe(M_WBYTES, nwritten)
 		if err ~= 0 then
 			self.ch_state = CH_ERRORED
 			self.ch_err = err
@@ -448,13 +753,13 @@ function stream_channel:write(data, sec)
 				resume_task(self.ch_rtask, err)
 			end
 
-			return err
+			return err, offset
 		else
 			datasiz = datasiz - nwritten
 			offset = offset + nwritten
 			if datasiz > 0 then
 				if sec == 0 then
-					return ETIMEDOUT
+					return ETIMEDOUT, offset
 				end
 
 				--
@@ -464,7 +769,7 @@ function stream_channel:write(data, sec)
 				if sec > 0 then
 					local elapsed = tasklet.now - tm_start
 					if elapsed >= sec then
-						return ETIMEDOUT
+						return ETIMEDOUT, offset
 					end
 					wait_sec = sec - elapsed
 				end
@@ -474,23 +779,30 @@ function stream_channel:write(data, sec)
 				self.ch_wtask = false
 
 				if err ~= 0 then
-					return err
+					return err, offset
 				end
 				if self.ch_state < 0 then
-					return self.ch_err
+					return self.ch_err, offset
 				end
 			end
 		end
 	end
-	return 0
+	return 0, offset
 end
 
 -- Close the channel(release the internal resource and close related file descriptor)
 function stream_channel:close()
 	local fd = self.ch_fd
 	if fd >= 0 then
-		del_handler(fd)
-		os.close(fd)
+		local lingering = false
+		if self.ch_uring then
+			lingering = uring_cancel(self)
+		else
+			del_handler(fd)
+		end
+		if not lingering then
+			os.close(fd)
+		end
 		self.ch_fd = -1
 		self.ch_err = EBADF
 		if self.ch_rbuf then
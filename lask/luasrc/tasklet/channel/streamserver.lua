@@ -22,7 +22,60 @@ local streamserver_channel = {
 }
 streamserver_channel.__index = streamserver_channel
 
+local function uring_onaccept(self, slot, res)
+	self.ch_uring:release(slot)
+	if self.ch_slot ~= slot then
+		-- canceled by close, or the waiting task timed out
+		if res >= 0 then
+			os.close(res)
+		end
+		return
+	end
+	self.ch_slot = false
+	self.ch_res = res
+	if self.ch_task then
+		resume_task(self.ch_task)
+		self.ch_task = false
+	end
+end
+
+local function uring_accept(self, sec)
+	local ring = self.ch_uring
+	local slot, err = ring:accept(self.ch_fd)
+	if not slot then
+		return -1, nil, nil, err
+	end
+	self.ch_slot = slot
+	self.ch_res = -ETIMEDOUT
+	tasklet._uring_watch(slot, self, uring_onaccept)
+
+	local task = tasklet.current_task()
+	task.t_blockedby = self
+	self.ch_task = task
+	err = block_task(sec or -1)
+	self.ch_task = false
+
+	if self.ch_slot then
+		ring:cancel(slot)
+		self.ch_slot = false
+	end
+	if err ~= 0 then
+		return -1, nil, nil, err
+	end
+
+	local peerfd = self.ch_res
+	if peerfd < 0 then
+		return -1, nil, nil, self.ch_fd >= 0 and -peerfd or EBADF
+	end
+	local peeraddr, peerport = socket.getpeername(peerfd)
+	return peerfd, peeraddr, peerport, 0
+end
+
 function streamserver_channel:accept(sec)
+	if self.ch_uring then
+		return uring_accept(self, sec)
+	end
+
 	local fd = self.ch_fd
 	local peerfd, peeraddr, peerport, err = -1, nil, nil, EBADF
 	while fd >= 0 do
@@ -63,7 +116,16 @@ end
 function streamserver_channel:close()
 	local fd = self.ch_fd
 	if fd >= 0 then
-		tasklet.del_handler(fd)
+		if self.ch_uring then
+			if self.ch_slot then
+				-- submitted before closing, the fd number may be reused right away
+				self.ch_uring:cancel(self.ch_slot)
+				self.ch_uring:submit()
+				self.ch_slot = false
+			end
+		else
+			tasklet.del_handler(fd)
+		end
 		os.close(fd)
 		self.ch_fd = -1
 		if self.ch_task then
@@ -100,7 +162,6 @@ local function create_streamserver_channel(addr, port, backlog)
 		return nil, err
 	end
 	socket.listen(fd, backlog)
-	os.setnonblock(fd)
 
 	local ch = setmetatable({
 		ch_fd = fd,
@@ -108,8 +169,14 @@ local function create_streamserver_channel(addr, port, backlog)
 		ch_events = tasklet.EVT_READ + tasklet.EVT_EDGE,
 		ch_task = false,
 		ch_pending = false,
+		ch_uring = tasklet.uring or false,
+		ch_slot = false,
+		ch_res = 0,
 	}, streamserver_channel)
-	tasklet.add_handler(fd, ch.ch_events, ch)
+	if not ch.ch_uring then
+		os.setnonblock(fd)
+		tasklet.add_handler(fd, ch.ch_events, ch)
+	end
 	return ch, 0
 end
 
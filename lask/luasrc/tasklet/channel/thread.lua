@@ -0,0 +1,129 @@
+--
+-- Copyright (C) spyder
+--
+
+-- Channel to talk with Lua states running on other OS threads(see thread.start).
+--
+-- Messages are bytes carried by a thread.queue, both sides encode/decode them
+-- by buffers(putlist/getlist, putlstr/getlstr ...).
+--
+-- SAMPLE:
+--	local req, resp = thread.queue(64), thread.queue(64)
+--	thread.start(function (req, resp)
+--		require 'std'
+--		local buf = buffer.new()
+--		while req:pop(buf:rewind(), -1) do
+--			resp:push(md5(buf:str()))
+--		end
+--	end, req, resp)
+--
+--	local ch = tasklet.thread_channel.new(resp, req)
+--	ch:write('hello')
+--	local buf = buffer.new()
+--	ch:read(buf)
+
+local tasklet = require 'tasklet'
+local block_task, resume_task, current_task = tasklet._block_task, tasklet._resume_task, tasklet.current_task
+local READ, EDGE = tasklet.EVT_READ, tasklet.EVT_EDGE
+
+local ETIMEDOUT, EAGAIN, EBADF = errno.ETIMEDOUT, errno.EAGAIN, errno.EBADF
+
+local function ch_onevents(self)
+	local task = self.ch_rtask
+	if task then
+		resume_task(task)
+	end
+end
+
+local thread_channel = {}
+thread_channel.__index = thread_channel
+local thread_channel_meta = {
+	__index = thread_channel,
+	__call = ch_onevents,
+}
+
+-- Create a channel reading messages from 'rqueue' and writing into 'wqueue',
+-- either of them can be nil.
+function thread_channel.new(rqueue, wqueue)
+	local ch = setmetatable({
+		ch_rqueue = rqueue or false,
+		ch_wqueue = wqueue or false,
+		ch_fd = rqueue and rqueue:fd() or -1,
+		ch_rtask = false,
+	}, thread_channel_meta)
+
+	if ch.ch_fd >= 0 then
+		-- eventfd wakes epoll up on every write, even if it was already readable
+		tasklet.add_handler(ch.ch_fd, READ + EDGE, ch)
+	end
+	return ch
+end
+
+-- Pop the next message and append it to 'buf'
+--
+-- Return err(0, EBADF or ETIMEDOUT)
+function thread_channel:read(buf, sec)
+	local queue = self.ch_rqueue
+	if not queue or self.ch_fd < 0 then
+		return EBADF
+	end
+
+	if self.ch_rtask then
+		error('another task is reading-blocked on this thread channel')
+	end
+
+	sec = sec or -1
+	local task = current_task()
+	local tm_start = tasklet.now
+	while not queue:pop(buf) do
+		local wait_sec = -1
+		if sec == 0 then
+			return ETIMEDOUT
+		elseif sec > 0 then
+			local elapsed = tasklet.now - tm_start
+			if elapsed >= sec then
+				return ETIMEDOUT
+			end
+			wait_sec = sec - elapsed
+		end
+
+		self.ch_rtask = task
+		task.t_blockedby = self
+		local err = block_task(wait_sec)
+		self.ch_rtask = false
+		if err ~= 0 then
+			return err
+		end
+		if self.ch_fd < 0 then
+			return EBADF
+		end
+	end
+	return 0
+end
+
+-- Push a message(string/buffer/reader)
+--
+-- Never blocks, return EAGAIN if the queue is full.
+function thread_channel:write(data)
+	local queue = self.ch_wqueue
+	if not queue then
+		return EBADF
+	end
+	return queue:push(data) and 0 or EAGAIN
+end
+
+function thread_channel:close()
+	local fd = self.ch_fd
+	if fd >= 0 then
+		tasklet.del_handler(fd)
+		self.ch_fd = -1
+		if self.ch_rtask then
+			resume_task(self.ch_rtask, EBADF)
+		end
+	end
+	self.ch_rqueue = false
+	self.ch_wqueue = false
+end
+
+tasklet.thread_channel = thread_channel
+return tasklet
@@ -0,0 +1,81 @@
+--
+-- Copyright (C) spyder
+--
+
+-- Run blocking calls on the worker threads of the 'offload' pool, the calling
+-- task is blocked until the call completes while other tasks keep running.
+--
+-- Supported calls(see offload.submit for the arguments):
+--	stat, lstat, open, fsync, listdir, getaddrbyname, md5, walk, hashfile
+--
+-- SAMPLE:
+--	local st, err = tasklet.offload('stat', '/mnt/sdcard/record.mp4')
+--	local addrs, err = tasklet.offload('getaddrbyname', 'www.example.com')
+
+local tasklet = require 'tasklet'
+local block_task, resume_task, current_task = tasklet._block_task, tasklet._resume_task, tasklet.current_task
+local offload_submit, offload_reap = offload.submit, offload.reap
+local unpack = table.unpack or unpack
+
+-- {[id] = task}
+local waiting = {}
+
+-- {[id] = true}, 'open' calls nobody is waiting for anymore
+local orphans = {}
+
+local handler_added = false
+
+local function complete(id, ...)
+	if not id then
+		return false
+	end
+
+	local task = waiting[id]
+	if task then
+		waiting[id] = nil
+		task.t_svcresp = {n = select('#', ...), ...}
+		resume_task(task)
+	elseif orphans[id] then
+		orphans[id] = nil
+		local fd = ...
+		if fd >= 0 then
+			os.close(fd)
+		end
+	end
+	return true
+end
+
+local function on_completion()
+	while complete(offload_reap()) do end
+end
+
+-- Return the results of the call, or nil followed by errno.EINTR if the task
+-- is killed while waiting.
+function tasklet.offload(op, ...)
+	if not handler_added then
+		tasklet.add_handler(offload.fd(), tasklet.EVT_READ, on_completion)
+		handler_added = true
+	end
+
+	local id, err = offload_submit(op, ...)
+	if not id then
+		return nil, err
+	end
+
+	local task = current_task()
+	waiting[id] = task
+	err = block_task(-1, true)
+	if err ~= 0 then
+		waiting[id] = nil
+		if op == 'open' then
+			orphans[id] = true
+		end
+		return nil, err
+	end
+
+	local results = task.t_svcresp
+	task.t_svcresp = false
+	return unpack(results, 1, results.n)
+end
+
+return tasklet
@@ -9,6 +9,8 @@ local block_task, resume_task, current_task = tasklet._block_task, tasklet._resu
 
 local error = error
 local ETIMEDOUT, EAGAIN = errno.ETIMEDOUT, errno.EAGAIN
+local uptime = time.uptime
+local metrics_observe = metrics.observe
 
 -- XXX: maybe a light user data is better
 local MARK_NOT_IN_CHAIN = 0xf0403023
@@ -135,6 +137,52 @@ local function multi_serve(owner, svc, num, sec)
 	end
 end
 
+-- drain all the queued requests in one call of the handler
+local function batch_serve(owner, svc)
+	while not svc.svc_taskq do
+		owner.t_blockedby = svc
+		block_task(-1)
+	end
+
+	local task = svc.svc_taskq
+	local nhandle = svc.svc_nreq
+	local reqarr = svc.svc_reqarr
+	local resparr = svc.svc_resparr
+	local taskarr = svc.svc_taskarr
+	local errarr = svc.svc_errarr
+
+	svc.svc_taskq = false
+	svc.svc_nreq = 0
+	for i = 1, nhandle do
+		reqarr[i] = task.t_svcreq
+		errarr[i] = 0
+		task.t_svcreq = MARK_NOT_IN_CHAIN
+		taskarr[i] = task
+		task = task.t_svcnext
+	end
+
+	local tm_start = uptime()
+	svc.svc_handler(reqarr, resparr, errarr, nhandle)
+	local elapsed = uptime() - tm_start
+
+	for i = 1, nhandle do
+		task = taskarr[i]
+		-- skip the tasks timed out(and probably requesting again) while handling
+		if task.t_blockedby == svc and task.t_svcreq == MARK_NOT_IN_CHAIN then
+			-- t_err is overwritten by resume_task
+			task.t_svcresp = resparr[i]
+			task.t_svcerr = errarr[i]
+			resume_task(task)
+		end
+		reqarr[i], resparr[i], taskarr[i] = nil, nil, nil
+	end
+
+	svc.svc_nbatch = svc.svc_nbatch + 1
+	svc.svc_nserved = svc.svc_nserved + nhandle
+	svc.svc_secperreq = svc.svc_secperreq * 0.875 + elapsed / nhandle * 0.125
+	metrics_observe(svc.svc_mbatch, nhandle, svc.svc_mseconds, elapsed)
+end
+
 -- cb is running in a separate task
 function tasklet.create_service(name, cb)
 	if svc_byname[name] then
@@ -196,6 +244,92 @@ function tasklet.create_multi_service(name, cb, max_concurrent, interval)
 	return svc
 end
 
+-- Create a service whose handler takes all the requests queued since its last
+-- call, as create_multi_service does but without the limit and the polling
+-- interval: the owner wakes up as soon as a request arrives, and requests
+-- arriving while the handler is running(blocked) make the next batch bigger.
+--
+-- cb(reqarr, resparr, errarr, num) fills resparr[1 .. num] and optionally
+-- errarr[1 .. num](defaulted to 0).
+--
+-- The batch sizes and handling time are observed by the metrics
+-- 'service_<name>_batch_size' and 'service_<name>_seconds'.
+-- See tasklet.service_load for backpressure.
+function tasklet.create_batch_service(name, cb)
+	if svc_byname[name] then
+		error('service ' .. name .. ' already exists')
+	end
+
+	local mname = 'service_' .. name:gsub('[^%w_]', '_')
+	local svc = {
+		svc_name = name,
+		svc_owner = false,
+		svc_batch = true,
+		svc_reqarr = {},
+		svc_resparr = {},
+		svc_errarr = {},
+		svc_taskarr = {},
+		svc_taskq = false, -- requesting task list
+		svc_nreq = 0,   -- number of elements of requesting task list
+		svc_nbatch = 0,
+		svc_nserved = 0,
+		svc_secperreq = 0, -- moving average of the handling time per request
+		svc_mbatch = metrics.histogram(mname .. '_batch_size', 'Requests handled by one call of service ' .. name),
+		svc_mseconds = metrics.histogram(mname .. '_seconds', 'Time spent in the handler of service ' .. name, 1e-6),
+		svc_handler = cb,
+	}
+	svc_byname[name] = svc
+	svc.svc_owner = tasklet.start_task(function ()
+		local owner = tasklet.current_task()
+		while true do
+			batch_serve(owner, svc)
+		end
+	end)
+	return svc
+end
+
+-- Return (depth, sec_per_req) of a batch service:
+--   depth: number of requests queued and not handled yet
+--   sec_per_req: moving average of the handling time per request
+--
+-- A caller may reject or delay new requests when depth * sec_per_req(the
+-- expected waiting time) is too long.
+function tasklet.service_load(svc)
+	if type(svc) == 'string' then
+		svc = svc_byname[svc]
+	end
+	return svc.svc_nreq, svc.svc_secperreq
+end
+
+local function batch_service_request(svc, req, sec)
+	local task = current_task()
+
+	task.t_svcreq = req
+	task.t_svcreqtime = tasklet.now
+	push_task(svc, 'svc_taskq', task)
+	task.t_blockedby = svc
+	svc.svc_nreq = svc.svc_nreq + 1
+
+	local owner = svc.svc_owner
+	if owner.t_blockedby == svc then
+		resume_task(owner)
+	end
+
+	local err = block_task(sec or -1)
+	if err == 0 then
+		local resp = task.t_svcresp
+		task.t_svcresp = false
+		return resp, task.t_svcerr
+	else
+		if task.t_svcreq ~= MARK_NOT_IN_CHAIN then
+			unlink_task(svc, 'svc_taskq', task)
+			svc.svc_nreq = svc.svc_nreq - 1
+		end
+		task.t_svcreqtime = false
+		return nil, err
+	end
+end
+
 local function service_request(svc, req, sec)
 	local task = current_task()
 
@@ -261,6 +395,9 @@ function tasklet.request(svc, req, sec)
 			error('')
 		end
 	end
+	if svc.svc_batch then
+		return batch_service_request(svc, req, sec)
+	end
 	return (svc.svc_nwait and multi_service_request or service_request)(svc, req, sec)
 end
 
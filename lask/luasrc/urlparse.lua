@@ -79,16 +79,8 @@ function urlparse.build_query(params, buf)
 	return buf_valid and buf or buf:str()
 end
 
-function urlparse.split_query(query, params)
-	params = params or { }
-	for pair in query:gmatch( "[^&;]+" ) do
-		local key, value = pair:match("^([^=]+)=(.+)$")
-		if key and value then
-			params[decode(key)] = decode(value)
-		end
-	end
-	return params
-end
+-- query is a string/buffer/reader
+urlparse.split_query = codec.parse_query
 	
 function urlparse.build(url, buf)
 	local buf_valid = buf
@@ -6,6 +6,7 @@
 
 #include "lstdimpl.h"
 #include <unistd.h>
+#include <sys/mman.h>
 
 static size_t pagesize = 0;
 
@@ -25,6 +26,75 @@ typedef struct _Writer {
 #define BUFFER_READERS 				"buffer_readers"
 #define BUFFER_WRITERS				"buffer_writers"
 
+/*
+** A slice(see buffer:slice) pins the memory of the buffer it's taken from,
+** the memory is freed when neither the buffer nor any slice uses it. The
+** bytes of the slices are never touched again: the buffer stops compacting
+** itself, and moves its data to a new memory when it needs to grow the old
+** one or starts over.
+*/
+BufferSeg* bufseg_new(uint8 *mem)
+{
+	BufferSeg *seg = NEW(BufferSeg);
+	seg->refs = 1;
+	seg->mem = mem;
+	seg->mapsiz = 0;
+	return seg;
+}
+
+void bufseg_release(BufferSeg *seg)
+{
+	if (--seg->refs == 0) {
+		if (seg->mapsiz > 0)
+			munmap(seg->mem, seg->mapsiz);
+		else
+			FREE(seg->mem);
+		FREE(seg);
+	}
+}
+
+void reader_pin(Reader *rd, BufferSeg *seg)
+{
+	if (seg != NULL)
+		seg->refs++;
+	rd->seg = seg;
+}
+
+void reader_unpin(Reader *rd)
+{
+	if (rd->seg != NULL) {
+		bufseg_release(rd->seg);
+		rd->seg = NULL;
+	}
+}
+
+/*
+** leave the memory to the slices, start over with a new one for 'minsiz' bytes,
+** the buffer is left as it was if that can't be allocated.
+*/
+static bool buffer_unshare(Buffer *buf, size_t minsiz)
+{
+	size_t newsiz = buf->minsiz;
+	uint8 *p = NULL;
+
+	if (minsiz > 0) {
+		while (newsiz < minsiz)
+			newsiz *= 2;
+		p = (uint8*)MALLOC(newsiz);
+		if (p == NULL)
+			return false;
+		memcpy(p, buf->data, buf->datasiz);
+	} else {
+		newsiz = 0;
+	}
+
+	bufseg_release(buf->seg);
+	buf->seg = NULL;
+	buf->mem = buf->data = p;
+	buf->memsiz = newsiz;
+	return true;
+}
+
 /******************************************************************************
 	buffer
 ******************************************************************************/
@@ -44,6 +114,7 @@ void buffer_init(Buffer *buf, size_t minsiz)
 	buf->be = true;
 	buf->rd = false;
 	buf->wr = false;
+	buf->seg = NULL;
 }
 
 uint8* buffer_grow(Buffer *buf, size_t growth)
@@ -53,7 +124,10 @@ uint8* buffer_grow(Buffer *buf, size_t growth)
 	uint8 *p;
 
 	if (rgap < growth) {
-		if ((lgap + rgap) >= growth) {
+		if (buf->seg != NULL) {
+			if (!buffer_unshare(buf, buf->datasiz + growth))
+				return NULL;
+		} else if ((lgap + rgap) >= growth) {
 			memmove(buf->mem, buf->data, buf->datasiz);
 			buf->data = buf->mem;
 		} else {
@@ -96,7 +170,9 @@ size_t buffer_push(Buffer *buf, const void *mem, size_t memsiz)
 static void buffer_adjust(Buffer *buf)
 {
 	size_t datasiz = buf->datasiz;
-	if (datasiz == 0) {
+	if (buf->seg != NULL) {
+		return;
+	} else if (datasiz == 0) {
 		buf->data = buf->mem;
 	} else {
 		size_t lgap = buf->data - buf->mem;
@@ -142,13 +218,18 @@ void buffer_shift(Buffer *buf, size_t siz)
 
 void buffer_rewind(Buffer *buf)
 {
-	buf->data = buf->mem;
 	buf->datasiz = 0;
+	if (buf->seg != NULL && !buffer_unshare(buf, buf->memsiz))
+		buffer_unshare(buf, 0);
+	buf->data = buf->mem;
 }
 
 void buffer_reset(Buffer *buf)
 {
-	if (buf->memsiz > buf->minsiz) {
+	if (buf->seg != NULL) {
+		buf->datasiz = 0;
+		buffer_unshare(buf, 0);
+	} else if (buf->memsiz > buf->minsiz) {
 		buf->mem = REALLOC(buf->mem, buf->minsiz);
 		buf->memsiz = buf->minsiz;
 	}
@@ -158,8 +239,11 @@ void buffer_reset(Buffer *buf)
 
 void buffer_finalize(Buffer *buf)
 {
-	if (buf->mem)
+	if (buf->seg != NULL)
+		bufseg_release(buf->seg);
+	else if (buf->mem)
 		(void)FREE(buf->mem);
+	buf->seg = NULL;
 
 	buf->mem = buf->data = NULL;
 	buf->memsiz = buf->datasiz = 0;
@@ -298,6 +382,7 @@ static int lbuffer_reader(lua_State *L)
 				lua_pop(L, 1);
 				reader = lua_newuserdata(L, sizeof(Reader)); /* [readers, ud] */
 				l_setmetatable(L, -1, READER_META);
+				reader->seg = NULL;
 				lua_pushlightuserdata(L, buffer);	/* [readers, rd, buf] */
 				lua_pushvalue(L, -2);	/* [readers, rd, buf, rd] */
 				lua_rawset(L, -4);
@@ -320,6 +405,7 @@ static int lbuffer_reader(lua_State *L)
 		if (offset + length > buffer->datasiz)
 			length = buffer->datasiz - offset;
 
+		reader_unpin(reader);
 		reader_init(reader, buffer->data + offset, length);
 	} else {
 		Reader *reader = lua_newuserdata(L, sizeof(Reader)); /* [readers, ud] */
@@ -329,6 +415,37 @@ static int lbuffer_reader(lua_State *L)
 	return 1;
 }
 
+/*
+** rd = buffer:slice(length=all)
+**
+** take the first 'length' bytes out of the buffer as a reader, without copying.
+**
+** unlike buffer:reader(), the reader remains valid whatever is done to the
+** buffer afterwards, it keeps the memory until being collected.
+*/
+static int lbuffer_slice(lua_State *L)
+{
+	Buffer *buffer = buffer_lcheck(L, 1);
+	size_t length = (size_t)luaL_optinteger(L, 2, buffer->datasiz);
+	Reader *reader;
+
+	if (length > buffer->datasiz)
+		length = buffer->datasiz;
+
+	reader = lua_newuserdata(L, sizeof(Reader));
+	l_setmetatable(L, -1, READER_META);
+	reader_init(reader, buffer->data, length);
+
+	if (length > 0) {
+		if (buffer->seg == NULL)
+			buffer->seg = bufseg_new(buffer->mem);
+		reader_pin(reader, buffer->seg);
+		buffer->data += length;
+		buffer->datasiz -= length;
+	}
+	return 1;
+}
+
 /*
 ** wr = buffer:writer(length, wr=nil)
 */
@@ -399,7 +516,7 @@ static int lbuffer_setbe(lua_State *L)
 static int lbuffer_beginlen(lua_State *L)
 {
 	Buffer *buffer = buffer_lcheck(L, 1);
-	buffer_grow(buffer, 4);
+	buffer_safegrow(buffer, 4, L);
 	lua_pushinteger(L, buffer->datasiz);
 	return 1;
 }
@@ -600,7 +717,7 @@ static int lbuffer_fill(lua_State *L)
 {
 	Buffer *buffer = buffer_lcheck(L, 1);
 	size_t length = (size_t)luaL_checkinteger(L, 3);
-	memset(buffer_grow(buffer, length), (uint8)luaL_checkinteger(L, 2), length);
+	memset(buffer_safegrow(buffer, length, L), (uint8)luaL_checkinteger(L, 2), length);
 	lua_pushvalue(L, 1);
 	return 1;
 }
@@ -778,26 +895,74 @@ static int lbuffer_putstr(lua_State *L)
 	return 1;
 }
 
+/*
+** self = buffer:putlstr(str1, str2, ..., strN)
+**
+** push each string prefixed with its length as a 32-bit unsigned integer,
+** so it can be read back by getu + getlstr.
+**
+** non-string values are converted as tostring() does.
+*/
+static int lbuffer_putlstr(lua_State *L)
+{
+	Buffer *buffer = buffer_lcheck(L, 1);
+	int top = lua_gettop(L);
+
+	for (int i = 2; i <= top; i++) {
+		size_t len;
+		const char *str = NULL;
+		uint8 *p;
+
+		if (lua_type(L, i) == LUA_TSTRING || lua_type(L, i) == LUA_TNUMBER) {
+			str = lua_tolstring(L, i, &len);
+		} else {
+			/* the converted string replaces the argument, anchored until copied */
+			luaL_tolstring(L, i, &len);
+			lua_replace(L, i);
+			str = lua_tolstring(L, i, &len);
+		}
+
+		p = buffer_safegrow(buffer, len + 4, L);
+		if (buffer->be) {
+			uint32_to_bytes_be((uint32)len, p);
+		} else {
+			uint32_to_bytes_le((uint32)len, p);
+		}
+		memcpy(p + 4, str, len);
+	}
+
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
 /*
 ** self = buffer:putreader(rd, offset=0, length=all)
+**
+** 'rd' can also be a chain.
 */
 static int lbuffer_putreader(lua_State *L)
 {
 	Buffer *buffer = buffer_lcheck(L, 1);
-	Reader *reader = reader_lcheck(L, 2);
+	Chain *chain = chain_test(L, 2);
+	Reader *reader = chain == NULL ? reader_lcheck(L, 2) : NULL;
+	size_t datasiz = chain != NULL ? chain->datasiz : reader->datasiz;
 	size_t offset = (size_t)luaL_optinteger(L, 3, 0);
-	size_t length = reader->datasiz;
+	size_t length = datasiz;
 
 	if (lua_gettop(L) >= 4)
 		length = (size_t)luaL_checkinteger(L, 4);
 
-	if (offset >= reader->datasiz)
+	if (offset >= datasiz)
 		length = 0;
-	else if ((offset + length) > reader->datasiz)
-		length = (reader->datasiz - offset);
+	else if ((offset + length) > datasiz)
+		length = (datasiz - offset);
 
-	if (length > 0)
-		buffer_push(buffer, reader->data + offset, length);
+	if (length > 0) {
+		if (chain != NULL)
+			chain_copy(chain, offset, length, buffer_safegrow(buffer, length, L));
+		else
+			buffer_push(buffer, reader->data + offset, length);
+	}
 
 	lua_pushvalue(L, 1);
 	return 1;
@@ -922,6 +1087,7 @@ static const luaL_Reg buffer_methods[] =  {
 	{"str", lbuffer_str},
 	{"setbe", lbuffer_setbe},
 	{"reader", lbuffer_reader},
+	{"slice", lbuffer_slice},
 	{"writer", lbuffer_writer},
 	{"beginlen", lbuffer_beginlen},
 	{"endlen", lbuffer_endlen},
@@ -941,6 +1107,7 @@ static const luaL_Reg buffer_methods[] =  {
 	{"putu", lbuffer_putu},
 	{"putlist", lbuffer_putlist},
     {"putstr", lbuffer_putstr},
+	{"putlstr", lbuffer_putlstr},
 	{"putreader", lbuffer_putreader},
 	{"overwrite", lbuffer_overwrite},
     {"pop", lbuffer_pop},
@@ -0,0 +1,669 @@
+/*
+ * Copyright (C) spyder
+ */
+
+
+#include "lstdimpl.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define CHAIN_PAGE_SIZE 			16384
+
+/* iovecs passed to one writev() */
+#define CHAIN_IOV_MAX 				64
+
+/*
+** A chain holds its data in pages of a fixed size, so growing it never moves
+** what's already there, and a large body costs no more memory than its size.
+**
+** Each page is a BufferSeg, which can be shared with the readers returned by
+** chain:segments(), with the chains split from it, or be the memory pinned by
+** a slice(see buffer:slice) appended to it. The bytes of a shared page are
+** never written again: a chain only appends to the pages it allocated itself
+** ([lo, hi) is empty for the others), and only prepends to a page no one
+** else uses.
+*/
+
+static ChainPage* page_new(Chain *chain)
+{
+	ChainPage *page = NEW(ChainPage);
+	uint8 *mem = (uint8*)MALLOC(chain->pagesiz);
+
+	page->next = NULL;
+	page->seg = bufseg_new(mem);
+	page->lo = page->data = mem;
+	page->hi = mem + chain->pagesiz;
+	page->datasiz = 0;
+	chain->npages++;
+	return page;
+}
+
+/* a page of the bytes [data, data+datasiz) of 'seg', which is not writable */
+static ChainPage* page_share(Chain *chain, BufferSeg *seg, const uint8 *data, size_t datasiz)
+{
+	ChainPage *page = NEW(ChainPage);
+
+	seg->refs++;
+	page->next = NULL;
+	page->seg = seg;
+	page->lo = page->data = (uint8*)data;
+	page->hi = page->data + datasiz;
+	page->datasiz = datasiz;
+	chain->npages++;
+	return page;
+}
+
+static void page_free(Chain *chain, ChainPage *page)
+{
+	bufseg_release(page->seg);
+	FREE(page);
+	chain->npages--;
+}
+
+static void chain_link(Chain *chain, ChainPage *page)
+{
+	if (chain->tail != NULL)
+		chain->tail->next = page;
+	else
+		chain->head = page;
+	chain->tail = page;
+	chain->datasiz += page->datasiz;
+}
+
+static void chain_init(Chain *chain, size_t pagesiz)
+{
+	chain->magic = CHAIN_MAGIC;
+	chain->head = chain->tail = NULL;
+	chain->datasiz = 0;
+	chain->pagesiz = pagesiz;
+	chain->npages = 0;
+	chain->cur = NULL;
+	chain->curoff = 0;
+}
+
+static void chain_clear(Chain *chain)
+{
+	ChainPage *page = chain->head;
+
+	while (page != NULL) {
+		ChainPage *next = page->next;
+		page_free(chain, page);
+		page = next;
+	}
+	chain->head = chain->tail = NULL;
+	chain->datasiz = 0;
+	chain->cur = NULL;
+	chain->curoff = 0;
+}
+
+static void chain_push(Chain *chain, const uint8 *mem, size_t memsiz)
+{
+	while (memsiz > 0) {
+		ChainPage *tail = chain->tail;
+		size_t room = 0;
+		size_t n;
+
+		if (tail != NULL)
+			room = tail->hi - (tail->data + tail->datasiz);
+		if (room == 0) {
+			tail = page_new(chain);
+			chain_link(chain, tail);
+			room = chain->pagesiz;
+		}
+
+		n = MIN(room, memsiz);
+		memcpy(tail->data + tail->datasiz, mem, n);
+		tail->datasiz += n;
+		chain->datasiz += n;
+		mem += n;
+		memsiz -= n;
+	}
+}
+
+/* the bytes of a slice are shared rather than copied, unless too few to be worth a page */
+static void chain_put(Chain *chain, BufferSeg *seg, const uint8 *data, size_t datasiz)
+{
+	if (seg != NULL && datasiz >= chain->pagesiz / 4)
+		chain_link(chain, page_share(chain, seg, data, datasiz));
+	else
+		chain_push(chain, data, datasiz);
+}
+
+static void chain_prepend(Chain *chain, const uint8 *mem, size_t memsiz)
+{
+	while (memsiz > 0) {
+		ChainPage *head = chain->head;
+		size_t room = 0;
+		size_t n;
+
+		if (head != NULL && head->seg->refs == 1)
+			room = head->data - head->lo;
+		if (room == 0) {
+			/* filled from the end, so the next prepending goes to the same page */
+			head = page_new(chain);
+			head->data = head->hi;
+			head->next = chain->head;
+			chain->head = head;
+			if (chain->tail == NULL)
+				chain->tail = head;
+			room = chain->pagesiz;
+		}
+
+		n = MIN(room, memsiz);
+		head->data -= n;
+		head->datasiz += n;
+		memcpy(head->data, mem + memsiz - n, n);
+		chain->datasiz += n;
+		memsiz -= n;
+	}
+	chain->cur = NULL;
+}
+
+/* move all the pages of 'from' to the head of 'chain' */
+static void chain_splice(Chain *chain, Chain *from)
+{
+	if (from->head == NULL)
+		return;
+
+	from->tail->next = chain->head;
+	if (chain->tail == NULL)
+		chain->tail = from->tail;
+	chain->head = from->head;
+	chain->datasiz += from->datasiz;
+	chain->npages += from->npages;
+	chain->cur = NULL;
+
+	from->head = from->tail = NULL;
+	from->datasiz = 0;
+	from->npages = 0;
+	from->cur = NULL;
+}
+
+static void chain_shift(Chain *chain, size_t siz)
+{
+	if (siz > chain->datasiz)
+		siz = chain->datasiz;
+
+	chain->datasiz -= siz;
+	while (siz > 0) {
+		ChainPage *head = chain->head;
+		if (head->datasiz <= siz) {
+			siz -= head->datasiz;
+			chain->head = head->next;
+			page_free(chain, head);
+		} else {
+			head->data += siz;
+			head->datasiz -= siz;
+			siz = 0;
+		}
+	}
+	if (chain->head == NULL)
+		chain->tail = NULL;
+	chain->cur = NULL;
+}
+
+/* move the first 'siz' bytes of 'chain' to the empty chain 'to' */
+static void chain_split(Chain *chain, size_t siz, Chain *to)
+{
+	if (siz > chain->datasiz)
+		siz = chain->datasiz;
+
+	while (siz > 0) {
+		ChainPage *head = chain->head;
+		if (head->datasiz <= siz) {
+			siz -= head->datasiz;
+			chain->head = head->next;
+			chain->datasiz -= head->datasiz;
+			chain->npages--;
+			head->next = NULL;
+			to->npages++;
+			chain_link(to, head);
+		} else {
+			chain_link(to, page_share(to, head->seg, head->data, siz));
+			head->data += siz;
+			head->datasiz -= siz;
+			chain->datasiz -= siz;
+			siz = 0;
+		}
+	}
+	if (chain->head == NULL)
+		chain->tail = NULL;
+	chain->cur = NULL;
+}
+
+/* find the page holding the byte at 'offset', and where it is in the page */
+static ChainPage* chain_seek(Chain *chain, size_t offset, size_t *pageoff)
+{
+	ChainPage *page = chain->head;
+	size_t off = 0;
+
+	/* mostly looked up in order, by os.writeb or chain:segments() */
+	if (chain->cur != NULL && chain->curoff <= offset) {
+		page = chain->cur;
+		off = chain->curoff;
+	}
+
+	while (page != NULL && off + page->datasiz <= offset) {
+		off += page->datasiz;
+		page = page->next;
+	}
+
+	if (page != NULL) {
+		chain->cur = page;
+		chain->curoff = off;
+		*pageoff = offset - off;
+	}
+	return page;
+}
+
+/* fill at most 'maxiov' iovecs with the bytes [offset, offset+length) */
+static int chain_iovec(Chain *chain, size_t offset, size_t length, struct iovec *iov, int maxiov)
+{
+	size_t pageoff = 0;
+	ChainPage *page = chain_seek(chain, offset, &pageoff);
+	int niov = 0;
+
+	while (page != NULL && length > 0 && niov < maxiov) {
+		size_t n = MIN(page->datasiz - pageoff, length);
+		iov[niov].iov_base = page->data + pageoff;
+		iov[niov].iov_len = n;
+		niov++;
+		length -= n;
+		pageoff = 0;
+		page = page->next;
+	}
+	return niov;
+}
+
+void chain_copy(Chain *chain, size_t offset, size_t length, uint8 *dst)
+{
+	struct iovec iov[CHAIN_IOV_MAX];
+
+	while (length > 0) {
+		int niov = chain_iovec(chain, offset, length, iov, CHAIN_IOV_MAX);
+		if (niov == 0)
+			break;
+		for (int i = 0; i < niov; i++) {
+			memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+			dst += iov[i].iov_len;
+			offset += iov[i].iov_len;
+			length -= iov[i].iov_len;
+		}
+	}
+}
+
+/* the same as os_write(), but the pages are written by writev() */
+int chain_write(int fd, Chain *chain, size_t offset, size_t length, size_t *ndone)
+{
+	struct iovec iov[CHAIN_IOV_MAX];
+	size_t total = 0;
+	int err = 0;
+
+	if (ndone != NULL)
+		*ndone = 0;
+
+	while (total < length) {
+		int niov = chain_iovec(chain, offset + total, length - total, iov, CHAIN_IOV_MAX);
+		ssize_t ret = writev(fd, iov, niov);
+		err = 0;
+		if (ret > 0) {
+			total += (size_t)ret;
+		} else if (ret == 0) {
+			break;
+		} else {
+			err = errno;
+			if (err == EINTR)
+				continue;
+			else {
+				if (err == EWOULDBLOCK || err == EAGAIN)
+					err = 0;
+				break;
+			}
+		}
+	}
+	if (err == 0 && ndone != NULL)
+		*ndone = total;
+
+	return err;
+}
+
+Chain* chain_test(lua_State *L, int idx)
+{
+	Chain *chain = lua_touserdata(L, idx);
+	if (chain == NULL || chain->magic != CHAIN_MAGIC)
+		return NULL;
+	return chain;
+}
+
+static Chain* chain_lcheck(lua_State *L, int idx)
+{
+	Chain *chain = chain_test(L, idx);
+	if (chain == NULL)
+		luaL_error(L, "expecting chain(userdata) for argument %d", idx);
+	return chain;
+}
+
+static Chain* chain_lnew(lua_State *L, size_t pagesiz)
+{
+	Chain *chain = lua_newuserdata(L, sizeof(Chain));
+	chain_init(chain, pagesiz);
+	l_setmetatable(L, -1, CHAIN_META);
+	return chain;
+}
+
+/* clamp [offset, offset+length) of 'datasiz' bytes, with the arguments at 'idx' and 'idx+1' */
+static size_t check_range(lua_State *L, int idx, size_t datasiz, size_t *offset)
+{
+	size_t length;
+
+	*offset = (size_t)luaL_optinteger(L, idx, 0);
+	length = (size_t)luaL_optinteger(L, idx + 1, (lua_Integer)datasiz);
+
+	if (*offset >= datasiz)
+		length = 0;
+	else if ((*offset + length) > datasiz)
+		length = datasiz - *offset;
+	return length;
+}
+
+/******************************************************************************
+	lua-chain
+******************************************************************************/
+
+/*
+** chain = buffer.chain(pagesiz=16384)
+*/
+static int lchain_new(lua_State *L)
+{
+	lua_Integer pagesiz = luaL_optinteger(L, 1, CHAIN_PAGE_SIZE);
+	luaL_argcheck(L, pagesiz >= 64, 1, "page size too small");
+	chain_lnew(L, (size_t)pagesiz);
+	return 1;
+}
+
+/*
+** chain:__gc
+*/
+static int lchain_gc(lua_State *L)
+{
+	Chain *chain = chain_lcheck(L, 1);
+	chain_clear(chain);
+	return 0;
+}
+
+/*
+** chain:__tostring
+*/
+static int lchain_tostring(lua_State *L)
+{
+	Chain *chain = chain_lcheck(L, 1);
+	char buf[LINE_MAX];
+	snprintf(buf, sizeof(buf), "chain (%p, datasiz=%u, pages=%u, pagesiz=%u)",
+			chain, (unsigned int)chain->datasiz, (unsigned int)chain->npages, (unsigned int)chain->pagesiz);
+	lua_pushstring(L, buf);
+	return 1;
+}
+
+/*
+** __len
+*/
+static int lchain_len(lua_State *L)
+{
+	lua_pushinteger(L, chain_lcheck(L, 1)->datasiz);
+	return 1;
+}
+
+/*
+** str = chain:str(offset=0, length=all)
+*/
+static int lchain_str(lua_State *L)
+{
+	Chain *chain = chain_lcheck(L, 1);
+	size_t offset;
+	size_t length = check_range(L, 2, chain->datasiz, &offset);
+	luaL_Buffer b;
+
+	chain_copy(chain, offset, length, (uint8*)luaL_buffinitsize(L, &b, length));
+	luaL_pushresultsize(&b, length);
+	return 1;
+}
+
+/*
+** self = chain:putstr(str1, str2, ..., strN)
+*/
+static int lchain_putstr(lua_State *L)
+{
+	Chain *chain = chain_lcheck(L, 1);
+	int top = lua_gettop(L);
+
+	for (int i = 2; i <= top; i++) {
+		size_t len;
+		const char *str = NULL;
+		if (lua_isnil(L, i)) {
+			str = "nil";
+			len = 3;
+		} else {
+			str = luaL_checklstring(L, i, &len);
+		}
+		chain_push(chain, (const uint8*)str, len);
+	}
+
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/* append the bytes of reader/buffer/chain at 'idx' to 'chain', with offset/length after it */
+static void put_userdata(lua_State *L, Chain *chain, int idx)
+{
+	union {
+		const Buffer *buffer;
+		const Reader *reader;
+		Chain *chain;
+	}ptr;
+	size_t offset, length;
+
+	ptr.buffer = (const Buffer*)lua_touserdata(L, idx);
+	if (ptr.buffer != NULL && ptr.buffer->magic == BUFFER_MAGIC) {
+		/* the bytes of a buffer may be written again, always copied */
+		length = check_range(L, idx + 1, ptr.buffer->datasiz, &offset);
+		chain_push(chain, ptr.buffer->data + offset, length);
+	} else if (ptr.buffer != NULL && ptr.reader->magic == READER_MAGIC) {
+		length = check_range(L, idx + 1, ptr.reader->datasiz, &offset);
+		chain_put(chain, ptr.reader->seg, ptr.reader->data + offset, length);
+	} else if (ptr.buffer != NULL && ptr.chain->magic == CHAIN_MAGIC) {
+		Chain *from = ptr.chain;
+		size_t pageoff = 0;
+		ChainPage *page;
+
+		if (from == chain)
+			luaL_argerror(L, idx, "the same as self");
+
+		length = check_range(L, idx + 1, from->datasiz, &offset);
+		page = length > 0 ? chain_seek(from, offset, &pageoff) : NULL;
+		while (length > 0) {
+			size_t n = MIN(page->datasiz - pageoff, length);
+			chain_put(chain, page->seg, page->data + pageoff, n);
+			length -= n;
+			pageoff = 0;
+			page = page->next;
+		}
+	} else {
+		luaL_argerror(L, idx, "reader/buffer/chain expected");
+	}
+}
+
+/*
+** self = chain:putreader(rd, offset=0, length=all)
+**
+** 'rd' can also be a buffer or another chain.
+**
+** the bytes of a slice(see buffer:slice) or a chain are shared rather than
+** copied, unless they are less than a quarter of a page.
+*/
+static int lchain_putreader(lua_State *L)
+{
+	put_userdata(L, chain_lcheck(L, 1), 2);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*
+** self = chain:prepend(str_or_rd, offset=0, length=all)
+**
+** put the bytes in front of the chain, 'str_or_rd' can be string/buffer/reader/chain.
+*/
+static int lchain_prepend(lua_State *L)
+{
+	Chain *chain = chain_lcheck(L, 1);
+
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		size_t offset, len;
+		const uint8 *str = (const uint8*)lua_tolstring(L, 2, &len);
+		size_t length = check_range(L, 3, len, &offset);
+		chain_prepend(chain, str + offset, length);
+	} else if (lua_isuserdata(L, 2)) {
+		union {
+			const Buffer *buffer;
+			const Reader *reader;
+		}ptr;
+		size_t offset, length;
+
+		/* the bytes to be copied, like a header, mostly fit in the room before the first page */
+		ptr.buffer = (const Buffer*)lua_touserdata(L, 2);
+		if (ptr.buffer->magic == BUFFER_MAGIC) {
+			length = check_range(L, 3, ptr.buffer->datasiz, &offset);
+			chain_prepend(chain, ptr.buffer->data + offset, length);
+		} else if (ptr.reader->magic == READER_MAGIC && ptr.reader->seg == NULL) {
+			length = check_range(L, 3, ptr.reader->datasiz, &offset);
+			chain_prepend(chain, ptr.reader->data + offset, length);
+		} else {
+			Chain tmp;
+			chain_init(&tmp, chain->pagesiz);
+			put_userdata(L, &tmp, 2);
+			chain_splice(chain, &tmp);
+		}
+	} else {
+		luaL_argerror(L, 2, "string/buffer/reader/chain expected");
+	}
+
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*
+** head = chain:split(length)
+**
+** take the first 'length' bytes out of the chain as a new chain, only the page
+** holding the boundary is shared, no byte is copied.
+*/
+static int lchain_split(lua_State *L)
+{
+	Chain *chain = chain_lcheck(L, 1);
+	size_t length = (size_t)luaL_checkinteger(L, 2);
+	Chain *head = chain_lnew(L, chain->pagesiz);
+
+	chain_split(chain, length, head);
+	return 1;
+}
+
+/*
+** self = chain:shift(length)
+**
+** discard the first 'length' bytes.
+*/
+static int lchain_shift(lua_State *L)
+{
+	Chain *chain = chain_lcheck(L, 1);
+	chain_shift(chain, (size_t)luaL_checkinteger(L, 2));
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*
+** self = chain:reset()
+**
+** discard all the data and free the pages
+*/
+static int lchain_reset(lua_State *L)
+{
+	chain_clear(chain_lcheck(L, 1));
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+static int segments_iter(lua_State *L)
+{
+	Chain *chain = chain_lcheck(L, lua_upvalueindex(1));
+	size_t offset = (size_t)lua_tointeger(L, lua_upvalueindex(2));
+	size_t pageoff = 0;
+	ChainPage *page = chain_seek(chain, offset, &pageoff);
+	Reader *rd;
+
+	if (page == NULL)
+		return 0;
+
+	if (lua_isnil(L, lua_upvalueindex(3))) {
+		rd = lua_newuserdata(L, sizeof(Reader));
+		l_setmetatable(L, -1, READER_META);
+	} else {
+		lua_pushvalue(L, lua_upvalueindex(3));
+		rd = reader_lcheck(L, -1);
+		reader_unpin(rd);
+	}
+	reader_init(rd, page->data + pageoff, page->datasiz - pageoff);
+	reader_pin(rd, page->seg);
+
+	lua_pushinteger(L, (lua_Integer)(offset + rd->datasiz));
+	lua_replace(L, lua_upvalueindex(2));
+	return 1;
+}
+
+/*
+** for rd in chain:segments(rd=nil) do ... end
+**
+** iterate the pages of the chain as readers, each of which pins its page and
+** remains valid whatever is done to the chain afterwards.
+**
+** 'rd' is reused for every page if given, a new reader is created otherwise.
+*/
+static int lchain_segments(lua_State *L)
+{
+	chain_lcheck(L, 1);
+	if (!lua_isnoneornil(L, 2))
+		reader_lcheck(L, 2);
+
+	lua_settop(L, 2);
+	lua_pushvalue(L, 1);
+	lua_pushinteger(L, 0);
+	lua_pushvalue(L, 2);
+	lua_pushcclosure(L, segments_iter, 3);
+	return 1;
+}
+
+static const luaL_Reg chain_methods[] = {
+	{"__gc", lchain_gc},
+	{"__tostring", lchain_tostring},
+	{"__len", lchain_len},
+	{"str", lchain_str},
+	{"putstr", lchain_putstr},
+	{"putreader", lchain_putreader},
+	{"prepend", lchain_prepend},
+	{"split", lchain_split},
+	{"shift", lchain_shift},
+	{"reset", lchain_reset},
+	{"segments", lchain_segments},
+	{NULL, NULL}
+};
+
+static const luaL_Reg buffer_funcs[] = {
+	{"chain", lchain_new},
+	{NULL, NULL}
+};
+
+int l_openchain(lua_State *L)
+{
+	l_register_lib(L, "buffer", buffer_funcs, NULL);
+	l_register_metatable2(L, CHAIN_META, chain_methods);
+	return 0;
+}
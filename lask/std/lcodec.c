@@ -7,6 +7,11 @@
 #include "lstdimpl.h"
 #include <ctype.h>
 
+#ifdef __SSE2__
+#define URL_SSE2
+#include <emmintrin.h>
+#endif
+
 static uint8 code_table[256] = {0};
 static const char *xdigits = "0123456789abcdefABCDEF";
 
@@ -21,98 +26,292 @@ static inline int xvalue(int c)
 }
 
 /*
-** str/buf = codec.urlencode(src, buf=nil)
+** The bytes are looked at 16 at once with SSE2, blocks with nothing to be
+** escaped/unescaped are copied as they are. The others go byte by byte.
 */
-static int lcodec_urlencode(lua_State *L)
+#ifdef URL_SSE2
+static inline int encode_mask(__m128i v)
 {
-	const char *src = luaL_checkstring(L, 1);
-	Buffer _buf;
-	Buffer *buf = &_buf;
-	char chbuf[36], *p = chbuf;
-	uint8 ch;
-	
-	if (lua_gettop(L) > 1) 
-		buf = buffer_lcheck(L, 2);
-	else
-		buffer_init(buf, 256);
-	
-	while ((ch = (uint8)*src) != 0) {
-		uint8 code = code_table[ch];
-		
-		if (p - chbuf >= 32) {
-			buffer_push(buf, (const uint8*)chbuf, p - chbuf);
-			p = chbuf;
+	int mask = _mm_movemask_epi8(v);  /* bytes >= 128 */
+	mask |= _mm_movemask_epi8(_mm_or_si128(
+		_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(';')), _mm_cmpeq_epi8(v, _mm_set1_epi8('/'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('?')), _mm_cmpeq_epi8(v, _mm_set1_epi8(':')))),
+		_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('@')), _mm_cmpeq_epi8(v, _mm_set1_epi8('&'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('=')), _mm_cmpeq_epi8(v, _mm_set1_epi8('+'))))));
+	mask |= _mm_movemask_epi8(_mm_or_si128(
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('$')), _mm_cmpeq_epi8(v, _mm_set1_epi8(','))),
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('%')), _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')))));
+	return mask;
+}
+
+static inline int decode_mask(__m128i v)
+{
+	return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('%')),
+		_mm_cmpeq_epi8(v, _mm_set1_epi8('+'))));
+}
+#endif
+
+/* whether urlencode() has nothing to do with the 'len' bytes */
+static bool encode_plain(const uint8 *src, size_t len)
+{
+	size_t i = 0;
+#ifdef URL_SSE2
+	for (; i + 16 <= len; i += 16) {
+		if (encode_mask(_mm_loadu_si128((const __m128i*)(src + i))) != 0)
+			return false;
+	}
+#endif
+	for (; i < len; i++) {
+		if (code_table[src[i]] > 1 || src[i] == ' ')
+			return false;
+	}
+	return true;
+}
+
+/* whether urldecode() has nothing to do with the 'len' bytes */
+static bool decode_plain(const uint8 *src, size_t len)
+{
+	size_t i = 0;
+#ifdef URL_SSE2
+	for (; i + 16 <= len; i += 16) {
+		if (decode_mask(_mm_loadu_si128((const __m128i*)(src + i))) != 0)
+			return false;
+	}
+#endif
+	return memchr(src + i, '%', len - i) == NULL && memchr(src + i, '+', len - i) == NULL;
+}
+
+/* encode 'len' bytes from 'src' to 'dst'(at least 3 * 'len' bytes), return the encoded length */
+static size_t urlencode_mem(const uint8 *src, size_t len, uint8 *dst)
+{
+	const uint8 *end = src + len;
+	const uint8 *stop;
+	uint8 *start = dst;
+
+	while (src < end) {
+		stop = end;
+#ifdef URL_SSE2
+		if (end - src >= 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)src);
+			if (encode_mask(v) == 0) {
+				_mm_storeu_si128((__m128i*)dst, v);
+				src += 16;
+				dst += 16;
+				continue;
+			}
+			stop = src + 16;
 		}
-		
-		if (code != 0 && code != 1) {
-			p[0] = '%';
-			p[1] = xdigits[code / 16];
-			p[2] = xdigits[code % 16];
-			p += 3;
-		} else {
-			p[0] = (ch != ' ') ? (char)ch : '+';
-			p++;
+#endif
+		while (src < stop) {
+			uint8 ch = *src++;
+			uint8 code = code_table[ch];
+			if (code > 1) {
+				dst[0] = '%';
+				dst[1] = xdigits[code / 16];
+				dst[2] = xdigits[code % 16];
+				dst += 3;
+			} else {
+				*dst++ = (ch != ' ') ? ch : '+';
+			}
 		}
-		src++;
 	}
-	if (p > chbuf)
-		buffer_push(buf, (const uint8*)chbuf, p - chbuf);
-	
-	if (buf == &_buf) {
-		lua_pushlstring(L, (const char*)buf->data, buf->datasiz);
-		buffer_finalize(buf);
-	} else {
-		lua_pushvalue(L, 2);
-	}
-	return 1;
+	return dst - start;
 }
 
-static char* urldecode(char *str)
+/* decode 'len' bytes from 'src' to 'dst'(at least 'len' bytes, may be 'src'), return the decoded length */
+static size_t urldecode_mem(const uint8 *src, size_t len, uint8 *dst)
 {
-	if (str != NULL) {
-		char *src = str, *dst = str;
-		while (*src != 0) {
-			if (src[0] == '%' && code_table[(uint8)src[1]] == 1 && code_table[(uint8)src[2]] == 1) {
-				*dst = (char)(xvalue(src[1]) * 16 + xvalue(src[2]));
+	const uint8 *end = src + len;
+	const uint8 *stop;
+	uint8 *start = dst;
+
+	while (src < end) {
+		stop = end;
+#ifdef URL_SSE2
+		if (end - src >= 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)src);
+			if (decode_mask(v) == 0) {
+				_mm_storeu_si128((__m128i*)dst, v);
+				src += 16;
+				dst += 16;
+				continue;
+			}
+			stop = src + 16;
+		}
+#endif
+		while (src < stop) {
+			if (src[0] == '+') {
+				*dst++ = ' ';
+				src++;
+			} else if (src[0] == '%' && end - src >= 3 && code_table[src[1]] == 1 && code_table[src[2]] == 1) {
+				*dst++ = (uint8)(xvalue(src[1]) * 16 + xvalue(src[2]));
 				src += 3;
 			} else {
-				if (*src == '+')
-					*dst = ' ';
-				else if (dst != src)
-					*dst = *src;
-				src++;
-			} 
-			dst++;
+				*dst++ = *src++;
+			}
 		}
-		*dst = 0;
+	}
+	return dst - start;
+}
+
+static char* urldecode(char *str)
+{
+	if (str != NULL) {
+		size_t len = strlen(str);
+		str[urldecode_mem((const uint8*)str, len, (uint8*)str)] = 0;
 	}
 	return str;
 }
 
+/* string/buffer/reader at 'idx' */
+static const uint8* check_data(lua_State *L, int idx, size_t *len)
+{
+	union {
+		const Buffer *buffer;
+		const Reader *reader;
+	}ptr;
+
+	if (lua_type(L, idx) == LUA_TSTRING)
+		return (const uint8*)lua_tolstring(L, idx, len);
+
+	if ((ptr.buffer = (const Buffer*)lua_touserdata(L, idx)) != NULL) {
+		if (ptr.buffer->magic == BUFFER_MAGIC) {
+			*len = ptr.buffer->datasiz;
+			return ptr.buffer->data;
+		} else if (ptr.reader->magic == READER_MAGIC) {
+			*len = ptr.reader->datasiz;
+			return ptr.reader->data;
+		}
+	}
+	luaL_argerror(L, idx, "string/buffer/reader expected");
+	return NULL;
+}
+
+#define ENCODE_CHUNK		4096
+
+/*
+** str/buf = codec.urlencode(src, buf=nil)
+*/
+static int lcodec_urlencode(lua_State *L)
+{
+	size_t len;
+	const uint8 *src = check_data(L, 1, &len);
+
+	if (lua_gettop(L) > 1) {
+		Buffer *buf = buffer_lcheck(L, 2);
+		if (lua_touserdata(L, 1) == buf)
+			luaL_argerror(L, 2, "the same as src");
+
+		/* in chunks, not to reserve 3 times of a big input */
+		while (len > 0) {
+			size_t n = MIN(len, ENCODE_CHUNK);
+			uint8 *p = buffer_grow(buf, n * 3);
+			buffer_pop(buf, n * 3 - urlencode_mem(src, n, p));
+			src += n;
+			len -= n;
+		}
+		lua_pushvalue(L, 2);
+	} else if (lua_type(L, 1) == LUA_TSTRING && encode_plain(src, len)) {
+		/* nothing to escape */
+		lua_settop(L, 1);
+	} else {
+		/* the GC owns a luaL_Buffer, nothing leaks if pushing the result raises */
+		luaL_Buffer b;
+		luaL_buffinit(L, &b);
+		while (len > 0) {
+			size_t n = MIN(len, ENCODE_CHUNK);
+			uint8 *p = (uint8*)luaL_prepbuffsize(&b, n * 3);
+			luaL_addsize(&b, urlencode_mem(src, n, p));
+			src += n;
+			len -= n;
+		}
+		luaL_pushresult(&b);
+	}
+	return 1;
+}
+
+/* decode 'len' bytes from 'src' and append them to 'buf' */
+static void urldecode_push(Buffer *buf, const uint8 *src, size_t len)
+{
+	uint8 *p = buffer_grow(buf, len);
+	buffer_pop(buf, len - urldecode_mem(src, len, p));
+}
+
+/*
+** push the decoded 'len' bytes from 'src'
+**
+** decoded in a luaL_Buffer owned by the GC, nothing leaks if pushing raises
+*/
+static void push_decoded(lua_State *L, const uint8 *src, size_t len)
+{
+	if (decode_plain(src, len)) {
+		lua_pushlstring(L, (const char*)src, len);
+	} else {
+		luaL_Buffer b;
+		uint8 *p = (uint8*)luaL_buffinitsize(L, &b, len);
+		luaL_pushresultsize(&b, urldecode_mem(src, len, p));
+	}
+}
+
 /*
 ** str/buf = codec.urldecode(src, buf=nil)
 */
 static int lcodec_urldecode(lua_State *L)
 {
-	size_t inlen = 0;
-	const char *in = luaL_checklstring(L, 1, &inlen);
-	size_t outlen = 0;
-	char out[inlen + 1];
-	Buffer *buf = NULL;
-	
-	if (lua_gettop(L) > 1)
-		buf = buffer_lcheck(L, 2);
-	
-	memcpy(out, in, inlen);
-	out[inlen] = 0;
-	urldecode(out);
-	outlen = strlen(out);
+	size_t len;
+	const uint8 *src = check_data(L, 1, &len);
 
-	if (buf != NULL) {
-		buffer_push(buf, (const uint8*)out, outlen);
+	if (lua_gettop(L) > 1) {
+		Buffer *buf = buffer_lcheck(L, 2);
+		if (lua_touserdata(L, 1) == buf)
+			luaL_argerror(L, 2, "the same as src");
+		urldecode_push(buf, src, len);
 		lua_pushvalue(L, 2);
+	} else if (lua_type(L, 1) == LUA_TSTRING && decode_plain(src, len)) {
+		/* nothing to decode */
+		lua_settop(L, 1);
+	} else {
+		push_decoded(L, src, len);
+	}
+	return 1;
+}
+
+/*
+** params = codec.parse_query(src, params=nil)
+**
+** src is a string/buffer/reader of 'k1=v1&k2=v2;k3=v3'. The pairs without a key or
+** a value are skipped.
+*/
+static int lcodec_parse_query(lua_State *L)
+{
+	size_t len;
+	const uint8 *src = check_data(L, 1, &len);
+	const uint8 *end = src + len;
+
+	if (lua_isnoneornil(L, 2)) {
+		lua_settop(L, 1);
+		lua_newtable(L);
 	} else {
-		lua_pushlstring(L, out, outlen);
+		luaL_checktype(L, 2, LUA_TTABLE);
+		lua_settop(L, 2);
+	}
+
+	while (src < end) {
+		const uint8 *pair_end = src;
+		const uint8 *eq = NULL;
+
+		while (pair_end < end && *pair_end != '&' && *pair_end != ';') {
+			if (eq == NULL && *pair_end == '=')
+				eq = pair_end;
+			pair_end++;
+		}
+
+		if (eq != NULL && eq > src && eq + 1 < pair_end) {
+			push_decoded(L, src, eq - src);
+			push_decoded(L, eq + 1, pair_end - eq - 1);
+			lua_rawset(L, 2);
+		}
+		src = pair_end + 1;
 	}
 	return 1;
 }
@@ -288,13 +487,14 @@ static const luaL_Reg funcs[] = {
 	{"urlencode", lcodec_urlencode},
 	{"urldecode", lcodec_urldecode},
 	{"urlsplit", lcodec_urlsplit},
+	{"parse_query", lcodec_parse_query},
 	{NULL, NULL},
 };
 
 int l_opencodec(lua_State *L)
 {
 	if (code_table['+'] == 0) {
-		const char *reserved = ";/?:@&=+$,";
+		const char *reserved = ";/?:@&=+$,%";
 		
 		for (const char *p = reserved; *p != 0; p++) {
 			code_table[(uint8)*p] = (uint8)*p;
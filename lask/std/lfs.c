@@ -13,6 +13,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/mman.h>
 
 #define FS_DIR_META			"meta(fs.dir)"
 #define FS_GLOB_META		"meta(fs.glob)"
@@ -351,6 +352,66 @@ static int ustat_retval(lua_State *L, struct stat *st, int err)
 	return 2;
 }
 
+void stat_pushtable(lua_State *L, const struct stat *st, int fields)
+{
+	lua_newtable(L);
+	if (fields & ST_UID) {
+		lua_pushstring(L,"uid");
+		lua_pushinteger(L, st->st_uid);
+		lua_settable(L, -3);
+	}
+	if (fields & ST_GID) {
+		lua_pushstring(L,"gid");
+		lua_pushinteger(L, st->st_gid);
+		lua_settable(L, -3);
+	}
+	if (fields & ST_NLINK) {
+		lua_pushstring(L,"nlink");
+		lua_pushinteger(L, st->st_nlink);
+		lua_settable(L, -3);
+	}
+	if (fields & ST_MODE) {
+		lua_pushstring(L,"mode");
+		lua_pushinteger(L, st->st_mode);
+		lua_settable(L, -3);
+	}
+	if (fields & ST_DEV) {
+		lua_pushstring(L,"dev");
+		lua_pushinteger(L, st->st_dev);
+		lua_settable(L, -3);
+	}
+	if (fields & ST_INO) {
+		lua_pushstring(L,"ino");
+		lua_pushinteger(L, st->st_ino);
+		lua_settable(L, -3);
+	}
+	if (fields & ST_RDEV) {
+		lua_pushstring(L,"rdev");
+		lua_pushinteger(L, st->st_rdev);
+		lua_settable(L, -3);
+	}
+	if (fields & ST_SIZE) {
+		lua_pushstring(L,"size");
+		lua_pushinteger(L, st->st_size);
+		lua_settable(L, -3);
+	}
+	if (fields & ST_ATIME) {
+		lua_pushstring(L,"atime");
+		lua_pushinteger(L, st->st_atime);
+		lua_settable(L, -3);
+	}
+	if (fields & ST_MTIME) {
+		lua_pushstring(L,"mtime");
+		lua_pushinteger(L, st->st_mtime);
+		lua_settable(L, -3);
+	}
+	if (fields & ST_CTIME) {
+		lua_pushstring(L,"ctime");
+		lua_pushinteger(L, st->st_ctime);
+		lua_settable(L, -3);
+	}
+}
+
 static int stat_retval(lua_State *L, struct stat *st, int err)
 {
 	if (err != 0) {
@@ -361,62 +422,7 @@ static int stat_retval(lua_State *L, struct stat *st, int err)
 		if (lua_gettop(L) >= 2) {
 			fields = lua_tointeger(L, 2);
 		}
-		lua_newtable(L);
-		if (fields & ST_UID) {
-			lua_pushstring(L,"uid");
-			lua_pushinteger(L, st->st_uid);
-			lua_settable(L, -3);
-		}
-		if (fields & ST_GID) {
-			lua_pushstring(L,"gid");
-			lua_pushinteger(L, st->st_gid);
-			lua_settable(L, -3);
-		}
-		if (fields & ST_NLINK) {
-			lua_pushstring(L,"nlink");
-			lua_pushinteger(L, st->st_nlink);
-			lua_settable(L, -3);
-		}
-		if (fields & ST_MODE) {
-			lua_pushstring(L,"mode");
-			lua_pushinteger(L, st->st_mode);
-			lua_settable(L, -3);
-		}
-		if (fields & ST_DEV) {
-			lua_pushstring(L,"dev");
-			lua_pushinteger(L, st->st_dev);
-			lua_settable(L, -3);
-		}
-		if (fields & ST_INO) {
-			lua_pushstring(L,"ino");
-			lua_pushinteger(L, st->st_ino);
-			lua_settable(L, -3);
-		}
-		if (fields & ST_RDEV) {
-			lua_pushstring(L,"rdev");
-			lua_pushinteger(L, st->st_rdev);
-			lua_settable(L, -3);
-		}
-		if (fields & ST_SIZE) {
-			lua_pushstring(L,"size");
-			lua_pushinteger(L, st->st_size);
-			lua_settable(L, -3);
-		}
-		if (fields & ST_ATIME) {
-			lua_pushstring(L,"atime");
-			lua_pushinteger(L, st->st_atime);
-			lua_settable(L, -3);
-		}
-		if (fields & ST_MTIME) {
-			lua_pushstring(L,"mtime");
-			lua_pushinteger(L, st->st_mtime);
-			lua_settable(L, -3);
-		}
-		if (fields & ST_CTIME) {
-			lua_pushstring(L,"ctime");
-			lua_pushinteger(L, st->st_ctime);
-			lua_settable(L, -3);
-		}
+		stat_pushtable(L, st, fields);
 		lua_pushinteger(L, 0);
 	}
 	return 2;
@@ -823,6 +829,93 @@ static int lfs_utimes(lua_State *L)
 	return 1;
 }
 
+/*
+** rd, err = fs.mmap(path_or_fd, offset=0, length=all, advice=fs.MADV_SEQUENTIAL)
+**
+** map the file into memory as a reader, nothing is read until being accessed.
+** the mapping is private, writing to it(reader:getline does) never reaches the file.
+**
+** the file is unmapped when the reader and its sub readers are all collected,
+** or by fs.munmap(rd). accessing the bytes beyond the end of a file truncated
+** after being mapped raises SIGBUS.
+*/
+static int lfs_mmap(lua_State *L)
+{
+	off_t offset = (off_t)luaL_optinteger(L, 2, 0);
+	int advice = (int)luaL_optinteger(L, 4, MADV_SEQUENTIAL);
+	bool opened = false;
+	size_t length, delta;
+	struct stat st;
+	Reader *rd;
+	uint8 *mem;
+	int fd;
+	int err = 0;
+
+	if (lua_type(L, 1) == LUA_TNUMBER) {
+		fd = (int)lua_tointeger(L, 1);
+	} else {
+		fd = open(luaL_checkstring(L, 1), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			goto error;
+		opened = true;
+	}
+
+	if (fstat(fd, &st) < 0)
+		goto error;
+
+	if (offset < 0 || offset > st.st_size)
+		offset = st.st_size;
+	length = (size_t)(st.st_size - offset);
+	if (!lua_isnoneornil(L, 3) && (size_t)luaL_checkinteger(L, 3) < length)
+		length = (size_t)lua_tointeger(L, 3);
+
+	rd = lua_newuserdata(L, sizeof(Reader));
+	l_setmetatable(L, -1, READER_META);
+	reader_init(rd, NULL, 0);
+
+	if (length > 0) {
+		/* the offset of a mapping must be a multiple of the page size */
+		delta = (size_t)(offset % sysconf(_SC_PAGESIZE));
+		mem = mmap(NULL, length + delta, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset - delta);
+		if (mem == MAP_FAILED) {
+			lua_pop(L, 1);
+			goto error;
+		}
+		madvise(mem, length + delta, advice);
+
+		reader_init(rd, mem + delta, length);
+		rd->seg = bufseg_new(mem);
+		rd->seg->mapsiz = length + delta;
+	}
+
+	if (opened)
+		close(fd);
+	lua_pushinteger(L, 0);
+	return 2;
+
+error:
+	err = errno;
+	if (opened)
+		close(fd);
+	lua_pushnil(L);
+	lua_pushinteger(L, err);
+	return 2;
+}
+
+/*
+** fs.munmap(rd)
+**
+** release the mapping of a reader returned by fs.mmap now rather than when
+** being collected, the reader becomes empty.
+*/
+static int lfs_munmap(lua_State *L)
+{
+	Reader *rd = reader_lcheck(L, 1);
+	reader_unpin(rd);
+	reader_init(rd, NULL, 0);
+	return 0;
+}
+
 static const luaL_Reg dir_methods[] = {
 	{"next", lfs_dir_next},
 	{"close", lfs_dir_close},
@@ -854,6 +947,11 @@ static const EnumReg enums[] = {
 	LENUM(R_OK),
 	LENUM(W_OK),
 	LENUM(X_OK),
+	LENUM(MADV_NORMAL),
+	LENUM(MADV_SEQUENTIAL),
+	LENUM(MADV_RANDOM),
+	LENUM(MADV_WILLNEED),
+	LENUM(MADV_DONTNEED),
 	LENUM_NULL
 };
 
@@ -899,6 +997,9 @@ static const luaL_Reg funcs[] = {
 	{"ftruncate", lfs_ftruncate},
 	{"utimes", lfs_utimes},
 
+	{"mmap", lfs_mmap},
+	{"munmap", lfs_munmap},
+
 	{NULL, NULL}
 };
 
@@ -0,0 +1,952 @@
+/*
+ * Copyright (C) spyder
+ */
+
+/*
+** Streaming hashes and checksums.
+**
+**	h = hash.new('sha256')
+**	h:update(buffer):update(reader):update('string')
+**	hex = h:digest()
+**
+** The data could be a string, a buffer or a reader, nothing is copied. The
+** algorithms are md5, sha1, sha256, crc32c and xxh64.
+**
+** On x86-64 the SSE4.2 crc32 instruction and the SHA extensions(sha1 and sha256)
+** are used if the CPU has them, so is the ARMv8 crc32 instruction if compiled
+** with it, otherwise they fall back to portable C.
+*/
+
+#include "lstdimpl.h"
+#include <unistd.h>
+#include <errno.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HASH_X86 				1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define HASH_ARM_CRC 			1
+#include <arm_acle.h>
+#endif
+
+#define HASH_METATABLE 			"hash"
+
+/* bytes read at a time by hash_fd */
+#define HASH_READSIZ 			(256 * 1024)
+
+enum {
+	ALG_MD5,
+	ALG_SHA1,
+	ALG_SHA256,
+	ALG_CRC32C,
+	ALG_XXH64,
+};
+
+static const char *const alg_names[] = {"md5", "sha1", "sha256", "crc32c", "xxh64", NULL};
+static const int alg_sizes[] = {16, 20, 32, 4, 8};
+
+typedef struct {
+	int alg;
+	uint8 block[64]; 		/* partial block not compressed yet */
+	size_t blocklen;
+	uint64 total; 			/* bytes updated */
+	union {
+		uint32 md5[4];
+		uint32 sha1[5];
+		uint32 sha256[8];
+		uint32 crc;
+		uint64 xxh[4];
+	}st;
+}Hash;
+
+static bool use_accel = true;
+
+/* set by detect_accel */
+static bool has_sse42 = false;
+static bool has_sha = false;
+
+static void detect_accel(void)
+{
+#ifdef HASH_X86
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		has_sse42 = (ecx & bit_SSE4_2) != 0;
+		if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+			has_sha = (ebx & bit_SHA) != 0 && has_sse42;
+	}
+#endif
+}
+
+#define ROL32(x, n) 			(((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR32(x, n) 			(((x) >> (n)) | ((x) << (32 - (n))))
+#define ROL64(x, n) 			(((x) << (n)) | ((x) >> (64 - (n))))
+
+/******************************************************************************
+** md5
+******************************************************************************/
+
+static const uint32 md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint8 md5_r[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static void md5_blocks(uint32 *st, const uint8 *p, size_t nblocks)
+{
+	while (nblocks-- > 0) {
+		uint32 w[16];
+		uint32 a = st[0], b = st[1], c = st[2], d = st[3];
+
+		for (int i = 0; i < 16; i++)
+			w[i] = bytes_to_uint32_le((p + i * 4));
+
+		/* one loop per round function, so the compiler unrolls them without branches */
+#define MD5_STEP(f, g) do { \
+			uint32 t = a + (f) + md5_k[i] + w[g]; \
+			a = d; d = c; c = b; \
+			b += ROL32(t, md5_r[i]); \
+		} while (0)
+		int i;
+		for (i = 0; i < 16; i++)
+			MD5_STEP(d ^ (b & (c ^ d)), i);
+		for (; i < 32; i++)
+			MD5_STEP(c ^ (d & (b ^ c)), (5 * i + 1) & 15);
+		for (; i < 48; i++)
+			MD5_STEP(b ^ c ^ d, (3 * i + 5) & 15);
+		for (; i < 64; i++)
+			MD5_STEP(c ^ (b | ~d), (7 * i) & 15);
+#undef MD5_STEP
+
+		st[0] += a;
+		st[1] += b;
+		st[2] += c;
+		st[3] += d;
+		p += 64;
+	}
+}
+
+/******************************************************************************
+** sha1
+******************************************************************************/
+
+static void sha1_blocks_c(uint32 *st, const uint8 *p, size_t nblocks)
+{
+	while (nblocks-- > 0) {
+		uint32 w[80];
+		uint32 a = st[0], b = st[1], c = st[2], d = st[3], e = st[4];
+
+		for (int i = 0; i < 16; i++)
+			w[i] = bytes_to_uint32_be((p + i * 4));
+		for (int i = 16; i < 80; i++)
+			w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+#define SHA1_STEP(f, k) do { \
+			uint32 t = ROL32(a, 5) + (f) + e + (k) + w[i]; \
+			e = d; d = c; c = ROL32(b, 30); b = a; a = t; \
+		} while (0)
+		int i;
+		for (i = 0; i < 20; i++)
+			SHA1_STEP(d ^ (b & (c ^ d)), 0x5a827999);
+		for (; i < 40; i++)
+			SHA1_STEP(b ^ c ^ d, 0x6ed9eba1);
+		for (; i < 60; i++)
+			SHA1_STEP((b & c) | (d & (b | c)), 0x8f1bbcdc);
+		for (; i < 80; i++)
+			SHA1_STEP(b ^ c ^ d, 0xca62c1d6);
+#undef SHA1_STEP
+
+		st[0] += a;
+		st[1] += b;
+		st[2] += c;
+		st[3] += d;
+		st[4] += e;
+		p += 64;
+	}
+}
+
+#ifdef HASH_X86
+/*
+** 4 rounds per sha1rnds4, 'e' of the next 4 rounds is derived from 'abcd'
+** before them by sha1nexte, message words of the group g are
+**
+**	M[g] = msg2(msg1(M[g-4], M[g-3]) ^ M[g-2], M[g-1])
+*/
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha1_blocks_ni(uint32 *st, const uint8 *p, size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, e0, e, enext, m[4], save_abcd, save_e0;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)st), 0x1b);
+	e0 = _mm_set_epi32((int)st[4], 0, 0, 0);
+
+	while (nblocks-- > 0) {
+		save_abcd = abcd;
+		save_e0 = e0;
+		enext = e0;
+
+		for (int g = 0; g < 20; g++) {
+			if (g < 4) {
+				m[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + g * 16)), mask);
+			} else {
+				e = _mm_xor_si128(_mm_sha1msg1_epu32(m[g & 3], m[(g - 3) & 3]), m[(g - 2) & 3]);
+				m[g & 3] = _mm_sha1msg2_epu32(e, m[(g - 1) & 3]);
+			}
+			e = g == 0 ? _mm_add_epi32(e0, m[0]) : _mm_sha1nexte_epu32(enext, m[g & 3]);
+			enext = abcd;
+
+			/* the function selector must be an immediate */
+			switch (g / 5) {
+			case 0: abcd = _mm_sha1rnds4_epu32(abcd, e, 0); break;
+			case 1: abcd = _mm_sha1rnds4_epu32(abcd, e, 1); break;
+			case 2: abcd = _mm_sha1rnds4_epu32(abcd, e, 2); break;
+			default: abcd = _mm_sha1rnds4_epu32(abcd, e, 3); break;
+			}
+		}
+
+		e0 = _mm_sha1nexte_epu32(enext, save_e0);
+		abcd = _mm_add_epi32(abcd, save_abcd);
+		p += 64;
+	}
+
+	_mm_storeu_si128((__m128i*)st, _mm_shuffle_epi32(abcd, 0x1b));
+	st[4] = (uint32)_mm_extract_epi32(e0, 3);
+}
+#endif
+
+static void sha1_blocks(uint32 *st, const uint8 *p, size_t nblocks)
+{
+#ifdef HASH_X86
+	if (has_sha && use_accel) {
+		sha1_blocks_ni(st, p, nblocks);
+		return;
+	}
+#endif
+	sha1_blocks_c(st, p, nblocks);
+}
+
+/******************************************************************************
+** sha256
+******************************************************************************/
+
+static const uint32 sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256_blocks_c(uint32 *st, const uint8 *p, size_t nblocks)
+{
+	while (nblocks-- > 0) {
+		uint32 w[64];
+		uint32 a = st[0], b = st[1], c = st[2], d = st[3];
+		uint32 e = st[4], f = st[5], g = st[6], h = st[7];
+
+		for (int i = 0; i < 16; i++)
+			w[i] = bytes_to_uint32_be((p + i * 4));
+		for (int i = 16; i < 64; i++) {
+			uint32 s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32 s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		for (int i = 0; i < 64; i++) {
+			uint32 s1 = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
+			uint32 ch = g ^ (e & (f ^ g));
+			uint32 t1 = h + s1 + ch + sha256_k[i] + w[i];
+			uint32 s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
+			uint32 maj = (a & b) | (c & (a | b));
+			uint32 t2 = s0 + maj;
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		st[0] += a;
+		st[1] += b;
+		st[2] += c;
+		st[3] += d;
+		st[4] += e;
+		st[5] += f;
+		st[6] += g;
+		st[7] += h;
+		p += 64;
+	}
+}
+
+#ifdef HASH_X86
+/*
+** 4 rounds per sha256rnds2 pair, the state is kept as ABEF/CDGH as the
+** instructions expect, message words of the group k are
+**
+**	M[k] = msg2(msg1(M[k-4], M[k-3]) + alignr(M[k-1], M[k-2]), M[k-1])
+*/
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_ni(uint32 *st, const uint8 *p, size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, tmp, msg, m[4], save0, save1;
+
+	tmp = _mm_loadu_si128((const __m128i*)&st[0]);
+	state1 = _mm_loadu_si128((const __m128i*)&st[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);				/* CDAB */
+	state1 = _mm_shuffle_epi32(state1, 0x1b);		/* EFGH */
+	state0 = _mm_alignr_epi8(tmp, state1, 8);		/* ABEF */
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);	/* CDGH */
+
+	while (nblocks-- > 0) {
+		save0 = state0;
+		save1 = state1;
+
+		for (int k = 0; k < 16; k++) {
+			if (k < 4) {
+				m[k] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + k * 16)), mask);
+			} else {
+				tmp = _mm_sha256msg1_epu32(m[k & 3], m[(k - 3) & 3]);
+				tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(m[(k - 1) & 3], m[(k - 2) & 3], 4));
+				m[k & 3] = _mm_sha256msg2_epu32(tmp, m[(k - 1) & 3]);
+			}
+			msg = _mm_add_epi32(m[k & 3], _mm_loadu_si128((const __m128i*)&sha256_k[k * 4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+
+		state0 = _mm_add_epi32(state0, save0);
+		state1 = _mm_add_epi32(state1, save1);
+		p += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);			/* FEBA */
+	state1 = _mm_shuffle_epi32(state1, 0xb1);		/* DCHG */
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);	/* DCBA */
+	state1 = _mm_alignr_epi8(state1, tmp, 8);		/* ABEF */
+	_mm_storeu_si128((__m128i*)&st[0], state0);
+	_mm_storeu_si128((__m128i*)&st[4], state1);
+}
+#endif
+
+static void sha256_blocks(uint32 *st, const uint8 *p, size_t nblocks)
+{
+#ifdef HASH_X86
+	if (has_sha && use_accel) {
+		sha256_blocks_ni(st, p, nblocks);
+		return;
+	}
+#endif
+	sha256_blocks_c(st, p, nblocks);
+}
+
+/******************************************************************************
+** crc32c(Castagnoli, reflected polynomial 0x82f63b78)
+******************************************************************************/
+
+static uint32 crc32c_table[8][256];
+static bool crc32c_ready = false;
+
+static void crc32c_init(void)
+{
+	for (uint32 i = 0; i < 256; i++) {
+		uint32 crc = i;
+		for (int j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+		crc32c_table[0][i] = crc;
+	}
+	for (uint32 i = 0; i < 256; i++) {
+		uint32 crc = crc32c_table[0][i];
+		for (int j = 1; j < 8; j++) {
+			crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+			crc32c_table[j][i] = crc;
+		}
+	}
+	crc32c_ready = true;
+}
+
+/* slicing-by-8 */
+static uint32 crc32c_c(uint32 crc, const uint8 *p, size_t len)
+{
+	if (!crc32c_ready)
+		crc32c_init();
+
+	while (len >= 8) {
+		uint32 lo = (bytes_to_uint32_le(p)) ^ crc;
+		uint32 hi = bytes_to_uint32_le((p + 4));
+		crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+			crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+			crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+			crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+	while (len-- > 0)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#ifdef HASH_X86
+__attribute__((target("sse4.2")))
+static uint32 crc32c_sse42(uint32 crc, const uint8 *p, size_t len)
+{
+	uint64 crc64 = crc;
+	while (len >= 8) {
+		uint64 v;
+		memcpy(&v, p, 8);
+		crc64 = _mm_crc32_u64(crc64, v);
+		p += 8;
+		len -= 8;
+	}
+	crc = (uint32)crc64;
+	while (len-- > 0)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+#endif
+
+#ifdef HASH_ARM_CRC
+static uint32 crc32c_arm(uint32 crc, const uint8 *p, size_t len)
+{
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		crc = __crc32cd(crc, v);
+		p += 8;
+		len -= 8;
+	}
+	while (len-- > 0)
+		crc = __crc32cb(crc, *p++);
+	return crc;
+}
+#endif
+
+static uint32 crc32c_update(uint32 crc, const uint8 *p, size_t len)
+{
+#ifdef HASH_X86
+	if (has_sse42 && use_accel)
+		return crc32c_sse42(crc, p, len);
+#endif
+#ifdef HASH_ARM_CRC
+	if (use_accel)
+		return crc32c_arm(crc, p, len);
+#endif
+	return crc32c_c(crc, p, len);
+}
+
+/******************************************************************************
+** xxh64
+******************************************************************************/
+
+#define XXH_P1 					0x9e3779b185ebca87ULL
+#define XXH_P2 					0xc2b2ae3d27d4eb4fULL
+#define XXH_P3 					0x165667b19e3779f9ULL
+#define XXH_P4 					0x85ebca77c2b2ae63ULL
+#define XXH_P5 					0x27d4eb2f165667c5ULL
+
+static inline uint64 read64_le(const uint8 *p)
+{
+	return (uint64)(bytes_to_uint32_le(p)) | ((uint64)(bytes_to_uint32_le((p + 4))) << 32);
+}
+
+static inline uint64 xxh_round(uint64 acc, uint64 input)
+{
+	acc += input * XXH_P2;
+	acc = ROL64(acc, 31);
+	return acc * XXH_P1;
+}
+
+static inline uint64 xxh_merge(uint64 acc, uint64 val)
+{
+	acc ^= xxh_round(0, val);
+	return acc * XXH_P1 + XXH_P4;
+}
+
+/* xxh64 takes 32-byte stripes, two of them a block */
+static void xxh64_blocks(uint64 *v, const uint8 *p, size_t nblocks)
+{
+	size_t nstripes = nblocks * 2;
+	while (nstripes-- > 0) {
+		v[0] = xxh_round(v[0], read64_le(p));
+		v[1] = xxh_round(v[1], read64_le(p + 8));
+		v[2] = xxh_round(v[2], read64_le(p + 16));
+		v[3] = xxh_round(v[3], read64_le(p + 24));
+		p += 32;
+	}
+}
+
+static uint64 xxh64_final(Hash *h)
+{
+	uint64 *v = h->st.xxh;
+	const uint8 *p = h->block;
+	size_t len = h->blocklen;
+	uint64 acc;
+
+	/* the partial block may still hold a full stripe */
+	if (len >= 32) {
+		v[0] = xxh_round(v[0], read64_le(p));
+		v[1] = xxh_round(v[1], read64_le(p + 8));
+		v[2] = xxh_round(v[2], read64_le(p + 16));
+		v[3] = xxh_round(v[3], read64_le(p + 24));
+		p += 32;
+		len -= 32;
+	}
+
+	if (h->total >= 32) {
+		acc = ROL64(v[0], 1) + ROL64(v[1], 7) + ROL64(v[2], 12) + ROL64(v[3], 18);
+		acc = xxh_merge(acc, v[0]);
+		acc = xxh_merge(acc, v[1]);
+		acc = xxh_merge(acc, v[2]);
+		acc = xxh_merge(acc, v[3]);
+	} else {
+		acc = v[2] + XXH_P5;  /* the seed(0) + P5 */
+	}
+	acc += h->total;
+
+	while (len >= 8) {
+		acc ^= xxh_round(0, read64_le(p));
+		acc = ROL64(acc, 27) * XXH_P1 + XXH_P4;
+		p += 8;
+		len -= 8;
+	}
+	if (len >= 4) {
+		acc ^= (uint64)(bytes_to_uint32_le(p)) * XXH_P1;
+		acc = ROL64(acc, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+		len -= 4;
+	}
+	while (len-- > 0) {
+		acc ^= (*p++) * XXH_P5;
+		acc = ROL64(acc, 11) * XXH_P1;
+	}
+
+	acc ^= acc >> 33;
+	acc *= XXH_P2;
+	acc ^= acc >> 29;
+	acc *= XXH_P3;
+	acc ^= acc >> 32;
+	return acc;
+}
+
+/******************************************************************************
+** common
+******************************************************************************/
+
+static void hash_reset(Hash *h)
+{
+	h->blocklen = 0;
+	h->total = 0;
+
+	switch (h->alg) {
+	case ALG_MD5:
+		h->st.md5[0] = 0x67452301;
+		h->st.md5[1] = 0xefcdab89;
+		h->st.md5[2] = 0x98badcfe;
+		h->st.md5[3] = 0x10325476;
+		break;
+	case ALG_SHA1:
+		h->st.sha1[0] = 0x67452301;
+		h->st.sha1[1] = 0xefcdab89;
+		h->st.sha1[2] = 0x98badcfe;
+		h->st.sha1[3] = 0x10325476;
+		h->st.sha1[4] = 0xc3d2e1f0;
+		break;
+	case ALG_SHA256:
+		h->st.sha256[0] = 0x6a09e667;
+		h->st.sha256[1] = 0xbb67ae85;
+		h->st.sha256[2] = 0x3c6ef372;
+		h->st.sha256[3] = 0xa54ff53a;
+		h->st.sha256[4] = 0x510e527f;
+		h->st.sha256[5] = 0x9b05688c;
+		h->st.sha256[6] = 0x1f83d9ab;
+		h->st.sha256[7] = 0x5be0cd19;
+		break;
+	case ALG_CRC32C:
+		h->st.crc = 0xffffffff;
+		break;
+	case ALG_XXH64:
+		h->st.xxh[0] = XXH_P1 + XXH_P2;
+		h->st.xxh[1] = XXH_P2;
+		h->st.xxh[2] = 0;
+		h->st.xxh[3] = 0 - XXH_P1;
+		break;
+	}
+}
+
+static void hash_blocks(Hash *h, const uint8 *p, size_t nblocks)
+{
+	switch (h->alg) {
+	case ALG_MD5:
+		md5_blocks(h->st.md5, p, nblocks);
+		break;
+	case ALG_SHA1:
+		sha1_blocks(h->st.sha1, p, nblocks);
+		break;
+	case ALG_SHA256:
+		sha256_blocks(h->st.sha256, p, nblocks);
+		break;
+	case ALG_XXH64:
+		xxh64_blocks(h->st.xxh, p, nblocks);
+		break;
+	}
+}
+
+static void hash_update(Hash *h, const uint8 *p, size_t len)
+{
+	h->total += len;
+
+	/* crc32c has no blocks */
+	if (h->alg == ALG_CRC32C) {
+		h->st.crc = crc32c_update(h->st.crc, p, len);
+		return;
+	}
+
+	if (h->blocklen > 0) {
+		size_t n = MIN(len, 64 - h->blocklen);
+		memcpy(h->block + h->blocklen, p, n);
+		h->blocklen += n;
+		p += n;
+		len -= n;
+		if (h->blocklen < 64)
+			return;
+		hash_blocks(h, h->block, 1);
+		h->blocklen = 0;
+	}
+
+	if (len >= 64) {
+		hash_blocks(h, p, len / 64);
+		p += len & ~(size_t)63;
+		len &= 63;
+	}
+
+	if (len > 0) {
+		memcpy(h->block, p, len);
+		h->blocklen = len;
+	}
+}
+
+/* md5/sha1/sha256 padding: 0x80, zeros, then the bit length */
+static void hash_pad(Hash *h, bool be)
+{
+	uint64 bits = h->total * 8;
+	uint8 tail[8];
+
+	h->block[h->blocklen++] = 0x80;
+	if (h->blocklen > 56) {
+		memset(h->block + h->blocklen, 0, 64 - h->blocklen);
+		hash_blocks(h, h->block, 1);
+		h->blocklen = 0;
+	}
+	memset(h->block + h->blocklen, 0, 56 - h->blocklen);
+
+	for (int i = 0; i < 8; i++)
+		tail[be ? 7 - i : i] = (uint8)(bits >> (i * 8));
+	memcpy(h->block + 56, tail, 8);
+	hash_blocks(h, h->block, 1);
+	h->blocklen = 0;
+}
+
+/* the digest of the data updated so far, 'h' is left unusable until reset */
+static size_t hash_final(Hash *h, uint8 *out)
+{
+	switch (h->alg) {
+	case ALG_MD5:
+		hash_pad(h, false);
+		for (int i = 0; i < 4; i++)
+			uint32_to_bytes_le(h->st.md5[i], out + i * 4);
+		break;
+	case ALG_SHA1:
+		hash_pad(h, true);
+		for (int i = 0; i < 5; i++)
+			uint32_to_bytes_be(h->st.sha1[i], out + i * 4);
+		break;
+	case ALG_SHA256:
+		hash_pad(h, true);
+		for (int i = 0; i < 8; i++)
+			uint32_to_bytes_be(h->st.sha256[i], out + i * 4);
+		break;
+	case ALG_CRC32C:
+		uint32_to_bytes_be(h->st.crc ^ 0xffffffff, out);
+		break;
+	case ALG_XXH64: {
+			uint64 val = xxh64_final(h);
+			uint32_to_bytes_be((uint32)(val >> 32), out);
+			uint32_to_bytes_be((uint32)val, out + 4);
+			break;
+		}
+	}
+	return (size_t)alg_sizes[h->alg];
+}
+
+/* string/buffer/reader at 'idx' */
+static const uint8* check_data(lua_State *L, int idx, size_t *len)
+{
+	union {
+		const Buffer *buffer;
+		const Reader *reader;
+	}ptr;
+
+	if (lua_type(L, idx) == LUA_TSTRING)
+		return (const uint8*)lua_tolstring(L, idx, len);
+
+	if ((ptr.buffer = (const Buffer*)lua_touserdata(L, idx)) != NULL) {
+		if (ptr.buffer->magic == BUFFER_MAGIC) {
+			*len = ptr.buffer->datasiz;
+			return ptr.buffer->data;
+		} else if (ptr.reader->magic == READER_MAGIC) {
+			*len = ptr.reader->datasiz;
+			return ptr.reader->data;
+		}
+	}
+	luaL_argerror(L, idx, "string/buffer/reader expected");
+	return NULL;
+}
+
+static void push_digest(lua_State *L, const uint8 *out, size_t len, bool raw)
+{
+	static const char digits[] = "0123456789abcdef";
+	char hex[64];
+
+	if (raw) {
+		lua_pushlstring(L, (const char*)out, len);
+		return;
+	}
+	for (size_t i = 0; i < len; i++) {
+		hex[i * 2] = digits[out[i] >> 4];
+		hex[i * 2 + 1] = digits[out[i] & 15];
+	}
+	lua_pushlstring(L, hex, len * 2);
+}
+
+/* the index of the algorithm named at 'idx', for the other modules */
+int hash_lcheckalg(lua_State *L, int idx, const char *def)
+{
+	return luaL_checkoption(L, idx, def, alg_names);
+}
+
+/*
+** Hash what is left to read from 'fd' into 'out'(32 bytes at most) and set
+** '*outsiz', return 0 or errno.
+**
+** It reads instead of mapping the file, a file truncated meanwhile is only
+** shorter(not SIGBUS). It's thread-safe, the offload workers call it.
+*/
+int hash_fd(int alg, int fd, uint8 *out, size_t *outsiz)
+{
+	Hash h;
+	uint8 *mem = (uint8*)MALLOC(HASH_READSIZ);
+	ssize_t n;
+
+	if (mem == NULL)
+		return ENOMEM;
+
+	h.alg = alg;
+	hash_reset(&h);
+	while ((n = read(fd, mem, HASH_READSIZ)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			n = errno;
+			FREE(mem);
+			return (int)n;
+		}
+		hash_update(&h, mem, (size_t)n);
+	}
+	FREE(mem);
+	*outsiz = hash_final(&h, out);
+	return 0;
+}
+
+/*
+** h = hash.new(alg)
+**
+** 'alg' is one of 'md5', 'sha1', 'sha256', 'crc32c' and 'xxh64'(seed 0).
+*/
+static int lhash_new(lua_State *L)
+{
+	int alg = luaL_checkoption(L, 1, NULL, alg_names);
+	Hash *h = (Hash*)lua_newuserdata(L, sizeof(Hash));
+	h->alg = alg;
+	hash_reset(h);
+	l_setmetatable(L, -1, HASH_METATABLE);
+	return 1;
+}
+
+/*
+** digest = hash.sum(alg, data, raw=false)
+**
+** Hash 'data'(string/buffer/reader) in one go, see h:digest for 'raw'.
+*/
+static int lhash_sum(lua_State *L)
+{
+	Hash h;
+	uint8 out[32];
+	size_t len;
+	const uint8 *data;
+
+	h.alg = luaL_checkoption(L, 1, NULL, alg_names);
+	data = check_data(L, 2, &len);
+	hash_reset(&h);
+	hash_update(&h, data, len);
+	push_digest(L, out, hash_final(&h, out), lua_toboolean(L, 3));
+	return 1;
+}
+
+/*
+** enabled = hash.accel(enable=nil)
+**
+** Whether the CPU instructions are used if the CPU has them, turning them off
+** is only meant for testing and benchmarking the fallback.
+*/
+static int lhash_accel(lua_State *L)
+{
+	if (!lua_isnoneornil(L, 1))
+		use_accel = lua_toboolean(L, 1);
+	lua_pushboolean(L, use_accel);
+	return 1;
+}
+
+/*
+** name1, name2, ... = hash.accelerated()
+**
+** Return the algorithms accelerated by the CPU instructions.
+*/
+static int lhash_accelerated(lua_State *L)
+{
+	int n = 0;
+	if (!use_accel)
+		return 0;
+#ifdef HASH_X86
+	if (has_sse42) {
+		lua_pushstring(L, "crc32c");
+		n++;
+	}
+	if (has_sha) {
+		lua_pushstring(L, "sha1");
+		lua_pushstring(L, "sha256");
+		n += 2;
+	}
+#endif
+#ifdef HASH_ARM_CRC
+	lua_pushstring(L, "crc32c");
+	n++;
+#endif
+	return n;
+}
+
+static Hash* hash_lcheck(lua_State *L, int idx)
+{
+	return (Hash*)luaL_checkudata(L, idx, HASH_METATABLE);
+}
+
+/*
+** self = h:update(data1, data2, ...)
+**
+** Each data could be a string, a buffer or a reader.
+*/
+static int lhash_update(lua_State *L)
+{
+	Hash *h = hash_lcheck(L, 1);
+	int top = lua_gettop(L);
+
+	for (int i = 2; i <= top; i++) {
+		size_t len;
+		const uint8 *data = check_data(L, i, &len);
+		hash_update(h, data, len);
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+
+/*
+** digest = h:digest(raw=false)
+**
+** Return the digest in hex, or the raw bytes if 'raw' is true. The crc32c and
+** xxh64 values are big-endian, the same as their usual hex form.
+**
+** The hash object is reset afterwards.
+*/
+static int lhash_digest(lua_State *L)
+{
+	Hash *h = hash_lcheck(L, 1);
+	uint8 out[32];
+
+	push_digest(L, out, hash_final(h, out), lua_toboolean(L, 2));
+	hash_reset(h);
+	return 1;
+}
+
+/*
+** self = h:reset()
+*/
+static int lhash_reset(lua_State *L)
+{
+	hash_reset(hash_lcheck(L, 1));
+	lua_settop(L, 1);
+	return 1;
+}
+
+/*
+** n = h:size()
+**
+** Return the number of bytes updated since the last reset.
+*/
+static int lhash_size(lua_State *L)
+{
+	lua_pushinteger(L, (lua_Integer)hash_lcheck(L, 1)->total);
+	return 1;
+}
+
+static int lhash_tostring(lua_State *L)
+{
+	Hash *h = hash_lcheck(L, 1);
+	lua_pushfstring(L, "hash{alg=%s}", alg_names[h->alg]);
+	return 1;
+}
+
+static const luaL_Reg hash_methods[] = {
+	{"__tostring", lhash_tostring},
+	{"update", lhash_update},
+	{"digest", lhash_digest},
+	{"reset", lhash_reset},
+	{"size", lhash_size},
+	{NULL, NULL}
+};
+
+static const luaL_Reg funcs[] = {
+	{"new", lhash_new},
+	{"sum", lhash_sum},
+	{"accel", lhash_accel},
+	{"accelerated", lhash_accelerated},
+	{NULL, NULL}
+};
+
+int l_openhash(lua_State *L)
+{
+	detect_accel();
+	l_register_metatable2(L, HASH_METATABLE, hash_methods);
+	l_register_lib(L, "hash", funcs, NULL);
+	return 0;
+}
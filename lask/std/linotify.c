@@ -6,14 +6,27 @@
 
 #include "lstdimpl.h"
 #include <errno.h>
+#include <unistd.h>
 #include <sys/inotify.h>
 
+/* bytes asked by one read(2), and the maximum number of reads by inotify.read */
+#define INOTIFY_RBUFSIZ			65536
+#define INOTIFY_MAXREADS		16
+
+/* an event decoded from the buffer, events with the same wd and name are coalesced */
+typedef struct _InotifyEvent {
+	int wd;
+	uint32 mask;
+	const char *name;
+	size_t namelen;
+}InotifyEvent;
+
 /*
 ** fd, err = inotify.init(flags=nil)
 */
 static int linotify_init(lua_State *L)
 {
-	int flags = luaL_optint(L, 1, 0);
+	int flags = (int)luaL_optinteger(L, 1, 0);
 	int fd;
 	int err = 0;
 	
@@ -60,10 +73,113 @@ static int linotify_rm_watch(lua_State *L)
 	return 0;
 }
 
+static uint32 inotify_hash(int wd, const char *name, size_t namelen)
+{
+	uint32 h = 2166136261u ^ (uint32)wd;
+	size_t i;
+
+	for (i = 0; i < namelen; i++)
+		h = (h ^ (uint8)name[i]) * 16777619u;
+	return h;
+}
+
+/*
+** n, err = inotify.read(fd, buffer, events)
+** read the pending events of a non-blocking inotify fd into buffer, then decode them
+** into 'events' as n triples {wd1, mask1, name1, wd2, mask2, name2, ...}, followed by nil.
+**
+** Events with the same wd and name are coalesced into one, in the order they first
+** occurred, and with their masks OR-ed. name is '' for events on the watched object
+** itself(and for IN_Q_OVERFLOW whose wd is -1).
+**
+** The decoded bytes are shifted from buffer. EAGAIN/EINTR are filtered.
+*/
+static int linotify_read(lua_State *L)
+{
+	int fd = (int)luaL_checkinteger(L, 1);
+	Buffer *buffer = buffer_lcheck(L, 2);
+	InotifyEvent *evs;
+	uint32 *slots;
+	uint32 nslots = 16, mask;
+	size_t maxevs, nevs = 0, off = 0, i;
+	int nreads, err = 0;
+
+	luaL_checktype(L, 3, LUA_TTABLE);
+
+	for (nreads = 0; nreads < INOTIFY_MAXREADS; nreads++) {
+		uint8 *p = buffer_safegrow(buffer, INOTIFY_RBUFSIZ, L);
+		ssize_t ret = read(fd, p, INOTIFY_RBUFSIZ);
+
+		buffer_pop(buffer, ret > 0 ? INOTIFY_RBUFSIZ - (size_t)ret : INOTIFY_RBUFSIZ);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+				err = errno;
+			break;
+		}
+	}
+
+	/* the scratch memory of the hash is collected by gc, even if lua_rawseti() throws */
+	maxevs = buffer->datasiz / sizeof(struct inotify_event);
+	while (nslots < maxevs * 2)
+		nslots *= 2;
+	mask = nslots - 1;
+	evs = (InotifyEvent*)lua_newuserdata(L, maxevs * sizeof(InotifyEvent) + nslots * sizeof(uint32));
+	slots = (uint32*)(evs + maxevs);
+	memset(slots, 0xff, nslots * sizeof(uint32));
+
+	while (off + sizeof(struct inotify_event) <= buffer->datasiz) {
+		struct inotify_event *ev = (struct inotify_event*)(buffer->data + off);
+		size_t evsiz = sizeof(struct inotify_event) + ev->len;
+		size_t namelen;
+		uint32 h;
+
+		if (off + evsiz > buffer->datasiz)
+			break;
+		off += evsiz;
+
+		namelen = ev->len > 0 ? strnlen(ev->name, ev->len) : 0;
+		for (h = inotify_hash(ev->wd, ev->name, namelen) & mask; slots[h] != 0xffffffffu; h = (h + 1) & mask) {
+			InotifyEvent *e = evs + slots[h];
+			if (e->wd == ev->wd && e->namelen == namelen && memcmp(e->name, ev->name, namelen) == 0)
+				break;
+		}
+
+		if (slots[h] == 0xffffffffu) {
+			InotifyEvent *e = evs + nevs;
+			e->wd = ev->wd;
+			e->mask = ev->mask;
+			e->name = ev->name;
+			e->namelen = namelen;
+			slots[h] = (uint32)nevs++;
+		} else {
+			evs[slots[h]].mask |= ev->mask;
+		}
+	}
+
+	for (i = 0; i < nevs; i++) {
+		lua_pushinteger(L, evs[i].wd);
+		lua_rawseti(L, 3, (int)(i * 3 + 1));
+		lua_pushinteger(L, evs[i].mask);
+		lua_rawseti(L, 3, (int)(i * 3 + 2));
+		lua_pushlstring(L, evs[i].name, evs[i].namelen);
+		lua_rawseti(L, 3, (int)(i * 3 + 3));
+	}
+	lua_pushnil(L);
+	lua_rawseti(L, 3, (int)(nevs * 3 + 1));
+
+	buffer_shift(buffer, off);
+	lua_pushinteger(L, (lua_Integer)nevs);
+	lua_pushinteger(L, err);
+	return 2;
+}
+
 static const luaL_Reg funcs[] = {
 	{"init", linotify_init},
 	{"add_watch", linotify_add_watch},
 	{"rm_watch", linotify_rm_watch},
+	{"read", linotify_read},
 	{NULL, NULL}
 };
 
@@ -76,6 +192,7 @@ static const EnumReg enums[] = {
 	LENUM(IN_MASK_ADD),
 	LENUM(IN_ISDIR),
 	LENUM(IN_ONESHOT),
+	LENUM(IN_EXCL_UNLINK),
 	
 	/* mask*/
 	LENUM(IN_ACCESS),
@@ -26,6 +26,11 @@ static int lmd5(lua_State *L)
 	return 1;
 }
 
+void md5_digest(const void *message, size_t len, uint8 *output)
+{
+	md5((const char*)message, (long)len, (char*)output);
+}
+
 int l_openmd5(lua_State *L)
 {
 	lua_pushcfunction(L, lmd5);
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) spyder
+ */
+
+/*
+** Process-wide counters, gauges and histograms.
+**
+** Metrics are registered by name once(normally when a module is loaded) and
+** updated afterwards by the returned integer id, so an update is a C call
+** doing an array access plus an addition.
+**
+** Histograms use fixed power-of-two buckets: the upper bound of bucket i is
+** 'unit * 2^i', the last one is +Inf. With unit=1e-6 the buckets span from 1us
+** to about 33 seconds, with unit=1 from 1 to 32M(bytes, counts ...).
+*/
+
+#include "lstdimpl.h"
+#include <math.h>
+
+#define METRICS_MAX 		128
+#define NBUCKETS 			27
+
+enum {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM,
+};
+
+static const char *type_names[] = {"counter", "gauge", "histogram"};
+
+typedef struct _Metric {
+	char *name;
+	char *help;
+	int type;
+	double unit;
+	double value; 		/* counter/gauge value, or histogram sum */
+	uint64_t count;
+	uint64_t buckets[NBUCKETS];
+}Metric;
+
+static Metric metrics[METRICS_MAX];
+static int nmetrics = 0;
+
+static int metric_register(lua_State *L, int type)
+{
+	size_t namelen;
+	const char *name = luaL_checklstring(L, 1, &namelen);
+	const char *help = luaL_optstring(L, 2, "");
+	double unit = (double)luaL_optnumber(L, 3, 1);
+	Metric *m;
+	int i;
+
+	for (i = 0; i < nmetrics; i++) {
+		m = &metrics[i];
+		if (strcmp(m->name, name) == 0) {
+			if (m->type != type)
+				luaL_error(L, "metric '%s' is already registered as a %s", name, type_names[m->type]);
+			lua_pushinteger(L, i + 1);
+			return 1;
+		}
+	}
+
+	if (nmetrics >= METRICS_MAX)
+		luaL_error(L, "too many metrics");
+	if (unit <= 0)
+		luaL_error(L, "invalid histogram unit");
+
+	m = &metrics[nmetrics];
+	memset(m, 0, sizeof(Metric));
+	m->name = strdup(name);
+	m->help = strdup(help);
+	m->type = type;
+	m->unit = unit;
+	lua_pushinteger(L, ++nmetrics);
+	return 1;
+}
+
+static Metric* metric_lcheck(lua_State *L, int idx, int type)
+{
+	lua_Integer id = luaL_checkinteger(L, idx);
+	Metric *m;
+
+	if (id < 1 || id > nmetrics)
+		luaL_error(L, "invalid metric id %d", (int)id);
+	m = &metrics[id - 1];
+	if (m->type != type)
+		luaL_error(L, "metric '%s' is not a %s", m->name, type_names[type]);
+	return m;
+}
+
+static void histogram_observe(Metric *m, double v)
+{
+	double x = v / m->unit;
+	int i = 0;
+
+	if (x > 1) {
+		int e;
+		double frac = frexp(x, &e);
+		i = frac == 0.5 ? e - 1 : e;
+		if (i >= NBUCKETS)
+			i = NBUCKETS - 1;
+	}
+	m->buckets[i]++;
+	m->count++;
+	m->value += v;
+}
+
+static double histogram_quantile(const Metric *m, double q)
+{
+	uint64_t rank, acc = 0;
+	int i;
+
+	if (m->count == 0)
+		return 0;
+
+	rank = (uint64_t)ceil(q * (double)m->count);
+	if (rank == 0)
+		rank = 1;
+	for (i = 0; i < NBUCKETS - 1; i++) {
+		acc += m->buckets[i];
+		if (acc >= rank)
+			break;
+	}
+	return ldexp(m->unit, i);
+}
+
+/*
+** id = metrics.counter(name, help)
+*/
+static int lmetrics_counter(lua_State *L)
+{
+	return metric_register(L, METRIC_COUNTER);
+}
+
+/*
+** id = metrics.gauge(name, help)
+*/
+static int lmetrics_gauge(lua_State *L)
+{
+	return metric_register(L, METRIC_GAUGE);
+}
+
+/*
+** id = metrics.histogram(name, help, unit=1)
+**
+** Registering an existing name returns the same id.
+*/
+static int lmetrics_histogram(lua_State *L)
+{
+	return metric_register(L, METRIC_HISTOGRAM);
+}
+
+/*
+** metrics.add(id, n=1)
+*/
+static int lmetrics_add(lua_State *L)
+{
+	Metric *m = metric_lcheck(L, 1, METRIC_COUNTER);
+	m->value += (double)luaL_optnumber(L, 2, 1);
+	return 0;
+}
+
+/*
+** metrics.set(id, value)
+*/
+static int lmetrics_set(lua_State *L)
+{
+	Metric *m = metric_lcheck(L, 1, METRIC_GAUGE);
+	m->value = (double)luaL_checknumber(L, 2);
+	return 0;
+}
+
+/*
+** metrics.observe(id1, value1, id2, value2, ...)
+**
+** Several histograms can be updated by one call.
+*/
+static int lmetrics_observe(lua_State *L)
+{
+	int top = lua_gettop(L);
+	int i;
+
+	for (i = 1; i < top; i += 2)
+		histogram_observe(metric_lcheck(L, i, METRIC_HISTOGRAM), (double)luaL_checknumber(L, i + 1));
+	return 0;
+}
+
+/*
+** v = metrics.quantile(id, q)
+**
+** Estimated by the upper bound of the bucket the q-th observation falls into.
+*/
+static int lmetrics_quantile(lua_State *L)
+{
+	Metric *m = metric_lcheck(L, 1, METRIC_HISTOGRAM);
+	lua_pushnumber(L, histogram_quantile(m, (double)luaL_checknumber(L, 2)));
+	return 1;
+}
+
+/*
+** tbl = metrics.snapshot()
+**
+** {[name] = {type=, help=, value=}} for counters and gauges,
+** {[name] = {type=, help=, unit=, count=, sum=, p50=, p99=, buckets={n1, n2 ...}}} for histograms,
+** where buckets[i] counts the observations in (unit*2^(i-2), unit*2^(i-1)].
+*/
+static int lmetrics_snapshot(lua_State *L)
+{
+	int i, j;
+
+	lua_createtable(L, 0, nmetrics);
+	for (i = 0; i < nmetrics; i++) {
+		const Metric *m = &metrics[i];
+
+		lua_createtable(L, 0, 6);
+		lua_pushstring(L, type_names[m->type]);
+		lua_setfield(L, -2, "type");
+		lua_pushstring(L, m->help);
+		lua_setfield(L, -2, "help");
+
+		if (m->type == METRIC_HISTOGRAM) {
+			lua_pushnumber(L, m->unit);
+			lua_setfield(L, -2, "unit");
+			lua_pushinteger(L, (lua_Integer)m->count);
+			lua_setfield(L, -2, "count");
+			lua_pushnumber(L, m->value);
+			lua_setfield(L, -2, "sum");
+			lua_pushnumber(L, histogram_quantile(m, 0.5));
+			lua_setfield(L, -2, "p50");
+			lua_pushnumber(L, histogram_quantile(m, 0.99));
+			lua_setfield(L, -2, "p99");
+
+			lua_createtable(L, NBUCKETS, 0);
+			for (j = 0; j < NBUCKETS; j++) {
+				lua_pushinteger(L, (lua_Integer)m->buckets[j]);
+				lua_rawseti(L, -2, j + 1);
+			}
+			lua_setfield(L, -2, "buckets");
+		} else {
+			lua_pushnumber(L, m->value);
+			lua_setfield(L, -2, "value");
+		}
+		lua_setfield(L, -2, m->name);
+	}
+	return 1;
+}
+
+/*
+** buffer = metrics.prometheus(buffer)
+**
+** Append all the metrics in the Prometheus text exposition format.
+*/
+static int lmetrics_prometheus(lua_State *L)
+{
+	Buffer *buffer = buffer_lcheck(L, 1);
+	char line[256];
+	int i, j, n;
+
+	for (i = 0; i < nmetrics; i++) {
+		const Metric *m = &metrics[i];
+
+		if (m->help[0] != 0) {
+			n = snprintf(line, sizeof(line), "# HELP %s %s\n", m->name, m->help);
+			buffer_push(buffer, line, (size_t)MIN(n, (int)sizeof(line) - 1));
+		}
+		n = snprintf(line, sizeof(line), "# TYPE %s %s\n", m->name, type_names[m->type]);
+		buffer_push(buffer, line, (size_t)MIN(n, (int)sizeof(line) - 1));
+
+		if (m->type == METRIC_HISTOGRAM) {
+			uint64_t acc = 0;
+			for (j = 0; j < NBUCKETS - 1; j++) {
+				acc += m->buckets[j];
+				n = snprintf(line, sizeof(line), "%s_bucket{le=\"%.9g\"} %llu\n",
+						m->name, ldexp(m->unit, j), (unsigned long long)acc);
+				buffer_push(buffer, line, (size_t)MIN(n, (int)sizeof(line) - 1));
+			}
+			n = snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9g\n%s_count %llu\n",
+					m->name, (unsigned long long)m->count,
+					m->name, m->value,
+					m->name, (unsigned long long)m->count);
+		} else {
+			n = snprintf(line, sizeof(line), "%s %.17g\n", m->name, m->value);
+		}
+		buffer_push(buffer, line, (size_t)MIN(n, (int)sizeof(line) - 1));
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+/*
+** metrics.reset()
+**
+** Zero all the values, the registered metrics are kept.
+*/
+static int lmetrics_reset(lua_State *L)
+{
+	int i;
+
+	unused(L);
+	for (i = 0; i < nmetrics; i++) {
+		Metric *m = &metrics[i];
+		m->value = 0;
+		m->count = 0;
+		memset(m->buckets, 0, sizeof(m->buckets));
+	}
+	return 0;
+}
+
+static const luaL_Reg funcs[] = {
+	{"counter", lmetrics_counter},
+	{"gauge", lmetrics_gauge},
+	{"histogram", lmetrics_histogram},
+	{"add", lmetrics_add},
+	{"set", lmetrics_set},
+	{"observe", lmetrics_observe},
+	{"quantile", lmetrics_quantile},
+	{"snapshot", lmetrics_snapshot},
+	{"prometheus", lmetrics_prometheus},
+	{"reset", lmetrics_reset},
+	{NULL, NULL}
+};
+
+int l_openmetrics(lua_State *L)
+{
+	l_register_lib(L, "metrics", funcs, NULL);
+	return 0;
+}
@@ -0,0 +1,599 @@
+/*
+ * Copyright (C) spyder
+ */
+
+/*
+** A small thread pool running a whitelist of blocking calls natively, so the
+** tasklet loop is never blocked by a slow disk or DNS server.
+**
+** Jobs are submitted with offload.submit, done jobs are put into a completion
+** list and an eventfd is signaled, then offload.reap collects the results in
+** the main thread(see tasklet/offload.lua).
+**
+** Workers never touch the lua_State, the results are converted to lua values
+** by offload.reap.
+*/
+
+#include "lstdimpl.h"
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#define MAX_THREADS 		16
+#define JOB_META			"meta(offload.job)"
+
+enum {
+	OP_STAT,
+	OP_LSTAT,
+	OP_OPEN,
+	OP_FSYNC,
+	OP_LISTDIR,
+	OP_GETADDRBYNAME,
+	OP_MD5,
+	OP_WALK,
+	OP_HASHFILE,
+};
+
+static const char *const op_names[] = {
+	"stat",
+	"lstat",
+	"open",
+	"fsync",
+	"listdir",
+	"getaddrbyname",
+	"md5",
+	"walk",
+	"hashfile",
+	NULL,
+};
+
+typedef struct _Job {
+	struct _Job *next;
+	lua_Integer id;
+	int op;
+
+	/* arguments */
+	char *str;
+	size_t len;
+	int iarg1;
+	int iarg2;
+	Walker *walker;
+
+	/* results */
+	int err;
+	int ires;
+	struct stat st;
+	char **strs;
+	size_t nstrs;
+	uint8 digest[32];
+	size_t digestsiz;
+}Job;
+
+typedef struct _JobList {
+	Job *head;
+	Job *tail;
+}JobList;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static JobList pending;
+static JobList done;
+static int pool_efd = -1;
+static int pool_nthreads = 0;
+static int pool_maxthreads = 2;
+static int pool_nidle = 0;
+static lua_Integer pool_lastid = 0;
+
+static void joblist_push(JobList *list, Job *job)
+{
+	job->next = NULL;
+	if (list->tail != NULL)
+		list->tail->next = job;
+	else
+		list->head = job;
+	list->tail = job;
+}
+
+static Job* joblist_pop(JobList *list)
+{
+	Job *job = list->head;
+	if (job != NULL) {
+		list->head = job->next;
+		if (list->head == NULL)
+			list->tail = NULL;
+	}
+	return job;
+}
+
+static char* dupstr(const char *str)
+{
+	size_t len = strlen(str);
+	char *p = (char*)malloc(len + 1);
+	if (p != NULL)
+		memcpy(p, str, len + 1);
+	return p;
+}
+
+static void job_free(Job *job)
+{
+	if (job->strs != NULL) {
+		for (size_t i = 0; i < job->nstrs; i++)
+			free(job->strs[i]);
+		free(job->strs);
+	}
+	if (job->walker != NULL)
+		walker_release(job->walker);
+	free(job->str);
+	free(job);
+}
+
+static int job_addstr(Job *job, const char *str, size_t *cap)
+{
+	if (job->nstrs == *cap) {
+		size_t ncap = *cap > 0 ? *cap * 2 : 16;
+		char **strs = (char**)realloc(job->strs, ncap * sizeof(char*));
+		if (strs == NULL)
+			return ENOMEM;
+		job->strs = strs;
+		*cap = ncap;
+	}
+	job->strs[job->nstrs] = dupstr(str);
+	if (job->strs[job->nstrs] == NULL)
+		return ENOMEM;
+	job->nstrs++;
+	return 0;
+}
+
+static void job_listdir(Job *job)
+{
+	DIR *dir = opendir(job->str);
+	struct dirent *dp;
+	size_t cap = 0;
+
+	if (dir == NULL) {
+		job->err = errno;
+		return;
+	}
+	while ((dp = readdir(dir)) != NULL) {
+		const char *name = dp->d_name;
+		if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+			continue;
+		if ((job->err = job_addstr(job, name, &cap)) != 0)
+			break;
+	}
+	closedir(dir);
+}
+
+static void job_getaddrbyname(Job *job)
+{
+	struct addrinfo hints, *res, *ai;
+	size_t cap = 0;
+	int err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	err = getaddrinfo(job->str, NULL, &hints, &res);
+	if (err != 0) {
+		job->err = err;
+		return;
+	}
+
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		char addr_str[60];
+		const void *addr;
+		if (ai->ai_family == AF_INET)
+			addr = &((struct sockaddr_in*)ai->ai_addr)->sin_addr;
+		else if (ai->ai_family == AF_INET6)
+			addr = &((struct sockaddr_in6*)ai->ai_addr)->sin6_addr;
+		else
+			continue;
+		if (inet_ntop(ai->ai_family, addr, addr_str, sizeof(addr_str)) != NULL) {
+			if (job_addstr(job, addr_str, &cap) != 0)
+				break;
+		}
+	}
+	freeaddrinfo(res);
+}
+
+static void job_hashfile(Job *job)
+{
+	int fd = open(job->str, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		job->err = errno;
+		return;
+	}
+	job->err = hash_fd(job->iarg1, fd, job->digest, &job->digestsiz);
+	close(fd);
+}
+
+static void job_run(Job *job)
+{
+	switch (job->op) {
+	case OP_STAT:
+		if (stat(job->str, &job->st) != 0)
+			job->err = errno;
+		break;
+	case OP_LSTAT:
+		if (lstat(job->str, &job->st) != 0)
+			job->err = errno;
+		break;
+	case OP_OPEN:
+		job->ires = open(job->str, job->iarg1, job->iarg2);
+		if (job->ires < 0)
+			job->err = errno;
+		break;
+	case OP_FSYNC:
+		if (fsync(job->iarg1) != 0)
+			job->err = errno;
+		break;
+	case OP_LISTDIR:
+		job_listdir(job);
+		break;
+	case OP_GETADDRBYNAME:
+		job_getaddrbyname(job);
+		break;
+	case OP_MD5:
+		md5_digest(job->str, job->len, job->digest);
+		break;
+	case OP_WALK:
+		job->ires = (int)walker_fill(job->walker);
+		break;
+	case OP_HASHFILE:
+		job_hashfile(job);
+		break;
+	default:
+		job->err = ENOSYS;
+		break;
+	}
+}
+
+static void* pool_main(void *ud)
+{
+	uint64_t one = 1;
+	unused(ud);
+
+	pthread_mutex_lock(&pool_mutex);
+	while (true) {
+		Job *job = joblist_pop(&pending);
+		if (job == NULL) {
+			pool_nidle++;
+			pthread_cond_wait(&pool_cond, &pool_mutex);
+			pool_nidle--;
+			continue;
+		}
+		pthread_mutex_unlock(&pool_mutex);
+
+		job_run(job);
+
+		pthread_mutex_lock(&pool_mutex);
+		joblist_push(&done, job);
+		if (write(pool_efd, &one, sizeof(one)) < 0) {
+			/* never overflows in practice */
+		}
+	}
+	return NULL;
+}
+
+/* called with pool_mutex locked */
+static int pool_spawn(void)
+{
+	pthread_t tid;
+	pthread_attr_t attr;
+	sigset_t set, oldset;
+	int err;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	err = pthread_create(&tid, &attr, pool_main, NULL);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (err == 0)
+		pool_nthreads++;
+	return err;
+}
+
+static int pool_init(void)
+{
+	if (pool_efd < 0) {
+		pool_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (pool_efd < 0)
+			return errno;
+	}
+	return 0;
+}
+
+/*
+** err = offload.setup(nthreads=2)
+**
+** set the maximum number of worker threads, threads are spawned on demand.
+*/
+static int loffload_setup(lua_State *L)
+{
+	int nthreads = (int)luaL_optinteger(L, 1, 2);
+	pool_maxthreads = MAX(1, MIN(nthreads, MAX_THREADS));
+	lua_pushinteger(L, pool_init());
+	return 1;
+}
+
+/*
+** fd = offload.fd()
+**
+** the eventfd readable when there are jobs done.
+*/
+static int loffload_fd(lua_State *L)
+{
+	pool_init();
+	lua_pushinteger(L, pool_efd);
+	return 1;
+}
+
+/*
+** id, err = offload.submit(op, ...)
+**
+** offload.submit('stat', path)
+** offload.submit('lstat', path)
+** offload.submit('open', path, flags=O_RDONLY, mode=0644)
+** offload.submit('fsync', fd)
+** offload.submit('listdir', path)
+** offload.submit('getaddrbyname', name)
+** offload.submit('md5', str_or_buffer_or_reader)
+** offload.submit('walk', walker)		-- walker:fill() of fs.walk
+** offload.submit('hashfile', path, alg='xxh64')	-- see hash.new for 'alg'
+*/
+static int loffload_submit(lua_State *L)
+{
+	union {
+		const Buffer *buffer;
+		const Reader *reader;
+	}ptr;
+	int op = luaL_checkoption(L, 1, NULL, op_names);
+	const char *data = NULL;
+	size_t datasiz = 0;
+	int iarg1 = 0, iarg2 = 0;
+	Walker *walker = NULL;
+	lua_Integer id;
+	Job *job;
+	int err;
+
+	/* check all the arguments before anything allocated */
+	switch (op) {
+	case OP_FSYNC:
+		iarg1 = (int)luaL_checkinteger(L, 2);
+		break;
+	case OP_MD5:
+		if (lua_type(L, 2) == LUA_TSTRING) {
+			data = lua_tolstring(L, 2, &datasiz);
+		} else if ((ptr.buffer = (const Buffer*)lua_touserdata(L, 2)) != NULL) {
+			if (ptr.buffer->magic == BUFFER_MAGIC) {
+				data = (const char*)ptr.buffer->data;
+				datasiz = ptr.buffer->datasiz;
+			} else if (ptr.reader->magic == READER_MAGIC) {
+				data = (const char*)ptr.reader->data;
+				datasiz = ptr.reader->datasiz;
+			}
+		}
+		if (data == NULL)
+			return luaL_error(L, "expecting string/buffer/reader for argument 2");
+		break;
+	case OP_WALK:
+		walker = walker_acquire(L, 2);
+		break;
+	case OP_HASHFILE:
+		iarg1 = hash_lcheckalg(L, 3, "xxh64");
+		data = luaL_checklstring(L, 2, &datasiz);
+		break;
+	case OP_OPEN:
+		iarg1 = (int)luaL_optinteger(L, 3, O_RDONLY);
+		iarg2 = (int)luaL_optinteger(L, 4, 0644);
+		/* fall through */
+	default:
+		data = luaL_checklstring(L, 2, &datasiz);
+		break;
+	}
+
+	if ((err = pool_init()) != 0) {
+		if (walker != NULL)
+			walker_release(walker);
+		lua_pushnil(L);
+		lua_pushinteger(L, err);
+		return 2;
+	}
+
+	job = (Job*)calloc(1, sizeof(Job));
+	if (job == NULL) {
+		if (walker != NULL)
+			walker_release(walker);
+		return luaL_error(L, "out of memory");
+	}
+
+	job->op = op;
+	job->iarg1 = iarg1;
+	job->iarg2 = iarg2;
+	job->walker = walker;
+	if (data != NULL) {
+		job->str = (char*)malloc(datasiz + 1);
+		if (job->str == NULL) {
+			job_free(job);
+			return luaL_error(L, "out of memory");
+		}
+		memcpy(job->str, data, datasiz);
+		job->str[datasiz] = 0;
+		job->len = datasiz;
+	}
+
+	pthread_mutex_lock(&pool_mutex);
+	if (pool_nidle == 0 && pool_nthreads < pool_maxthreads)
+		err = pool_spawn();
+	if (pool_nthreads == 0) {
+		pthread_mutex_unlock(&pool_mutex);
+		job_free(job);
+		lua_pushnil(L);
+		lua_pushinteger(L, err);
+		return 2;
+	}
+	id = job->id = ++pool_lastid;
+	joblist_push(&pending, job);
+	pthread_cond_signal(&pool_cond);
+	pthread_mutex_unlock(&pool_mutex);
+
+	lua_pushinteger(L, id);
+	lua_pushinteger(L, 0);
+	return 2;
+}
+
+static int push_strs(lua_State *L, Job *job)
+{
+	lua_createtable(L, (int)job->nstrs, 0);
+	for (size_t i = 0; i < job->nstrs; i++) {
+		lua_pushstring(L, job->strs[i]);
+		lua_rawseti(L, -2, (int)i + 1);
+	}
+	return 1;
+}
+
+/* a reaped job is anchored in a userdata until its results pushed */
+static int job_gc(lua_State *L)
+{
+	Job **pjob = (Job**)luaL_checkudata(L, 1, JOB_META);
+	if (*pjob != NULL) {
+		job_free(*pjob);
+		*pjob = NULL;
+	}
+	return 0;
+}
+
+static void push_hex(lua_State *L, const uint8 *digest, size_t len)
+{
+	const char *digits = "0123456789abcdef";
+	char text[64];
+	for (size_t i = 0; i < len; i++) {
+		text[i * 2] = digits[digest[i] >> 4];
+		text[i * 2 + 1] = digits[digest[i] & 0xf];
+	}
+	lua_pushlstring(L, text, len * 2);
+}
+
+/*
+** id, ... = offload.reap()
+**
+** return the id of a done job followed by its results, or nil if none.
+**
+** 'stat'/'lstat'			-> id, stat_table/nil, err
+** 'open'					-> id, fd, err
+** 'fsync'					-> id, err
+** 'listdir'				-> id, {name1, ...}/nil, err
+** 'getaddrbyname'			-> id, {addr1, ...}/nil, err(EAI_XXX)
+** 'md5'					-> id, hex_digest
+** 'walk'					-> id, n(the number of entries to be picked by walker:next())
+** 'hashfile'				-> id, hex_digest/nil, err
+*/
+static int loffload_reap(lua_State *L)
+{
+	Job *job;
+	Job **pjob;
+	int nret = 1;
+
+	/* created before the job popped, an error raised while pushing the
+	results never leaks it */
+	pjob = (Job**)lua_newuserdata(L, sizeof(Job*));
+	*pjob = NULL;
+	l_setmetatable(L, -1, JOB_META);
+
+	pthread_mutex_lock(&pool_mutex);
+	job = joblist_pop(&done);
+	if (job == NULL) {
+		uint64_t count;
+		if (read(pool_efd, &count, sizeof(count)) < 0) {
+			/* EAGAIN */
+		}
+	}
+	pthread_mutex_unlock(&pool_mutex);
+
+	if (job == NULL)
+		return 0;
+
+	*pjob = job;
+	lua_pushinteger(L, job->id);
+	switch (job->op) {
+	case OP_STAT:
+	case OP_LSTAT:
+		if (job->err == 0)
+			stat_pushtable(L, &job->st, ST_ALL);
+		else
+			lua_pushnil(L);
+		lua_pushinteger(L, job->err);
+		nret += 2;
+		break;
+	case OP_OPEN:
+		lua_pushinteger(L, job->ires);
+		lua_pushinteger(L, job->err);
+		nret += 2;
+		break;
+	case OP_FSYNC:
+		lua_pushinteger(L, job->err);
+		nret += 1;
+		break;
+	case OP_LISTDIR:
+	case OP_GETADDRBYNAME:
+		if (job->err == 0)
+			push_strs(L, job);
+		else
+			lua_pushnil(L);
+		lua_pushinteger(L, job->err);
+		nret += 2;
+		break;
+	case OP_WALK:
+		lua_pushinteger(L, job->ires);
+		nret += 1;
+		break;
+	case OP_MD5:
+		push_hex(L, job->digest, 16);
+		nret += 1;
+		break;
+	case OP_HASHFILE:
+		if (job->err == 0)
+			push_hex(L, job->digest, job->digestsiz);
+		else
+			lua_pushnil(L);
+		lua_pushinteger(L, job->err);
+		nret += 2;
+		break;
+	}
+
+	job_free(job);
+	*pjob = NULL;
+	return nret;
+}
+
+static const luaL_Reg job_methods[] = {
+	{"__gc", job_gc},
+	{NULL, NULL},
+};
+
+static const luaL_Reg funcs[] = {
+	{"setup", loffload_setup},
+	{"fd", loffload_fd},
+	{"submit", loffload_submit},
+	{"reap", loffload_reap},
+	{NULL, NULL},
+};
+
+int l_openoffload(lua_State *L)
+{
+	l_register_metatable2(L, JOB_META, job_methods);
+	l_register_lib(L, "offload", funcs, NULL);
+	return 0;
+}
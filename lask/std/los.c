@@ -301,8 +301,9 @@ static int los_write(lua_State *L)
 }
 
 /*
-** nwrite, err = os.writeb(fd, buffer/reader, offset=0, length=all)
+** nwrite, err = os.writeb(fd, buffer/reader/chain, offset=0, length=all)
 **
+** the pages of a chain are written by writev().
 **
 ** return number of bytes written, plus the error code
 **
@@ -321,6 +322,7 @@ static int los_writeb(lua_State *L)
 	size_t length = 0;
 	size_t ndone = 0;
 	int err = 0;
+	Chain *chain = NULL;
 
 	ptr.buffer = (const Buffer*)lua_touserdata(L, 2);
 	if (ptr.buffer != NULL) {
@@ -330,12 +332,14 @@ static int los_writeb(lua_State *L)
 		} else if (ptr.reader->magic == READER_MAGIC) {
 			data = ptr.reader->data;
 			datasiz = ptr.reader->datasiz;
+		} else if ((chain = chain_test(L, 2)) != NULL) {
+			datasiz = chain->datasiz;
 		} else {
 			ptr.buffer = NULL;
 		}
 	}
 	if (ptr.buffer == NULL) {
-		luaL_error(L, "expecting userdata buffer/reader for argument 2");
+		luaL_error(L, "expecting userdata buffer/reader/chain for argument 2");
 	}
 
 	length = datasiz;
@@ -347,8 +351,12 @@ static int los_writeb(lua_State *L)
 	else if ((offset + length) > datasiz)
 		length = (datasiz - offset);
 
-	if (length > 0)
-		err = os_write(fd, data + offset, length, &ndone);
+	if (length > 0) {
+		if (chain != NULL)
+			err = chain_write(fd, chain, offset, length, &ndone);
+		else
+			err = os_write(fd, data + offset, length, &ndone);
+	}
 
 	lua_pushinteger(L, ndone);
 	lua_pushinteger(L, err);
@@ -538,6 +546,17 @@ static int los_fork(lua_State *L)
 	return 2;
 }
 
+/*
+** os._exit(status=0)
+** terminate without flushing the stdio buffers or running atexit handlers,
+** for a forked child whose buffers are copies of the parent's
+*/
+static int los__exit(lua_State *L)
+{
+	_exit((int)luaL_optinteger(L, 1, 0));
+	return 0;
+}
+
 /*
 ** pid, err = os.vfork()
 */
@@ -883,6 +902,7 @@ static const luaL_Reg funcs[] = {
 	{"execl", los_execl},
 	{"system", los_system},
 	{"fork", los_fork},
+	{"_exit", los__exit},
 	{"vfork", los_vfork},
 	{"wait", los_wait},
 	{"waitpid", los_waitpid},
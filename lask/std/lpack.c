@@ -0,0 +1,823 @@
+/*
+ * Copyright (C) spyder
+ */
+
+/*
+** Binary serialization of Lua values.
+**
+**	buf:pack({cmd = 'stat', argv = {'a', 'b'}, n = 1})
+**	value, err = rd:unpack()
+**
+** Without a format every value is tagged with its type, tables are written
+** as their array part followed by the other key/value pairs:
+**
+**	0x00                nil(also ends the key/value pairs of a table)
+**	0x01/0x02           false/true
+**	0x03 varint         integer, zigzag encoded
+**	0x04 8 bytes        double, little-endian
+**	0x05 varint bytes   string
+**	0x06 varint ...     table: the length of the array part, the array items,
+**	                    then key/value pairs up to a 0x00
+**	0x40 - 0x7f         string shorter than 64 bytes, followed by its bytes
+**	0x80 - 0xff         integer 0 - 127
+**
+** With a format(a spec string, or compiled once by buffer.packformat) only
+** the values are written, in the order of the format:
+**
+**	i                   integer, zigzag varint
+**	u                   unsigned integer, varint
+**	d                   double, 8 bytes little-endian
+**	s                   string, varint length + bytes
+**	b                   boolean, 1 byte
+**	*                   any value, tagged as above
+**	[T]                 array of T, varint length + items
+**	{k1:T1, k2:T2?}     record, fields in order, '?' marks an optional field
+**	                    which is prefixed with a byte of 0/1(absent/present)
+**
+**	fmt = buffer.packformat('{id:u, name:s, tags:[s], pos:{x:d, y:d}?}')
+**	buf:pack(msg, fmt)
+**	msg, err = rd:unpack(fmt)
+*/
+
+#include "lstdimpl.h"
+#include <errno.h>
+
+#define PACKFORMAT_META 		"meta(packformat)"
+#define PACK_FORMATS 			"pack_formats"
+#define PACK_MAXDEPTH 			100
+
+enum {
+	TAG_NIL = 0,
+	TAG_FALSE,
+	TAG_TRUE,
+	TAG_INT,
+	TAG_DOUBLE,
+	TAG_STR,
+	TAG_TABLE,
+	TAG_SHORTSTR = 0x40,
+	TAG_FIXINT = 0x80,
+};
+
+typedef struct _PackNode {
+	char type; 				/* one of "iudsb*[{" */
+	bool optional;
+	uint16 nfields; 		/* of '{' */
+	uint32 size; 			/* number of nodes of this subtree */
+	const char *name; 		/* field name of a record, or NULL */
+}PackNode;
+
+typedef struct _PackFormat {
+	uint32 nnodes;
+	PackNode nodes[1];
+	/* names of the fields follow the nodes */
+}PackFormat;
+
+/******************************************************************************
+	format
+******************************************************************************/
+
+typedef struct _Parser {
+	lua_State *L;
+	const char *spec;
+	const char *p;
+	PackNode *nodes;
+	uint32 n;
+	char *names;
+	int depth;
+}Parser;
+
+static void parse_error(Parser *ps, const char *what)
+{
+	luaL_error(ps->L, "bad pack format '%s' at %d: %s", ps->spec, (int)(ps->p - ps->spec) + 1, what);
+}
+
+static void skip_space(Parser *ps)
+{
+	while (isspace((uint8)*ps->p))
+		ps->p++;
+}
+
+static uint32 parse_type(Parser *ps)
+{
+	uint32 idx = ps->n++;
+	PackNode *node = ps->nodes + idx;
+	char ch;
+
+	if (++ps->depth > PACK_MAXDEPTH)
+		parse_error(ps, "nested too deep");
+
+	skip_space(ps);
+	ch = *ps->p;
+	node->type = ch;
+	node->optional = false;
+	node->nfields = 0;
+	node->name = NULL;
+
+	switch (ch) {
+	case 'i': case 'u': case 'd': case 's': case 'b': case '*':
+		ps->p++;
+		break;
+	case '[': {
+		ps->p++;
+		uint32 elem = parse_type(ps);
+		/* its elements would take no byte, a count alone could make any number of them */
+		if (ps->nodes[elem].type == '{' && ps->nodes[elem].nfields == 0)
+			parse_error(ps, "array of empty records");
+		skip_space(ps);
+		if (*ps->p != ']')
+			parse_error(ps, "']' expected");
+		ps->p++;
+		break;
+	}
+	case '{':
+		ps->p++;
+		skip_space(ps);
+		if (*ps->p == '}') {
+			ps->p++;
+			break;
+		}
+		while (true) {
+			const char *name;
+			size_t namelen;
+			uint32 child;
+
+			skip_space(ps);
+			name = ps->p;
+			while (isalnum((uint8)*ps->p) || *ps->p == '_')
+				ps->p++;
+			namelen = ps->p - name;
+			if (namelen == 0)
+				parse_error(ps, "field name expected");
+			skip_space(ps);
+			if (*ps->p != ':')
+				parse_error(ps, "':' expected");
+			ps->p++;
+
+			child = parse_type(ps);
+			memcpy(ps->names, name, namelen);
+			ps->names[namelen] = 0;
+			ps->nodes[child].name = ps->names;
+			ps->names += namelen + 1;
+
+			skip_space(ps);
+			if (*ps->p == '?') {
+				ps->nodes[child].optional = true;
+				ps->p++;
+				skip_space(ps);
+			}
+			node->nfields++;
+
+			if (*ps->p == ',') {
+				ps->p++;
+			} else if (*ps->p == '}') {
+				ps->p++;
+				break;
+			} else {
+				parse_error(ps, "',' or '}' expected");
+			}
+		}
+		break;
+	default:
+		parse_error(ps, "type expected");
+		break;
+	}
+
+	node->size = ps->n - idx;
+	ps->depth--;
+	return idx;
+}
+
+/* compile 'spec' and push the format */
+static PackFormat* compile_format(lua_State *L, const char *spec)
+{
+	size_t len = strlen(spec);
+	PackFormat *fmt;
+	Parser ps;
+
+	/* at most one node and one name per character */
+	fmt = (PackFormat*)lua_newuserdata(L, sizeof(PackFormat) + len * sizeof(PackNode) + len + 1);
+	ps.L = L;
+	ps.spec = ps.p = spec;
+	ps.nodes = fmt->nodes;
+	ps.n = 0;
+	ps.names = (char*)(fmt->nodes + len + 1);
+	ps.depth = 0;
+
+	parse_type(&ps);
+	skip_space(&ps);
+	if (*ps.p != 0)
+		parse_error(&ps, "end of format expected");
+	fmt->nnodes = ps.n;
+
+	luaL_getmetatable(L, PACKFORMAT_META);
+	lua_setmetatable(L, -2);
+	return fmt;
+}
+
+/* format at 'idx': nil, a compiled format or a spec(compiled and cached) */
+static const PackFormat* check_format(lua_State *L, int idx)
+{
+	PackFormat *fmt;
+	const char *spec;
+
+	if (lua_isnoneornil(L, idx))
+		return NULL;
+
+	if (lua_type(L, idx) != LUA_TSTRING)
+		return (const PackFormat*)luaL_checkudata(L, idx, PACKFORMAT_META);
+
+	spec = lua_tostring(L, idx);
+	lua_getfield(L, LUA_REGISTRYINDEX, PACK_FORMATS);
+	lua_pushvalue(L, idx);
+	lua_rawget(L, -2);
+	fmt = (PackFormat*)lua_touserdata(L, -1);
+	if (fmt == NULL) {
+		lua_pop(L, 1);
+		lua_pushvalue(L, idx);
+		fmt = compile_format(L, spec);
+		lua_rawset(L, -3);
+	} else {
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	return fmt;
+}
+
+/*
+** fmt = buffer.packformat(spec)
+*/
+static int lbuffer_packformat(lua_State *L)
+{
+	compile_format(L, luaL_checkstring(L, 1));
+	return 1;
+}
+
+/******************************************************************************
+	pack
+******************************************************************************/
+
+typedef struct _Packer {
+	lua_State *L;
+	Buffer *buf;
+	size_t oldsiz;
+}Packer;
+
+static void pack_error(Packer *pk, const char *fmt, const char *arg)
+{
+	/* nothing is left of a failed pack */
+	pk->buf->datasiz = pk->oldsiz;
+	luaL_error(pk->L, fmt, arg);
+}
+
+/* room for 'siz' bytes at the end, pack_commit() the bytes written */
+static inline uint8* pack_reserve(Packer *pk, size_t siz)
+{
+	uint8 *p = buffer_grow(pk->buf, siz);
+	pk->buf->datasiz -= siz;
+	return p;
+}
+
+static inline void pack_commit(Packer *pk, size_t siz)
+{
+	pk->buf->datasiz += siz;
+}
+
+static inline void put_byte(Packer *pk, uint8 b)
+{
+	*buffer_grow(pk->buf, 1) = b;
+}
+
+static inline void put_varint(Packer *pk, uint64 v)
+{
+	uint8 *p = pack_reserve(pk, 10);
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (uint8)v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = (uint8)v;
+	pack_commit(pk, n);
+}
+
+static inline void put_int(Packer *pk, lua_Integer i)
+{
+	put_varint(pk, ((uint64)i << 1) ^ (uint64)(i >> 63));
+}
+
+static inline void put_double(Packer *pk, double d)
+{
+	uint8 *p = buffer_grow(pk->buf, 8);
+	uint64 v;
+
+	memcpy(&v, &d, 8);
+	for (int i = 0; i < 8; i++) {
+		p[i] = (uint8)v;
+		v >>= 8;
+	}
+}
+
+static inline void put_lstr(Packer *pk, const char *str, size_t len)
+{
+	put_varint(pk, len);
+	buffer_push(pk->buf, str, len);
+}
+
+static void pack_value(Packer *pk, int idx, int depth);
+
+static void pack_table(Packer *pk, int idx, int depth)
+{
+	lua_State *L = pk->L;
+	size_t narr = lua_rawlen(L, idx);
+
+	if (depth > PACK_MAXDEPTH)
+		pack_error(pk, "%s", "can't pack a table nested too deep(circular reference?)");
+	luaL_checkstack(L, 3, NULL);
+
+	put_byte(pk, TAG_TABLE);
+	put_varint(pk, narr);
+	for (size_t i = 1; i <= narr; i++) {
+		lua_rawgeti(L, idx, i);
+		pack_value(pk, -1, depth + 1);
+		lua_pop(L, 1);
+	}
+
+	lua_pushnil(L);
+	while (lua_next(L, idx) != 0) {
+		if (lua_isinteger(L, -2)) {
+			lua_Integer k = lua_tointeger(L, -2);
+			if (k >= 1 && (size_t)k <= narr) {
+				lua_pop(L, 1);
+				continue;
+			}
+		}
+		pack_value(pk, -2, depth + 1);
+		pack_value(pk, -1, depth + 1);
+		lua_pop(L, 1);
+	}
+	put_byte(pk, TAG_NIL);
+}
+
+static void pack_value(Packer *pk, int idx, int depth)
+{
+	lua_State *L = pk->L;
+
+	idx = lua_absindex(L, idx);
+	switch (lua_type(L, idx)) {
+	case LUA_TNIL:
+		put_byte(pk, TAG_NIL);
+		break;
+	case LUA_TBOOLEAN:
+		put_byte(pk, lua_toboolean(L, idx) ? TAG_TRUE : TAG_FALSE);
+		break;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, idx)) {
+			lua_Integer i = lua_tointeger(L, idx);
+			if (i >= 0 && i < 128) {
+				put_byte(pk, TAG_FIXINT | (uint8)i);
+			} else {
+				put_byte(pk, TAG_INT);
+				put_int(pk, i);
+			}
+		} else {
+			put_byte(pk, TAG_DOUBLE);
+			put_double(pk, lua_tonumber(L, idx));
+		}
+		break;
+	case LUA_TSTRING: {
+			size_t len;
+			const char *str = lua_tolstring(L, idx, &len);
+			if (len < 64) {
+				uint8 *p = buffer_grow(pk->buf, len + 1);
+				p[0] = TAG_SHORTSTR | (uint8)len;
+				memcpy(p + 1, str, len);
+			} else {
+				put_byte(pk, TAG_STR);
+				put_lstr(pk, str, len);
+			}
+			break;
+		}
+	case LUA_TTABLE:
+		pack_table(pk, idx, depth);
+		break;
+	default:
+		pack_error(pk, "can't pack a %s value", luaL_typename(L, idx));
+		break;
+	}
+}
+
+static void pack_node(Packer *pk, const PackNode *node, int idx, int depth)
+{
+	lua_State *L = pk->L;
+	const char *name = node->name ? node->name : "value";
+	int isnum;
+
+	idx = lua_absindex(L, idx);
+	switch (node->type) {
+	case 'i': case 'u': {
+			lua_Integer i = lua_tointegerx(L, idx, &isnum);
+			if (!isnum)
+				pack_error(pk, "integer expected for '%s'", name);
+			if (node->type == 'i') {
+				put_int(pk, i);
+			} else {
+				if (i < 0)
+					pack_error(pk, "unsigned integer expected for '%s'", name);
+				put_varint(pk, (uint64)i);
+			}
+			break;
+		}
+	case 'd': {
+			lua_Number d = lua_tonumberx(L, idx, &isnum);
+			if (!isnum)
+				pack_error(pk, "number expected for '%s'", name);
+			put_double(pk, d);
+			break;
+		}
+	case 's': {
+			size_t len;
+			const char *str;
+			if (!lua_isstring(L, idx))
+				pack_error(pk, "string expected for '%s'", name);
+			str = lua_tolstring(L, idx, &len);
+			put_lstr(pk, str, len);
+			break;
+		}
+	case 'b':
+		put_byte(pk, lua_toboolean(L, idx) ? 1 : 0);
+		break;
+	case '*':
+		pack_value(pk, idx, depth);
+		break;
+	case '[': {
+			size_t n;
+			if (!lua_istable(L, idx))
+				pack_error(pk, "table expected for '%s'", name);
+			if (depth > PACK_MAXDEPTH)
+				pack_error(pk, "%s", "can't pack a table nested too deep");
+			luaL_checkstack(L, 2, NULL);
+			n = lua_rawlen(L, idx);
+			put_varint(pk, n);
+			for (size_t i = 1; i <= n; i++) {
+				lua_rawgeti(L, idx, i);
+				pack_node(pk, node + 1, -1, depth + 1);
+				lua_pop(L, 1);
+			}
+			break;
+		}
+	case '{': {
+			const PackNode *field = node + 1;
+			if (!lua_istable(L, idx))
+				pack_error(pk, "table expected for '%s'", name);
+			if (depth > PACK_MAXDEPTH)
+				pack_error(pk, "%s", "can't pack a table nested too deep");
+			luaL_checkstack(L, 2, NULL);
+			for (uint16 i = 0; i < node->nfields; i++) {
+				lua_getfield(L, idx, field->name);
+				if (field->optional) {
+					bool present = !lua_isnil(L, -1);
+					put_byte(pk, present ? 1 : 0);
+					if (present)
+						pack_node(pk, field, -1, depth + 1);
+				} else if (lua_isnil(L, -1) && field->type != '*' && field->type != 'b') {
+					pack_error(pk, "field '%s' missing", field->name);
+				} else {
+					pack_node(pk, field, -1, depth + 1);
+				}
+				lua_pop(L, 1);
+				field += field->size;
+			}
+			break;
+		}
+	}
+}
+
+/*
+** self = buffer:pack(value, fmt=nil)
+**
+** The buffer is left as it was if the value can't be packed.
+*/
+static int lbuffer_pack(lua_State *L)
+{
+	Packer pk;
+	const PackFormat *fmt;
+
+	pk.L = L;
+	pk.buf = buffer_lcheck(L, 1);
+	pk.oldsiz = pk.buf->datasiz;
+	luaL_checkany(L, 2);
+	fmt = check_format(L, 3);
+
+	if (fmt != NULL)
+		pack_node(&pk, fmt->nodes, 2, 0);
+	else
+		pack_value(&pk, 2, 0);
+
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/******************************************************************************
+	unpack
+******************************************************************************/
+
+typedef struct _Unpacker {
+	lua_State *L;
+	const uint8 *p;
+	const uint8 *end;
+	int err;
+}Unpacker;
+
+/* ENODATA for the truncated data, EINVAL for the malformed */
+#define UNPACK_FAIL(up, e) 		do { (up)->err = (e); return false; } while (0)
+#define UNPACK_NEED(up, n) 		do { if ((size_t)((up)->end - (up)->p) < (size_t)(n)) UNPACK_FAIL(up, ENODATA); } while (0)
+
+static inline bool get_varint(Unpacker *up, uint64 *v)
+{
+	uint64 x = 0;
+	int shift = 0;
+
+	while (up->p < up->end) {
+		uint8 b = *up->p++;
+		x |= (uint64)(b & 0x7f) << shift;
+		if (b < 0x80) {
+			*v = x;
+			return true;
+		}
+		shift += 7;
+		if (shift > 63)
+			UNPACK_FAIL(up, EINVAL);
+	}
+	UNPACK_FAIL(up, ENODATA);
+}
+
+static inline bool get_int(Unpacker *up, lua_Integer *i)
+{
+	uint64 v;
+	if (!get_varint(up, &v))
+		return false;
+	*i = (lua_Integer)((v >> 1) ^ (~(v & 1) + 1));
+	return true;
+}
+
+static inline bool get_double(Unpacker *up, double *d)
+{
+	uint64 v = 0;
+
+	UNPACK_NEED(up, 8);
+	for (int i = 7; i >= 0; i--)
+		v = (v << 8) | up->p[i];
+	up->p += 8;
+	memcpy(d, &v, 8);
+	return true;
+}
+
+static inline bool push_lstr(Unpacker *up, uint64 len)
+{
+	UNPACK_NEED(up, len);
+	lua_pushlstring(up->L, (const char*)up->p, (size_t)len);
+	up->p += len;
+	return true;
+}
+
+static bool unpack_value(Unpacker *up, int depth);
+
+static bool unpack_table(Unpacker *up, int depth)
+{
+	lua_State *L = up->L;
+	uint64 narr;
+
+	if (depth > PACK_MAXDEPTH)
+		UNPACK_FAIL(up, EINVAL);
+	luaL_checkstack(L, 3, NULL);
+
+	if (!get_varint(up, &narr))
+		return false;
+	/* every item takes one byte at least */
+	UNPACK_NEED(up, narr);
+
+	lua_createtable(L, (int)narr, 0);
+	for (uint64 i = 1; i <= narr; i++) {
+		if (!unpack_value(up, depth + 1))
+			return false;
+		lua_rawseti(L, -2, (lua_Integer)i);
+	}
+
+	while (true) {
+		UNPACK_NEED(up, 1);
+		if (*up->p == TAG_NIL) {
+			up->p++;
+			break;
+		}
+		if (!unpack_value(up, depth + 1))
+			return false;
+		if (lua_type(L, -1) == LUA_TNUMBER && lua_tonumber(L, -1) != lua_tonumber(L, -1))
+			UNPACK_FAIL(up, EINVAL);  /* NaN */
+		if (!unpack_value(up, depth + 1))
+			return false;
+		lua_rawset(L, -3);
+	}
+	return true;
+}
+
+static bool unpack_value(Unpacker *up, int depth)
+{
+	lua_State *L = up->L;
+	uint8 tag;
+
+	UNPACK_NEED(up, 1);
+	tag = *up->p++;
+	if (tag >= TAG_FIXINT) {
+		lua_pushinteger(L, tag & 0x7f);
+		return true;
+	} else if (tag >= TAG_SHORTSTR) {
+		return push_lstr(up, tag - TAG_SHORTSTR);
+	}
+
+	switch (tag) {
+	case TAG_NIL:
+		lua_pushnil(L);
+		break;
+	case TAG_FALSE: case TAG_TRUE:
+		lua_pushboolean(L, tag == TAG_TRUE);
+		break;
+	case TAG_INT: {
+			lua_Integer i;
+			if (!get_int(up, &i))
+				return false;
+			lua_pushinteger(L, i);
+			break;
+		}
+	case TAG_DOUBLE: {
+			double d;
+			if (!get_double(up, &d))
+				return false;
+			lua_pushnumber(L, d);
+			break;
+		}
+	case TAG_STR: {
+			uint64 len;
+			if (!get_varint(up, &len))
+				return false;
+			return push_lstr(up, len);
+		}
+	case TAG_TABLE:
+		return unpack_table(up, depth);
+	default:
+		UNPACK_FAIL(up, EINVAL);
+	}
+	return true;
+}
+
+static bool unpack_node(Unpacker *up, const PackNode *node, int depth)
+{
+	lua_State *L = up->L;
+
+	switch (node->type) {
+	case 'i': {
+			lua_Integer i;
+			if (!get_int(up, &i))
+				return false;
+			lua_pushinteger(L, i);
+			break;
+		}
+	case 'u': {
+			uint64 v;
+			if (!get_varint(up, &v))
+				return false;
+			lua_pushinteger(L, (lua_Integer)v);
+			break;
+		}
+	case 'd': {
+			double d;
+			if (!get_double(up, &d))
+				return false;
+			lua_pushnumber(L, d);
+			break;
+		}
+	case 's': {
+			uint64 len;
+			if (!get_varint(up, &len))
+				return false;
+			return push_lstr(up, len);
+		}
+	case 'b':
+		UNPACK_NEED(up, 1);
+		lua_pushboolean(L, *up->p++ != 0);
+		break;
+	case '*':
+		return unpack_value(up, depth);
+	case '[': {
+			uint64 n;
+			if (depth > PACK_MAXDEPTH)
+				UNPACK_FAIL(up, EINVAL);
+			luaL_checkstack(L, 2, NULL);
+			if (!get_varint(up, &n))
+				return false;
+			/* each element takes one byte at least(no array of empty records) */
+			UNPACK_NEED(up, n);
+			lua_createtable(L, (int)n, 0);
+			for (uint64 i = 1; i <= n; i++) {
+				if (!unpack_node(up, node + 1, depth + 1))
+					return false;
+				lua_rawseti(L, -2, (lua_Integer)i);
+			}
+			break;
+		}
+	case '{': {
+			const PackNode *field = node + 1;
+			if (depth > PACK_MAXDEPTH)
+				UNPACK_FAIL(up, EINVAL);
+			luaL_checkstack(L, 2, NULL);
+			lua_createtable(L, 0, node->nfields);
+			for (uint16 i = 0; i < node->nfields; i++) {
+				bool present = true;
+				if (field->optional) {
+					UNPACK_NEED(up, 1);
+					present = *up->p++ != 0;
+				}
+				if (present) {
+					if (!unpack_node(up, field, depth + 1))
+						return false;
+					lua_setfield(L, -2, field->name);
+				}
+				field += field->size;
+			}
+			break;
+		}
+	}
+	return true;
+}
+
+/* unpack from 'len' bytes at 'data', push value, err and return the bytes consumed */
+static size_t unpack(lua_State *L, const uint8 *data, size_t len, const PackFormat *fmt)
+{
+	int top = lua_gettop(L);
+	Unpacker up;
+	bool ok;
+
+	up.L = L;
+	up.p = data;
+	up.end = data + len;
+	up.err = 0;
+
+	ok = fmt != NULL ? unpack_node(&up, fmt->nodes, 0) : unpack_value(&up, 0);
+	if (!ok) {
+		lua_settop(L, top);
+		lua_pushnil(L);
+		lua_pushinteger(L, up.err);
+		return 0;
+	}
+	lua_pushinteger(L, 0);
+	return up.p - data;
+}
+
+/*
+** value, err = buffer:unpack(fmt=nil)
+**
+** err is ENODATA if the data is incomplete, EINVAL if it's malformed, nothing
+** is consumed from the buffer in both cases.
+*/
+static int lbuffer_unpack(lua_State *L)
+{
+	Buffer *buf = buffer_lcheck(L, 1);
+	const PackFormat *fmt = check_format(L, 2);
+	buffer_shift(buf, unpack(L, buf->data, buf->datasiz, fmt));
+	return 2;
+}
+
+/*
+** value, err = reader:unpack(fmt=nil)
+*/
+static int lreader_unpack(lua_State *L)
+{
+	Reader *rd = reader_lcheck(L, 1);
+	const PackFormat *fmt = check_format(L, 2);
+	reader_shift(rd, unpack(L, rd->data, rd->datasiz, fmt));
+	return 2;
+}
+
+static const luaL_Reg buffer_funcs[] = {
+	{"packformat", lbuffer_packformat},
+	{"pack", lbuffer_pack},
+	{"unpack", lbuffer_unpack},
+	{NULL, NULL}
+};
+
+static const luaL_Reg reader_funcs[] = {
+	{"unpack", lreader_unpack},
+	{NULL, NULL}
+};
+
+int l_openpack(lua_State *L)
+{
+	l_register_lib(L, "buffer", buffer_funcs, NULL);
+	l_register_lib(L, "reader", reader_funcs, NULL);
+
+	luaL_newmetatable(L, PACKFORMAT_META);
+	lua_pop(L, 1);
+
+	lua_newtable(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, PACK_FORMATS);
+	return 0;
+}
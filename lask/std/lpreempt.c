@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) spyder
+ */
+
+/*
+** Cooperative preemption of tasks.
+**
+** tasklet arms a count hook on the coroutine before each resume, the hook
+** yields the coroutine(lua_yield from a count hook is allowed since 5.2) once
+** it has run out of its budget:
+**
+**	- instruction budget: the hook is called once after 'count' instructions
+**	- time budget: the hook is called every 'count' instructions and checks
+**	  CLOCK_MONOTONIC against the time the coroutine was resumed
+**
+** The hook yields only at a safe point, otherwise it waits for the next call:
+**
+**	- the coroutine is the one armed, a coroutine created by a task inherits
+**	  its hook(lua_newthread copies it) and must run as usual, so the hook is
+**	  removed from any other coroutine it's called on
+**	- the coroutine is yieldable, it's not called back from C(table.sort, a
+**	  metamethod called by C, ...)
+**	- the running function is not from a protected source(see preempt.protect),
+**	  tasklet protects itself(tasklet.lua, tasklet/ and rbtree.lua) so a task is never suspended in the
+**	  middle of updating the scheduler or channel structures
+*/
+
+#include "lstdimpl.h"
+#include <time.h>
+
+#define MAX_PROTECTED 			16
+
+static volatile int enabled = 0;
+static double budget_sec = 0;
+static double resumed_at = 0;
+static lua_State *armed = NULL;
+static lua_State *fired = NULL;		/* force-yielded by the hook, see preempt.fired */
+static size_t npreempted = 0;
+
+static char *prefixes[MAX_PROTECTED];
+static size_t prefixes_len[MAX_PROTECTED];
+static int nprotected = 0;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000;
+}
+
+static int is_protected(const char *source)
+{
+	int i;
+	for (i = 0; i < nprotected; i++) {
+		if (strncmp(source, prefixes[i], prefixes_len[i]) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void preempt_hook(lua_State *L, lua_Debug *ar)
+{
+	if (ar->event != LUA_HOOKCOUNT)
+		return;
+
+	/* armed before being disabled, or inherited from the armed coroutine */
+	if (!enabled || L != armed) {
+		lua_sethook(L, NULL, 0, 0);
+		return;
+	}
+
+	if (budget_sec > 0 && now() - resumed_at < budget_sec)
+		return;
+
+	if (!lua_isyieldable(L))
+		return;
+
+	if (nprotected > 0 && lua_getinfo(L, "S", ar) && is_protected(ar->source))
+		return;
+
+	npreempted++;
+	fired = L;
+	lua_yield(L, 0);
+}
+
+/*
+** preempt.arm(co, count, sec=0)
+**
+** Install the hook on coroutine 'co' before resuming it, see the comments on
+** the top for 'count' and 'sec'.
+*/
+static int lpreempt_arm(lua_State *L)
+{
+	lua_State *co = lua_tothread(L, 1);
+	int count = (int)luaL_checkinteger(L, 2);
+	luaL_argcheck(L, co != NULL, 1, "coroutine expected");
+	luaL_argcheck(L, count > 0, 2, "positive count expected");
+
+	budget_sec = (double)luaL_optnumber(L, 3, 0);
+	if (budget_sec > 0)
+		resumed_at = now();
+	enabled = 1;
+	armed = co;
+	fired = NULL;
+	lua_sethook(co, preempt_hook, LUA_MASKCOUNT, count);
+	return 0;
+}
+
+/*
+** preempt.disable()
+**
+** The hooks left on the coroutines remove themselves when they are called.
+*/
+static int lpreempt_disable(lua_State *L)
+{
+	enabled = 0;
+	unused(L);
+	return 0;
+}
+
+/*
+** preempt.protect(prefix)
+**
+** Never preempt functions whose source(chunkname, e.g. '@/usr/lib/lua/5.3/tasklet.lua')
+** starts with 'prefix'.
+*/
+static int lpreempt_protect(lua_State *L)
+{
+	size_t len;
+	const char *prefix = luaL_checklstring(L, 1, &len);
+	int i;
+
+	for (i = 0; i < nprotected; i++) {
+		if (prefixes_len[i] == len && memcmp(prefixes[i], prefix, len) == 0)
+			return 0;
+	}
+	if (nprotected >= MAX_PROTECTED)
+		luaL_error(L, "too many protected sources");
+
+	prefixes[nprotected] = strdup(prefix);
+	prefixes_len[nprotected] = len;
+	nprotected++;
+	return 0;
+}
+
+/*
+** n = preempt.count()
+**
+** Return how many times the coroutines are force-yielded.
+*/
+static int lpreempt_count(lua_State *L)
+{
+	lua_pushinteger(L, (lua_Integer)npreempted);
+	return 1;
+}
+
+/*
+** boolean = preempt.fired(co)
+**
+** Tell whether the last resume of 'co' ended by the hook, rather than by a
+** yield of its own.
+*/
+static int lpreempt_fired(lua_State *L)
+{
+	lua_State *co = lua_tothread(L, 1);
+	luaL_argcheck(L, co != NULL, 1, "coroutine expected");
+	lua_pushboolean(L, co == fired);
+	if (co == fired)
+		fired = NULL;
+	return 1;
+}
+
+static const luaL_Reg funcs[] = {
+	{"arm", lpreempt_arm},
+	{"fired", lpreempt_fired},
+	{"disable", lpreempt_disable},
+	{"protect", lpreempt_protect},
+	{"count", lpreempt_count},
+	{NULL, NULL}
+};
+
+int l_openpreempt(lua_State *L)
+{
+	l_register_lib(L, "preempt", funcs, NULL);
+	return 0;
+}
@@ -0,0 +1,361 @@
+/*
+ * Copyright (C) spyder
+ */
+
+/*
+** Sampling profiler for Lua code.
+**
+** ITIMER_VIRTUAL fires SIGVTALRM by the consumed user CPU time(SIGPROF is
+** taken by tasklet for updating time). The signal handler can't touch the
+** Lua state, it only installs a one-shot count hook on the running coroutine
+** (told by profiler.enter/leave, tasklet does it around every resume), the
+** hook walks the stack by lua_getstack and counts the stack in folded format:
+**
+**		task;file:line:func;file:line:func count
+**
+** which is what flamegraph.pl and most flamegraph tools take as input.
+*/
+
+#include "lstdimpl.h"
+#include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#define MAX_DEPTH 			64
+#define MAX_FRAME 			128
+#define MAX_NESTING 		16
+
+/* names are copied, a task may drop its t_name while being resumed */
+static lua_State *volatile active_L = NULL;
+static char active_name[MAX_FRAME];
+static lua_State *main_L = NULL;
+static volatile sig_atomic_t sampling = 0;
+
+/* resumes nest when a task resumes the ready tasks before blocking */
+static lua_State *outer_L[MAX_NESTING];
+static char outer_name[MAX_NESTING][MAX_FRAME];
+static int nesting = 0;
+
+/* hook replaced by the sampling hook on the target thread */
+static lua_State *hooked_L = NULL;
+static lua_Hook saved_hook;
+static int saved_mask;
+static int saved_count;
+
+static struct sigaction old_sa;
+static size_t nsamples = 0;
+
+/* registry key of the {[stack] = count} table */
+static char samples_key;
+
+static void put_frame(luaL_Buffer *b, lua_Debug *ar)
+{
+	char frame[MAX_FRAME];
+	const char *name = ar->name != NULL ? ar->name : "?";
+
+	if (*ar->what == 'C') {
+		snprintf(frame, sizeof(frame), "[C]:%s", name);
+	} else if (*ar->what == 'm') {
+		snprintf(frame, sizeof(frame), "%s:main", ar->short_src);
+	} else {
+		snprintf(frame, sizeof(frame), "%s:%d:%s", ar->short_src, ar->linedefined, name);
+	}
+
+	/* ';' and ' ' are separators in the folded format */
+	for (char *p = frame; *p; p++) {
+		if (*p == ';' || *p == ' ')
+			*p = '_';
+	}
+	luaL_addchar(b, ';');
+	luaL_addstring(b, frame);
+}
+
+/* number of frames on the stack of L */
+static int stack_depth(lua_State *L)
+{
+	lua_Debug ar;
+	int lo = 0, hi = 1;
+
+	/* level 'lo' exists and 'hi' doesn't */
+	if (!lua_getstack(L, 0, &ar))
+		return 0;
+	while (lua_getstack(L, hi, &ar)) {
+		lo = hi;
+		hi *= 2;
+	}
+	while (hi - lo > 1) {
+		int mid = lo + (hi - lo) / 2;
+		if (lua_getstack(L, mid, &ar))
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return hi;
+}
+
+static void sample_hook(lua_State *L, lua_Debug *unused_ar)
+{
+	lua_Debug ar;
+	luaL_Buffer b;
+	int depth, keep;
+
+	lua_sethook(L, saved_hook, saved_mask, saved_count);
+	hooked_L = NULL;
+	unused(unused_ar);
+
+	if (!sampling)
+		return;
+
+	/*
+	** the outermost frames are kept for a deep stack, so the truncated stacks
+	** still share their prefixes when merged into a flamegraph
+	*/
+	depth = stack_depth(L);
+	keep = depth > MAX_DEPTH ? MAX_DEPTH - 1 : depth;
+
+	luaL_buffinit(L, &b);
+	if (L == active_L && active_name[0] != '\0')
+		luaL_addstring(&b, active_name);
+	else
+		luaL_addstring(&b, L == main_L ? "loop" : "task");
+	for (int level = depth - 1; level >= depth - keep; level--) {
+		lua_getstack(L, level, &ar);
+		lua_getinfo(L, "Sn", &ar);
+		put_frame(&b, &ar);
+	}
+	if (keep < depth)
+		luaL_addstring(&b, ";[truncated]");
+	luaL_pushresult(&b);
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &samples_key);
+	if (lua_istable(L, -1)) {
+		lua_pushvalue(L, -2);
+		lua_rawget(L, -2);
+		lua_Integer count = lua_tointeger(L, -1) + 1;
+		lua_pop(L, 1);
+		lua_pushvalue(L, -2);
+		lua_pushinteger(L, count);
+		lua_rawset(L, -3);
+		nsamples++;
+	}
+	lua_pop(L, 2);
+}
+
+static void on_sigvtalrm(int sig)
+{
+	lua_State *L = active_L != NULL ? active_L : main_L;
+	unused(sig);
+
+	if (!sampling || L == NULL || hooked_L != NULL)
+		return;
+
+	hooked_L = L;
+	saved_hook = lua_gethook(L);
+	saved_mask = lua_gethookmask(L);
+	saved_count = lua_gethookcount(L);
+	lua_sethook(L, sample_hook, LUA_MASKCOUNT, 1);
+}
+
+/*
+** err = profiler.start(interval=0.01)
+**
+** Start sampling every 'interval' seconds of CPU time, the samples collected
+** previously are dropped.
+*/
+static int lprofiler_start(lua_State *L)
+{
+	lua_Number interval = luaL_optnumber(L, 1, 0.01);
+	struct itimerval itv;
+	struct sigaction sa;
+
+	if (sampling) {
+		lua_pushinteger(L, EALREADY);
+		return 1;
+	}
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+	main_L = lua_tothread(L, -1);
+	lua_pop(L, 1);
+
+	lua_newtable(L);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &samples_key);
+	nsamples = 0;
+	hooked_L = NULL;
+	nesting = 0;
+	active_L = NULL;
+	active_name[0] = '\0';
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_sigvtalrm;
+	sa.sa_flags = SA_RESTART;
+	sigfillset(&sa.sa_mask);
+	if (sigaction(SIGVTALRM, &sa, &old_sa) < 0) {
+		lua_pushinteger(L, errno);
+		return 1;
+	}
+
+	sampling = 1;
+	itv.it_interval.tv_sec = (time_t)interval;
+	itv.it_interval.tv_usec = (suseconds_t)((interval - (lua_Number)itv.it_interval.tv_sec) * 1000000);
+	if (itv.it_interval.tv_sec == 0 && itv.it_interval.tv_usec == 0)
+		itv.it_interval.tv_usec = 1000;
+	itv.it_value = itv.it_interval;
+	if (setitimer(ITIMER_VIRTUAL, &itv, NULL) < 0) {
+		int err = errno;
+		sampling = 0;
+		sigaction(SIGVTALRM, &old_sa, NULL);
+		lua_pushinteger(L, err);
+		return 1;
+	}
+
+	lua_pushinteger(L, 0);
+	return 1;
+}
+
+/*
+** nsamples = profiler.stop()
+**
+** The collected samples are kept until the next start.
+*/
+static int lprofiler_stop(lua_State *L)
+{
+	if (sampling) {
+		struct itimerval itv;
+		memset(&itv, 0, sizeof(itv));
+		setitimer(ITIMER_VIRTUAL, &itv, NULL);
+		sampling = 0;
+		sigaction(SIGVTALRM, &old_sa, NULL);
+
+		/* the pending sampling hook becomes a no-op, but the saved hook must be restored */
+		if (hooked_L != NULL) {
+			lua_sethook(hooked_L, saved_hook, saved_mask, saved_count);
+			hooked_L = NULL;
+		}
+	}
+	lua_pushinteger(L, (lua_Integer)nsamples);
+	return 1;
+}
+
+/*
+** boolean = profiler.running()
+*/
+static int lprofiler_running(lua_State *L)
+{
+	lua_pushboolean(L, sampling);
+	return 1;
+}
+
+/*
+** profiler.enter(co, name)
+**
+** Tell the profiler the coroutine 'co' is about to be resumed, 'name' is the
+** root frame of its samples.
+*/
+static int lprofiler_enter(lua_State *L)
+{
+	lua_State *co = lua_tothread(L, 1);
+	const char *name = lua_tostring(L, 2);
+	luaL_argcheck(L, co != NULL, 1, "coroutine expected");
+	if (nesting < MAX_NESTING) {
+		outer_L[nesting] = active_L;
+		memcpy(outer_name[nesting], active_name, sizeof(active_name));
+	}
+	nesting++;
+	snprintf(active_name, sizeof(active_name), "%s", name != NULL ? name : "");
+	active_L = co;
+	return 0;
+}
+
+/*
+** profiler.leave()
+**
+** The coroutine told by profiler.enter has yielded or finished.
+*/
+static int lprofiler_leave(lua_State *L)
+{
+	lua_State *co = active_L;
+
+	if (nesting > 0 && --nesting < MAX_NESTING) {
+		memcpy(active_name, outer_name[nesting], sizeof(active_name));
+		active_L = outer_L[nesting];
+	} else {
+		active_name[0] = '\0';
+		active_L = NULL;
+	}
+
+	/*
+	** a sample requested while 'co' was running but not taken yet, drop it
+	** instead of waiting for the next resume which may never happen
+	*/
+	if (co != NULL && hooked_L == co) {
+		lua_sethook(co, saved_hook, saved_mask, saved_count);
+		hooked_L = NULL;
+	}
+	unused(L);
+	return 0;
+}
+
+/*
+** samples = profiler.samples()
+**
+** Return {[folded_stack] = count}
+*/
+static int lprofiler_samples(lua_State *L)
+{
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &samples_key);
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+	}
+	return 1;
+}
+
+/*
+** err = profiler.dump(path)
+**
+** Write the samples in folded format, one stack per line.
+*/
+static int lprofiler_dump(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	FILE *fp = fopen(path, "w");
+	int err = 0;
+
+	if (fp == NULL) {
+		lua_pushinteger(L, errno);
+		return 1;
+	}
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &samples_key);
+	if (lua_istable(L, -1)) {
+		lua_pushnil(L);
+		while (lua_next(L, -2)) {
+			fprintf(fp, "%s %lld\n", lua_tostring(L, -2), (long long)lua_tointeger(L, -1));
+			lua_pop(L, 1);
+		}
+	}
+	lua_pop(L, 1);
+
+	if (fflush(fp) != 0)
+		err = errno;
+	fclose(fp);
+	lua_pushinteger(L, err);
+	return 1;
+}
+
+static const luaL_Reg funcs[] = {
+	{"start", lprofiler_start},
+	{"stop", lprofiler_stop},
+	{"running", lprofiler_running},
+	{"enter", lprofiler_enter},
+	{"leave", lprofiler_leave},
+	{"samples", lprofiler_samples},
+	{"dump", lprofiler_dump},
+	{NULL, NULL}
+};
+
+int l_openprofiler(lua_State *L)
+{
+	l_register_lib(L, "profiler", funcs, NULL);
+	return 0;
+}
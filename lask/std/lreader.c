@@ -16,6 +16,7 @@ void reader_init(Reader *rd, const uint8 *mem, size_t memsiz)
 	rd->mem = rd->data = mem;
 	rd->memsiz = rd->datasiz = memsiz;
 	rd->be = true;
+	rd->seg = NULL;
 }
 
 void reader_shift(Reader *rd, size_t siz)
@@ -72,6 +73,17 @@ Reader* reader_lcheck(lua_State *L, int idx)
 /******************************************************************************
 	lua interface
 ******************************************************************************/
+/*
+** __gc
+*/
+static int lreader_gc(lua_State *L)
+{
+	Reader *rd = (Reader*)lua_touserdata(L, 1);
+	if (rd->magic == READER_MAGIC)
+		reader_unpin(rd);
+	return 0;
+}
+
 /*
 ** __len
 */
@@ -143,6 +155,7 @@ static int lreader_sub(lua_State *L)
 
 	subrd = (Reader*)lua_newuserdata(L, sizeof(Reader));
 	reader_init(subrd, rd->data + offset, length);
+	reader_pin(subrd, rd->seg);
 	l_setmetatable(L, -1, READER_META);
 	return 1;
 }
@@ -303,9 +316,10 @@ static int eachline_next(lua_State *L)
 */
 static int lreader_eachline(lua_State *L)
 {
-	Reader *rd = reader_lcheck(L, 1);
+	reader_lcheck(L, 1);
 	lua_pushcfunction(L, eachline_next);
-	lua_pushlightuserdata(L, rd);
+	/* the reader itself rather than a light userdata, not to be collected while iterated */
+	lua_pushvalue(L, 1);
 	return 2;
 }
 
@@ -410,6 +424,7 @@ static int lreader_find_formdata_content_boundary(lua_State *L)
 }
 
 static const luaL_Reg meta_funcs[] = {
+	{"__gc", lreader_gc},
 	{"__len", lreader_len},
 	{"__tostring", lreader_tostring},
 	{NULL, NULL}
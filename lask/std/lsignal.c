@@ -105,9 +105,15 @@ static void sig_postpone (int i)
 	/* Queue signals */
 	signals[signal_count] = i;
 	signal_count ++;
-	old_hook = lua_gethook(signalL);
-	old_mask = lua_gethookmask(signalL);
-	old_count = lua_gethookcount(signalL);
+	/*
+	** a signal arriving before the previous one is handled must not save
+	** sig_handle as the old hook, or it would never be removed
+	*/
+	if (lua_gethook(signalL) != sig_handle) {
+		old_hook = lua_gethook(signalL);
+		old_mask = lua_gethookmask(signalL);
+		old_count = lua_gethookcount(signalL);
+	}
 	lua_sethook(signalL, sig_handle, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
 	defer_signal--;
 	/* re-raise any pending signals */
@@ -246,7 +252,9 @@ static const luaL_Reg funcs[] = {
 
 int l_opensignal(lua_State *L)
 {	
-	signalL = L;
+	/* states opened later(by thread.start) never get signals */
+	if (signalL == NULL)
+		signalL = L;
 	
 	lua_pushlightuserdata(L, &signalL);
 	lua_newtable(L);
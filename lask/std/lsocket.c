@@ -73,6 +73,17 @@ static bool sa_parse(const sockaddr_x *sa, char *addr, int *port)
 	return true;
 }
 
+bool socket_buildaddr(const char *addr, int port, void *sa, size_t *salen)
+{
+	sockaddr_x x;
+	memset(&x, 0, sizeof(x));
+	if (!sa_build(addr, port, &x) || *salen < SA_SIZE(x))
+		return false;
+	*salen = SA_SIZE(x);
+	memcpy(sa, &x, *salen);
+	return true;
+}
+
 int socket_shutdown(int fd, int how)
 {
     shutdown(fd, how);
@@ -400,7 +411,7 @@ static int lsocket_sendtob(lua_State *L)
 static int lsocket_getpeername(lua_State *L)
 {
 	int fd = luaL_checkinteger(L, 1);
-	char addr[INET6_ADDRSTRLEN];
+	char addr[MAX_ADDRSTRLEN];
 	int port = 0;
 	int err = socket_getpeername(fd, addr, &port);
 	if (err == 0) {
@@ -420,7 +431,7 @@ static int lsocket_getpeername(lua_State *L)
 static int lsocket_getsockname(lua_State *L)
 {
 	int fd = luaL_checkinteger(L, 1);
-	char addr[INET6_ADDRSTRLEN];
+	char addr[MAX_ADDRSTRLEN];
 	int port = 0;
 	int err = socket_getsockname(fd, addr, &port);
 	if (err == 0) {
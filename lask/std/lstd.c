@@ -26,14 +26,14 @@ void* l_realloc(void *optr, size_t nsize)
 
 		*(cast(size_t, nptr)) = nsize;
 		nptr = rshift(nptr);
-		mem_total += nsize;
+		__atomic_add_fetch(&mem_total, nsize, __ATOMIC_RELAXED);
 	}
 
 	if (optr != NULL) {
 		size_t *psize = lshift(optr);
 		size_t osize = *psize;
 
-		mem_total -= osize;
+		__atomic_sub_fetch(&mem_total, osize, __ATOMIC_RELAXED);
 
 		if (nsize > 0)
 			memcpy(nptr, optr, MIN(osize, nsize));
@@ -126,13 +126,23 @@ int luaopen__std(lua_State *L)
 	l_opencodec(L);
 #if 0
 	l_opensem(L);
-	l_openinotify(L);
 #endif
+	l_openinotify(L);
 	l_openfcntl(L);
 	l_openpoll(L);
 	l_openprctl(L);
 	l_openiface(L);
 	l_openmd5(L);
+	l_openthread(L);
+	l_openoffload(L);
+	l_openuring(L);
+	l_openmetrics(L);
+	l_openprofiler(L);
+	l_openpreempt(L);
+	l_openhash(L);
+	l_openpack(L);
+	l_openchain(L);
+	l_openwalk(L);
 
 	lua_pushcfunction(L, l_stdmem);
 	lua_setglobal(L, "stdmem");
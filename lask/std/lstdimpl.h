@@ -113,6 +113,37 @@ typedef enum {
 }ST_FIELD;
 
 
+/* a memory shared by the buffers, readers and chains using it, see buffer:slice() */
+typedef struct _BufferSeg {
+	uint32 refs;
+	uint8 *mem;
+	size_t mapsiz;			/* non-zero if 'mem' is mmap()-ed, see fs.mmap() */
+}BufferSeg;
+
+/* a chain of memory pages, see buffer.chain() */
+#define CHAIN_META				"meta(chain)"
+#define CHAIN_MAGIC				1437549503
+
+typedef struct _ChainPage {
+	struct _ChainPage *next;
+	BufferSeg *seg;
+	uint8 *lo;				/* [lo, hi) is the memory the chain may write to */
+	uint8 *hi;
+	uint8 *data;
+	size_t datasiz;
+}ChainPage;
+
+typedef struct _Chain {
+	uint32 magic;
+	ChainPage *head;
+	ChainPage *tail;
+	size_t datasiz;
+	size_t pagesiz;
+	size_t npages;
+	ChainPage *cur;			/* the page found by the last lookup, and its offset */
+	size_t curoff;
+}Chain;
+
 void 		buffer_init(Buffer *buf, size_t minsiz);
 uint8* 		buffer_grow(Buffer *buf, size_t growth);
 size_t 		buffer_push(Buffer *buf, const void *mem, size_t memsiz);
@@ -124,7 +155,12 @@ void 		buffer_finalize(Buffer *buf);
 Buffer* 	buffer_lcheck(lua_State *L, int idx);
 uint8* 		buffer_safegrow(Buffer *buffer, size_t growth, lua_State *L);
 
+BufferSeg* 	bufseg_new(uint8 *mem);
+void 		bufseg_release(BufferSeg *seg);
+
 void 		reader_init(Reader *rd, const uint8 *mem, size_t memsiz);
+void 		reader_pin(Reader *rd, BufferSeg *seg);
+void 		reader_unpin(Reader *rd);
 void 		reader_shift(Reader *rd, size_t siz);
 Reader* 	reader_lcheck(lua_State *L, int idx);
 const char* reader_getline(Reader *rd, size_t *len);
@@ -140,6 +176,23 @@ int 		os_implwrite(int fd, const uint8 *mem, size_t bytes_req, size_t *bytes_don
 				ssize_t (*write_cb)(int, const void*, size_t, void*), void* ud);
 int 		os_write(int fd, const uint8 *mem, size_t bytes_req, size_t *bytes_done);
 
+Chain* 		chain_test(lua_State *L, int idx);
+void 		chain_copy(Chain *chain, size_t offset, size_t length, uint8 *dst);
+int 		chain_write(int fd, Chain *chain, size_t offset, size_t length, size_t *bytes_done);
+
+typedef struct _Walker Walker;
+Walker* 	walker_acquire(lua_State *L, int idx);
+size_t 		walker_fill(Walker *w);
+void 		walker_release(Walker *w);
+
+bool 		socket_buildaddr(const char *addr, int port, void *sa, size_t *salen);
+
+struct stat;
+void 		stat_pushtable(lua_State *L, const struct stat *st, int fields);
+void 		md5_digest(const void *message, size_t len, uint8 *output);
+int 		hash_lcheckalg(lua_State *L, int idx, const char *def);
+int 		hash_fd(int alg, int fd, uint8 *out, size_t *outsiz);
+
 
 typedef struct _EnumReg {
 	const char *name;
@@ -185,6 +238,18 @@ int 		l_openprctl(lua_State *L);
 int 		l_openrbtree(lua_State *L);
 int 		l_openiface(lua_State *L);
 int 		l_openmd5(lua_State *L);
+int 		l_openthread(lua_State *L);
+int 		l_openoffload(lua_State *L);
+int 		l_openuring(lua_State *L);
+int 		l_openmetrics(lua_State *L);
+int 		l_openprofiler(lua_State *L);
+int 		l_openpreempt(lua_State *L);
+int 		l_openhash(lua_State *L);
+int 		l_openpack(lua_State *L);
+int 		l_openchain(lua_State *L);
+int 		l_openwalk(lua_State *L);
+
+int 		luaopen__std(lua_State *L);
 
 #if LUA_VERSION_NUM == 501
 void luaL_setfuncs (lua_State *L, const luaL_Reg *l, int nup);
@@ -18,6 +18,7 @@ static int lstring_reader(lua_State *L)
 
 	if (top >= 2 && lua_type(L, 2) == LUA_TUSERDATA) {
 		reader = reader_lcheck(L, 2);
+		reader_unpin(reader);
 		lua_pushvalue(L, 2);
 	}
 	if (reader == NULL) {
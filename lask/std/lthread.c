@@ -0,0 +1,577 @@
+/*
+ * Copyright (C) spyder
+ */
+
+/*
+** Bounded message queues shared by Lua states running on different OS threads.
+**
+** A queue is a lock-free MPMC ring(as described by Dmitry Vyukov), messages are
+** plain bytes copied in and out of buffers, thus any encoding(putlist, putlstr,
+** cjson ...) can be carried.
+**
+** Each queue owns an eventfd which becomes readable when messages are pushed,
+** so the consumer in the tasklet loop can wait for it by tasklet.add_handler.
+*/
+
+#include "lstdimpl.h"
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <lualib.h>
+
+#define QUEUE_META 			"queue*"
+#define CACHELINE			64
+
+typedef struct _Message {
+	size_t len;
+	uint8 data[0];
+}Message;
+
+typedef struct _Cell {
+	size_t seq;
+	Message *msg;
+}Cell;
+
+typedef struct _Queue {
+	int refcnt;
+	int efd;
+	size_t mask;
+	char pad0[CACHELINE];
+	size_t enqpos;
+	char pad1[CACHELINE];
+	size_t deqpos;
+	char pad2[CACHELINE];
+	Cell cells[0];
+}Queue;
+
+#define atomic_load(p)				__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define atomic_store(p, v)			__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define atomic_cas(p, o, n)			__atomic_compare_exchange_n(p, o, n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#define atomic_add(p, v)			__atomic_add_fetch(p, v, __ATOMIC_ACQ_REL)
+
+static Queue* queue_new(size_t cap)
+{
+	size_t siz = 2;
+	Queue *q;
+
+	while (siz < cap)
+		siz <<= 1;
+
+	q = (Queue*)malloc(sizeof(Queue) + siz * sizeof(Cell));
+	if (q == NULL)
+		return NULL;
+
+	q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (q->efd < 0) {
+		free(q);
+		return NULL;
+	}
+
+	q->refcnt = 1;
+	q->mask = siz - 1;
+	q->enqpos = 0;
+	q->deqpos = 0;
+	for (size_t i = 0; i < siz; i++) {
+		q->cells[i].seq = i;
+		q->cells[i].msg = NULL;
+	}
+	return q;
+}
+
+static void queue_release(Queue *q)
+{
+	if (atomic_add(&q->refcnt, -1) == 0) {
+		for (size_t i = 0; i <= q->mask; i++) {
+			if (q->cells[i].msg != NULL)
+				free(q->cells[i].msg);
+		}
+		close(q->efd);
+		free(q);
+	}
+}
+
+static bool queue_push(Queue *q, Message *msg)
+{
+	size_t pos = __atomic_load_n(&q->enqpos, __ATOMIC_RELAXED);
+	Cell *cell;
+
+	while (true) {
+		cell = &q->cells[pos & q->mask];
+		size_t seq = atomic_load(&cell->seq);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			if (atomic_cas(&q->enqpos, &pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return false;	/* full */
+		} else {
+			pos = __atomic_load_n(&q->enqpos, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->msg = msg;
+	atomic_store(&cell->seq, pos + 1);
+	return true;
+}
+
+static Message* queue_pop(Queue *q)
+{
+	size_t pos = __atomic_load_n(&q->deqpos, __ATOMIC_RELAXED);
+	Cell *cell;
+	Message *msg;
+
+	while (true) {
+		cell = &q->cells[pos & q->mask];
+		size_t seq = atomic_load(&cell->seq);
+		intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (diff == 0) {
+			if (atomic_cas(&q->deqpos, &pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return NULL; /* empty */
+		} else {
+			pos = __atomic_load_n(&q->deqpos, __ATOMIC_RELAXED);
+		}
+	}
+
+	msg = cell->msg;
+	cell->msg = NULL;
+	atomic_store(&cell->seq, pos + q->mask + 1);
+	return msg;
+}
+
+static Queue* queue_lcheck(lua_State *L, int idx)
+{
+	Queue **pq = (Queue**)luaL_checkudata(L, idx, QUEUE_META);
+	return *pq;
+}
+
+static void queue_lpush(lua_State *L, Queue *q)
+{
+	Queue **pq = (Queue**)lua_newuserdata(L, sizeof(Queue*));
+	*pq = q;
+	l_setmetatable(L, -1, QUEUE_META);
+}
+
+/*
+** q = thread.queue(capacity=64)
+**
+** capacity is rounded up to the power of 2.
+*/
+static int lthread_queue(lua_State *L)
+{
+	size_t cap = (size_t)luaL_optinteger(L, 1, 64);
+	Queue *q = queue_new(cap);
+	if (q == NULL) {
+		lua_pushnil(L);
+		lua_pushinteger(L, errno);
+		return 2;
+	}
+	queue_lpush(L, q);
+	lua_pushinteger(L, 0);
+	return 2;
+}
+
+/*
+** q:__gc
+*/
+static int lqueue_gc(lua_State *L)
+{
+	Queue **pq = (Queue**)luaL_checkudata(L, 1, QUEUE_META);
+	if (*pq != NULL) {
+		queue_release(*pq);
+		*pq = NULL;
+	}
+	return 0;
+}
+
+/*
+** ok = q:push(str_or_buffer_or_reader)
+**
+** return false if the queue is full.
+*/
+static int lqueue_push(lua_State *L)
+{
+	union {
+		const Buffer *buffer;
+		const Reader *reader;
+	}ptr;
+	Queue *q = queue_lcheck(L, 1);
+	const uint8 *data = NULL;
+	size_t datasiz = 0;
+	Message *msg;
+	uint64_t one = 1;
+
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		data = (const uint8*)lua_tolstring(L, 2, &datasiz);
+	} else {
+		ptr.buffer = (const Buffer*)lua_touserdata(L, 2);
+		if (ptr.buffer != NULL) {
+			if (ptr.buffer->magic == BUFFER_MAGIC) {
+				data = ptr.buffer->data;
+				datasiz = ptr.buffer->datasiz;
+			} else if (ptr.reader->magic == READER_MAGIC) {
+				data = ptr.reader->data;
+				datasiz = ptr.reader->datasiz;
+			}
+		}
+		if (data == NULL)
+			luaL_error(L, "expecting string/buffer/reader for argument 2");
+	}
+
+	msg = (Message*)malloc(sizeof(Message) + datasiz);
+	if (msg == NULL)
+		luaL_error(L, "out of memory");
+	msg->len = datasiz;
+	memcpy(msg->data, data, datasiz);
+
+	if (queue_push(q, msg)) {
+		if (write(q->efd, &one, sizeof(one)) < 0) {
+			/* EAGAIN only when the counter is about to overflow */
+		}
+		lua_pushboolean(L, 1);
+	} else {
+		free(msg);
+		lua_pushboolean(L, 0);
+	}
+	return 1;
+}
+
+/*
+** ok = q:pop(buffer, sec=0)
+**
+** append the next message to the buffer.
+**
+** if the queue is empty, wait up to 'sec' seconds(forever if sec < 0),
+** 'sec' should be 0 when called inside tasklet.loop.
+**
+** return false if no message popped.
+*/
+static int lqueue_pop(lua_State *L)
+{
+	Queue *q = queue_lcheck(L, 1);
+	Buffer *buffer = buffer_lcheck(L, 2);
+	lua_Number sec = luaL_optnumber(L, 3, 0);
+	int timeout = sec < 0 ? -1 : (int)(sec * 1000);
+	Message *msg;
+
+	while (true) {
+		uint64_t count;
+
+		msg = queue_pop(q);
+		if (msg != NULL)
+			break;
+
+		/* reset the eventfd, then check again so no wakeup is lost */
+		if (read(q->efd, &count, sizeof(count)) > 0) {
+			msg = queue_pop(q);
+			if (msg != NULL)
+				break;
+		}
+
+		if (timeout == 0) {
+			lua_pushboolean(L, 0);
+			return 1;
+		} else {
+			struct pollfd pfd = {.fd = q->efd, .events = POLLIN};
+			if (poll(&pfd, 1, timeout) == 0)
+				timeout = 0;
+		}
+	}
+
+	memcpy(buffer_safegrow(buffer, msg->len, L), msg->data, msg->len);
+	free(msg);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/*
+** fd = q:fd()
+*/
+static int lqueue_fd(lua_State *L)
+{
+	Queue *q = queue_lcheck(L, 1);
+	lua_pushinteger(L, q->efd);
+	return 1;
+}
+
+/******************************************************************************
+** threads
+******************************************************************************/
+
+enum {
+	ARG_NIL,
+	ARG_BOOLEAN,
+	ARG_INTEGER,
+	ARG_NUMBER,
+	ARG_STRING,
+	ARG_QUEUE,
+};
+
+typedef struct _ThreadArg {
+	int type;
+	union {
+		int b;
+		lua_Integer i;
+		lua_Number n;
+		Queue *q;
+		struct {
+			char *ptr;
+			size_t len;
+		}s;
+	}u;
+}ThreadArg;
+
+typedef struct _Thread {
+	char *chunk;
+	size_t chunklen;
+	char *path;
+	char *cpath;
+	int argc;
+	ThreadArg argv[0];
+}Thread;
+
+static char* strdup_len(const char *str, size_t len)
+{
+	char *p = (char*)malloc(len + 1);
+	if (p != NULL) {
+		memcpy(p, str, len);
+		p[len] = 0;
+	}
+	return p;
+}
+
+static void thread_free(Thread *th)
+{
+	for (int i = 0; i < th->argc; i++) {
+		ThreadArg *arg = &th->argv[i];
+		if (arg->type == ARG_STRING)
+			free(arg->u.s.ptr);
+		else if (arg->type == ARG_QUEUE && arg->u.q != NULL)
+			queue_release(arg->u.q);
+	}
+	free(th->chunk);
+	free(th->path);
+	free(th->cpath);
+	free(th);
+}
+
+static void thread_setpath(lua_State *L, const char *field, const char *path)
+{
+	if (path != NULL) {
+		lua_getglobal(L, "package");
+		lua_pushstring(L, path);
+		lua_setfield(L, -2, field);
+		lua_pop(L, 1);
+	}
+}
+
+static void* thread_main(void *ud)
+{
+	Thread *th = (Thread*)ud;
+	lua_State *L = luaL_newstate();
+
+	if (L == NULL) {
+		thread_free(th);
+		return NULL;
+	}
+
+	luaL_openlibs(L);
+	thread_setpath(L, "path", th->path);
+	thread_setpath(L, "cpath", th->cpath);
+	luaL_requiref(L, "_std", luaopen__std, 0);
+	lua_pop(L, 1);
+
+	if (luaL_loadbuffer(L, th->chunk, th->chunklen, "=thread") == 0) {
+		for (int i = 0; i < th->argc; i++) {
+			ThreadArg *arg = &th->argv[i];
+			switch (arg->type) {
+			case ARG_BOOLEAN:
+				lua_pushboolean(L, arg->u.b);
+				break;
+			case ARG_INTEGER:
+				lua_pushinteger(L, arg->u.i);
+				break;
+			case ARG_NUMBER:
+				lua_pushnumber(L, arg->u.n);
+				break;
+			case ARG_STRING:
+				lua_pushlstring(L, arg->u.s.ptr, arg->u.s.len);
+				break;
+			case ARG_QUEUE:
+				queue_lpush(L, arg->u.q);
+				arg->u.q = NULL;	/* owned by the userdata now */
+				break;
+			default:
+				lua_pushnil(L);
+				break;
+			}
+		}
+		if (lua_pcall(L, th->argc, 0, 0) != 0)
+			fprintf(stderr, "thread: %s\n", lua_tostring(L, -1));
+	} else {
+		fprintf(stderr, "thread: %s\n", lua_tostring(L, -1));
+	}
+
+	lua_close(L);
+	thread_free(th);
+	return NULL;
+}
+
+static int chunk_writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	unused(L);
+	luaL_addlstring((luaL_Buffer*)ud, (const char*)p, sz);
+	return 0;
+}
+
+/*
+** err = thread.start(chunk, arg1, arg2, ...)
+**
+** run 'chunk' in a new OS thread with a separated Lua state,
+** the standard libraries and _std are opened in advance.
+**
+** 'chunk' is either lua code or a function without upvalues.
+** arguments could be nil, boolean, number, string or queue.
+**
+** the thread is detached, and it exits when the chunk returns.
+** all signals are blocked in the thread, they are always delivered to
+** the main thread.
+*/
+static int lthread_start(lua_State *L)
+{
+	int argc = lua_gettop(L) - 1;
+	const char *chunk;
+	size_t chunklen;
+	Thread *th;
+	pthread_t tid;
+	pthread_attr_t attr;
+	sigset_t set, oldset;
+	int err;
+
+	if (lua_type(L, 1) == LUA_TFUNCTION) {
+		luaL_Buffer b;
+		lua_pushvalue(L, 1);
+		luaL_buffinit(L, &b);
+		lua_dump(L, chunk_writer, &b, 0);
+		luaL_pushresult(&b);
+		lua_replace(L, 1);
+		lua_pop(L, 1);
+	}
+	chunk = luaL_checklstring(L, 1, &chunklen);
+
+	th = (Thread*)calloc(1, sizeof(Thread) + sizeof(ThreadArg) * (size_t)argc);
+	if (th == NULL)
+		return luaL_error(L, "out of memory");
+
+	th->chunk = strdup_len(chunk, chunklen);
+	th->chunklen = chunklen;
+	if (th->chunk == NULL) {
+		thread_free(th);
+		return luaL_error(L, "out of memory");
+	}
+
+	lua_getglobal(L, "package");
+	if (lua_istable(L, -1)) {
+		size_t len;
+		const char *str;
+		lua_getfield(L, -1, "path");
+		if ((str = lua_tolstring(L, -1, &len)) != NULL && (th->path = strdup_len(str, len)) == NULL) {
+			thread_free(th);
+			return luaL_error(L, "out of memory");
+		}
+		lua_getfield(L, -2, "cpath");
+		if ((str = lua_tolstring(L, -1, &len)) != NULL && (th->cpath = strdup_len(str, len)) == NULL) {
+			thread_free(th);
+			return luaL_error(L, "out of memory");
+		}
+		lua_pop(L, 2);
+	}
+	lua_pop(L, 1);
+
+	for (int i = 0; i < argc; i++) {
+		ThreadArg *arg = &th->argv[i];
+		int idx = i + 2;
+		switch (lua_type(L, idx)) {
+		case LUA_TNIL:
+			arg->type = ARG_NIL;
+			break;
+		case LUA_TBOOLEAN:
+			arg->type = ARG_BOOLEAN;
+			arg->u.b = lua_toboolean(L, idx);
+			break;
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, idx)) {
+				arg->type = ARG_INTEGER;
+				arg->u.i = lua_tointeger(L, idx);
+			} else {
+				arg->type = ARG_NUMBER;
+				arg->u.n = lua_tonumber(L, idx);
+			}
+			break;
+		case LUA_TSTRING: {
+				size_t len;
+				const char *str = lua_tolstring(L, idx, &len);
+				arg->type = ARG_STRING;
+				arg->u.s.ptr = strdup_len(str, len);
+				arg->u.s.len = len;
+				if (arg->u.s.ptr == NULL) {
+					th->argc = i;
+					thread_free(th);
+					return luaL_error(L, "out of memory");
+				}
+				break;
+			}
+		default: {
+				Queue **pq = (Queue**)luaL_testudata(L, idx, QUEUE_META);
+				if (pq == NULL || *pq == NULL) {
+					th->argc = i;
+					thread_free(th);
+					return luaL_error(L, "unsupported type for argument %d", idx);
+				}
+				arg->type = ARG_QUEUE;
+				arg->u.q = *pq;
+				atomic_add(&arg->u.q->refcnt, 1);
+				break;
+			}
+		}
+	}
+	th->argc = argc;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	err = pthread_create(&tid, &attr, thread_main, th);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (err != 0)
+		thread_free(th);
+
+	lua_pushinteger(L, err);
+	return 1;
+}
+
+static const luaL_Reg queue_methods[] = {
+	{"__gc", lqueue_gc},
+	{"push", lqueue_push},
+	{"pop", lqueue_pop},
+	{"fd", lqueue_fd},
+	{NULL, NULL},
+};
+
+static const luaL_Reg funcs[] = {
+	{"queue", lthread_queue},
+	{"start", lthread_start},
+	{NULL, NULL},
+};
+
+int l_openthread(lua_State *L)
+{
+	l_register_lib(L, "thread", funcs, NULL);
+	l_register_metatable2(L, QUEUE_META, queue_methods);
+	return 0;
+}
@@ -117,7 +117,8 @@ static int ltime_ctime(lua_State *L)
 }
 
 /*
-** str = time.strftime(fmt, clock)
+** str = time.strftime(fmt, clock, utc=false)
+** clock is formatted in UTC if 'utc'(e.g. HTTP dates), otherwise in local time.
 */
 static int ltime_strftime(lua_State *L)
 {
@@ -126,14 +127,19 @@ static int ltime_strftime(lua_State *L)
 	char tmp[128];
 	struct tm tm_clock;
 
-	localtime_r(&clock, &tm_clock);
+	if (lua_toboolean(L, 3))
+		gmtime_r(&clock, &tm_clock);
+	else
+		localtime_r(&clock, &tm_clock);
 	strftime(tmp, sizeof(tmp), fmt, &tm_clock);
 	lua_pushstring(L, tmp);
 	return 1;
 }
 
 /*
-** t = time.strptime(str, fmt)
+** t = time.strptime(str, fmt, utc=false)
+** t is nil if str doesn't match fmt.
+** str is in UTC if 'utc'(e.g. HTTP dates), otherwise in local time.
 */
 static int ltime_strptime(lua_State *L)
 {
@@ -142,8 +148,15 @@ static int ltime_strptime(lua_State *L)
 	struct tm tm_clock;
 	time_t clock;
 
-	strptime(str, fmt, &tm_clock);
-	clock = mktime(&tm_clock);
+	memset(&tm_clock, 0, sizeof(tm_clock));
+	if (strptime(str, fmt, &tm_clock) == NULL)
+		return 0;
+	if (lua_toboolean(L, 3)) {
+		clock = timegm(&tm_clock);
+	} else {
+		tm_clock.tm_isdst = -1;  /* let mktime() decide */
+		clock = mktime(&tm_clock);
+	}
 	lua_pushinteger(L, clock);
 	return 1;
 }
@@ -254,6 +267,9 @@ static const luaL_Reg funcs[] = {
 
 static const EnumReg enums[] = {
 	LENUM(CLOCK_REALTIME),
+	LENUM(CLOCK_MONOTONIC),
+	LENUM(CLOCK_PROCESS_CPUTIME_ID),
+	LENUM(CLOCK_THREAD_CPUTIME_ID),
 	LENUM(ITIMER_REAL),
 	LENUM(ITIMER_VIRTUAL),
 	LENUM(ITIMER_PROF),
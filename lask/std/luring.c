@@ -0,0 +1,810 @@
+/*
+ * Copyright (C) spyder
+ */
+
+/*
+** A minimal io_uring binding used by tasklet as an alternative to epoll.
+**
+** Operations are prepared into the submission queue without any syscall, all of
+** them are submitted together by 'wait', which also reaps the completions, thus
+** one io_uring_enter per loop iteration replaces the read/write/epoll_wait calls.
+**
+** Every operation occupies a slot(an integer) until its completion is reaped
+** and the slot is released. The slot owns the memory handed to the kernel, so
+** reading/writing buffers may be resized or freed by Lua code meanwhile.
+**
+** Only raw syscalls are used(no liburing), it requires linux >= 5.11
+** (IORING_FEAT_EXT_ARG), otherwise 'create' fails with ENOSYS.
+*/
+
+#include "lstdimpl.h"
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_EXT_ARG
+#define HAVE_IO_URING 		1
+#endif
+#endif
+#endif
+
+#define RING_META				"uring*"
+#define RING_DEFAULT_ENTRIES	256
+
+/* bytes taken by one write at most, a big chain is written by several */
+#define RING_MAX_WRITE			(256 * 1024)
+
+#ifdef HAVE_IO_URING
+
+#if !defined(__NR_io_uring_setup)
+#define __NR_io_uring_setup		425
+#define __NR_io_uring_enter		426
+#endif
+
+#define load_acquire(p)			__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v)		__atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+typedef struct _Slot {
+	bool busy;
+	int res;
+	uint8 *mem;
+	size_t memsiz;
+	size_t len;
+	size_t off;			/* written by the previous completions of a write */
+	struct sockaddr_storage sa;
+}Slot;
+
+typedef struct _Ring {
+	int fd;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned sq_entries;
+	unsigned to_submit;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr;
+	size_t sq_ptrsiz;
+	void *cq_ptr;
+	size_t cq_ptrsiz;
+	size_t sqes_siz;
+
+	Slot **slots;
+	int nslots;
+	int *freelist;
+	int nfree;
+}Ring;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+			unsigned flags, const void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int ring_init(Ring *ring, unsigned entries)
+{
+	struct io_uring_params p;
+	uint8 *sq_ptr, *cq_ptr;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	fd = sys_io_uring_setup(entries, &p);
+	if (fd < 0)
+		return errno;
+
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		close(fd);
+		return ENOSYS;
+	}
+
+	ring->fd = fd;
+	ring->sq_ptrsiz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ptrsiz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_ptrsiz = ring->cq_ptrsiz = MAX(ring->sq_ptrsiz, ring->cq_ptrsiz);
+
+	sq_ptr = (uint8*)mmap(NULL, ring->sq_ptrsiz, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED)
+		goto failed;
+	ring->sq_ptr = sq_ptr;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ptr = sq_ptr;
+	} else {
+		cq_ptr = (uint8*)mmap(NULL, ring->cq_ptrsiz, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq_ptr == MAP_FAILED)
+			goto failed;
+	}
+	ring->cq_ptr = cq_ptr;
+
+	ring->sqes_siz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_siz, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto failed;
+	}
+
+	ring->sq_head = (unsigned*)(sq_ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq_ptr + p.sq_off.array);
+	ring->sq_entries = p.sq_entries;
+	ring->cq_head = (unsigned*)(cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq_ptr + p.cq_off.cqes);
+	return 0;
+
+failed:
+	{
+		int err = errno;
+		if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+			munmap(ring->cq_ptr, ring->cq_ptrsiz);
+		if (ring->sq_ptr != NULL)
+			munmap(ring->sq_ptr, ring->sq_ptrsiz);
+		ring->sq_ptr = ring->cq_ptr = NULL;
+		close(fd);
+		ring->fd = -1;
+		return err;
+	}
+}
+
+static void ring_finalize(Ring *ring)
+{
+	if (ring->fd < 0)
+		return;
+
+	close(ring->fd);
+	ring->fd = -1;
+	if (ring->sqes != NULL)
+		munmap(ring->sqes, ring->sqes_siz);
+	if (ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_ptrsiz);
+	munmap(ring->sq_ptr, ring->sq_ptrsiz);
+
+	for (int i = 0; i < ring->nslots; i++) {
+		Slot *slot = ring->slots[i];
+		/* memory of in-flight operations may still be touched by the kernel */
+		if (!slot->busy) {
+			if (slot->mem != NULL)
+				FREE(slot->mem);
+			FREE(slot);
+		}
+	}
+	free(ring->slots);
+	free(ring->freelist);
+	ring->slots = NULL;
+	ring->freelist = NULL;
+	ring->nslots = ring->nfree = 0;
+}
+
+static int ring_submit(Ring *ring, unsigned min_complete, const struct __kernel_timespec *ts)
+{
+	struct io_uring_getevents_arg arg;
+	unsigned flags = 0;
+	int ret;
+
+	if (min_complete > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (ts != NULL)
+			flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = (uint64_t)(uintptr_t)ts;
+	ret = sys_io_uring_enter(ring->fd, ring->to_submit, min_complete, flags,
+			(flags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+			(flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+	if (ret < 0)
+		return errno;
+
+	ring->to_submit -= MIN((unsigned)ret, ring->to_submit);
+	return 0;
+}
+
+/* return NULL if the submission queue is still full after flushing it */
+static struct io_uring_sqe* ring_getsqe(Ring *ring)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned head = load_acquire(ring->sq_head);
+
+	if (tail - head >= ring->sq_entries) {
+		ring_submit(ring, 0, NULL);
+		head = load_acquire(ring->sq_head);
+		if (tail - head >= ring->sq_entries)
+			return NULL;
+	}
+
+	unsigned idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[idx] = idx;
+	store_release(ring->sq_tail, tail + 1);
+	ring->to_submit++;
+	return sqe;
+}
+
+/* return the index of a free slot, -1 if out of memory */
+static int ring_getslot(Ring *ring)
+{
+	Slot **slots;
+	int *freelist;
+	Slot *slot;
+	int idx;
+
+	if (ring->nfree > 0)
+		return ring->freelist[--ring->nfree];
+
+	slot = (Slot*)MALLOC(sizeof(Slot));
+	if (slot == NULL)
+		return -1;
+	memset(slot, 0, sizeof(Slot));
+
+	/* an array grown is kept by the ring(freed by ring_destroy) even if the other fails */
+	slots = (Slot**)realloc(ring->slots, sizeof(Slot*) * (size_t)(ring->nslots + 1));
+	if (slots == NULL)
+		goto failed;
+	ring->slots = slots;
+
+	freelist = (int*)realloc(ring->freelist, sizeof(int) * (size_t)(ring->nslots + 1));
+	if (freelist == NULL)
+		goto failed;
+	ring->freelist = freelist;
+
+	idx = ring->nslots++;
+	slots[idx] = slot;
+	return idx;
+
+failed:
+	FREE(slot);
+	return -1;
+}
+
+static void ring_putslot(Ring *ring, int idx)
+{
+	Slot *slot = ring->slots[idx];
+	slot->busy = false;
+	slot->len = 0;
+	ring->freelist[ring->nfree++] = idx;
+}
+
+static bool slot_reserve(Slot *slot, size_t siz)
+{
+	if (slot->memsiz < siz) {
+		uint8 *mem = (uint8*)MALLOC(siz);
+		if (mem == NULL)
+			return false;
+		if (slot->mem != NULL)
+			FREE(slot->mem);
+		slot->mem = mem;
+		slot->memsiz = siz;
+	}
+	return true;
+}
+
+static Ring* ring_lcheck(lua_State *L, int idx)
+{
+	Ring *ring = (Ring*)luaL_checkudata(L, idx, RING_META);
+	if (ring->fd < 0)
+		luaL_error(L, "attempt to use a destroyed ring");
+	return ring;
+}
+
+static Slot* slot_lcheck(lua_State *L, Ring *ring, int idx, int *pidx)
+{
+	int slotidx = (int)luaL_checkinteger(L, idx) - 1;
+	if (slotidx < 0 || slotidx >= ring->nslots || !ring->slots[slotidx]->busy)
+		luaL_error(L, "invalid slot %d", slotidx + 1);
+	*pidx = slotidx;
+	return ring->slots[slotidx];
+}
+
+/*
+** Take a slot and a sqe for a new operation, return the slot index or -1 with
+** errno set(ENOMEM, or EBUSY if the submission queue is full).
+*/
+static int ring_prepare(Ring *ring, size_t memsiz, struct io_uring_sqe **psqe)
+{
+	int idx = ring_getslot(ring);
+	if (idx < 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	Slot *slot = ring->slots[idx];
+	if (memsiz > 0 && !slot_reserve(slot, memsiz)) {
+		ring->freelist[ring->nfree++] = idx;
+		errno = ENOMEM;
+		return -1;
+	}
+
+	*psqe = ring_getsqe(ring);
+	if (*psqe == NULL) {
+		ring->freelist[ring->nfree++] = idx;
+		errno = EBUSY;
+		return -1;
+	}
+
+	slot->busy = true;
+	slot->len = 0;
+	slot->off = 0;
+	slot->res = 0;
+	(*psqe)->user_data = (uint64_t)(idx + 1);
+	return idx;
+}
+
+static int push_slot(lua_State *L, int idx)
+{
+	if (idx >= 0) {
+		lua_pushinteger(L, idx + 1);
+		lua_pushinteger(L, 0);
+	} else {
+		lua_pushnil(L);
+		lua_pushinteger(L, errno);
+	}
+	return 2;
+}
+
+/*
+** ring, err = uring.create(entries=256)
+*/
+static int luring_create(lua_State *L)
+{
+	unsigned entries = (unsigned)luaL_optinteger(L, 1, RING_DEFAULT_ENTRIES);
+	Ring *ring = (Ring*)lua_newuserdata(L, sizeof(Ring));
+	int err;
+
+	memset(ring, 0, sizeof(Ring));
+	ring->fd = -1;
+	err = ring_init(ring, entries);
+	if (err != 0) {
+		lua_pushnil(L);
+		lua_pushinteger(L, err);
+		return 2;
+	}
+
+	l_setmetatable(L, -1, RING_META);
+	lua_pushinteger(L, 0);
+	return 2;
+}
+
+/*
+** uring.destroy(ring)
+*/
+static int luring_destroy(lua_State *L)
+{
+	Ring *ring = (Ring*)luaL_checkudata(L, 1, RING_META);
+	ring_finalize(ring);
+	return 0;
+}
+
+/*
+** fd = uring.fd(ring)
+*/
+static int luring_fd(lua_State *L)
+{
+	lua_pushinteger(L, ring_lcheck(L, 1)->fd);
+	return 1;
+}
+
+/*
+** slot, err = uring.read(ring, fd, nbytes)
+**
+** Read at most 'nbytes' bytes from 'fd', fetch them by 'uring.fetch' after completion.
+*/
+static int luring_read(lua_State *L)
+{
+	Ring *ring = ring_lcheck(L, 1);
+	int fd = (int)luaL_checkinteger(L, 2);
+	size_t nbytes = (size_t)luaL_checkinteger(L, 3);
+	struct io_uring_sqe *sqe;
+	int idx;
+
+	if (nbytes == 0)
+		luaL_error(L, "reading 0 bytes is meaningless");
+
+	idx = ring_prepare(ring, nbytes, &sqe);
+	if (idx >= 0) {
+		Slot *slot = ring->slots[idx];
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)slot->mem;
+		sqe->len = (unsigned)nbytes;
+		sqe->off = (uint64_t)-1;
+	}
+	return push_slot(L, idx);
+}
+
+/*
+** slot, err = uring.write(ring, fd, data, offset=0, length=#data-offset)
+**
+** 'data' can be string/buffer/reader/chain, it's copied thus can be freely changed after the call.
+** At most RING_MAX_WRITE bytes are taken, the result tells how many are written.
+*/
+static int luring_write(lua_State *L)
+{
+	union {
+		const Buffer *buffer;
+		const Reader *reader;
+	}ptr;
+	Ring *ring = ring_lcheck(L, 1);
+	int fd = (int)luaL_checkinteger(L, 2);
+	const uint8 *data = NULL;
+	size_t datasiz = 0;
+	size_t offset, length;
+	struct io_uring_sqe *sqe;
+	int idx;
+	Chain *chain = NULL;
+
+	if (lua_type(L, 3) == LUA_TSTRING) {
+		data = (const uint8*)lua_tolstring(L, 3, &datasiz);
+	} else {
+		ptr.buffer = (const Buffer*)lua_touserdata(L, 3);
+		if (ptr.buffer != NULL) {
+			if (ptr.buffer->magic == BUFFER_MAGIC) {
+				data = ptr.buffer->data;
+				datasiz = ptr.buffer->datasiz;
+			} else if (ptr.reader->magic == READER_MAGIC) {
+				data = ptr.reader->data;
+				datasiz = ptr.reader->datasiz;
+			} else if ((chain = chain_test(L, 3)) != NULL) {
+				datasiz = chain->datasiz;
+			}
+		}
+		if (data == NULL && chain == NULL)
+			luaL_error(L, "expecting string/buffer/reader/chain for argument 3");
+	}
+
+	offset = (size_t)luaL_optinteger(L, 4, 0);
+	if (offset > datasiz)
+		offset = datasiz;
+	length = (size_t)luaL_optinteger(L, 5, (lua_Integer)(datasiz - offset));
+	if (length > datasiz - offset)
+		length = datasiz - offset;
+	if (length == 0)
+		luaL_error(L, "writing 0 bytes is meaningless");
+	if (length > RING_MAX_WRITE)
+		length = RING_MAX_WRITE;
+
+	idx = ring_prepare(ring, length, &sqe);
+	if (idx >= 0) {
+		Slot *slot = ring->slots[idx];
+		if (chain != NULL)
+			chain_copy(chain, offset, length, slot->mem);
+		else
+			memcpy(slot->mem, data + offset, length);
+		slot->len = length;
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)slot->mem;
+		sqe->len = (unsigned)length;
+		sqe->off = (uint64_t)-1;
+	}
+	return push_slot(L, idx);
+}
+
+/*
+** err = uring.rewrite(ring, slot, fd)
+**
+** Write the rest of a completed short write with the same slot, the result is
+** the number of bytes written by this call.
+*/
+static int luring_rewrite(lua_State *L)
+{
+	Ring *ring = ring_lcheck(L, 1);
+	int idx;
+	Slot *slot = slot_lcheck(L, ring, 2, &idx);
+	int fd = (int)luaL_checkinteger(L, 3);
+	struct io_uring_sqe *sqe;
+
+	if (slot->res < 0 || slot->off + (size_t)slot->res >= slot->len)
+		luaL_error(L, "nothing left to write in slot %d", idx + 1);
+
+	sqe = ring_getsqe(ring);
+	if (sqe == NULL) {
+		lua_pushinteger(L, EBUSY);
+		return 1;
+	}
+
+	slot->off += (size_t)slot->res;
+	slot->res = 0;
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)(slot->mem + slot->off);
+	sqe->len = (unsigned)(slot->len - slot->off);
+	sqe->off = (uint64_t)-1;
+	sqe->user_data = (uint64_t)(idx + 1);
+	lua_pushinteger(L, 0);
+	return 1;
+}
+
+/*
+** slot, err = uring.accept(ring, fd)
+**
+** The result is the accepted file descriptor(with FD_CLOEXEC set).
+*/
+static int luring_accept(lua_State *L)
+{
+	Ring *ring = ring_lcheck(L, 1);
+	int fd = (int)luaL_checkinteger(L, 2);
+	struct io_uring_sqe *sqe;
+	int idx = ring_prepare(ring, 0, &sqe);
+
+	if (idx >= 0) {
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = fd;
+		sqe->accept_flags = SOCK_CLOEXEC;
+	}
+	return push_slot(L, idx);
+}
+
+/*
+** slot, err = uring.connect(ring, fd, addr, port)
+*/
+static int luring_connect(lua_State *L)
+{
+	Ring *ring = ring_lcheck(L, 1);
+	int fd = (int)luaL_checkinteger(L, 2);
+	const char *addr = luaL_checkstring(L, 3);
+	int port = (int)luaL_optinteger(L, 4, 0);
+	struct sockaddr_storage sa;
+	size_t salen = sizeof(sa);
+	struct io_uring_sqe *sqe;
+	int idx;
+
+	if (!socket_buildaddr(addr, port, &sa, &salen)) {
+		lua_pushnil(L);
+		lua_pushinteger(L, EFAULT);
+		return 2;
+	}
+
+	idx = ring_prepare(ring, 0, &sqe);
+	if (idx >= 0) {
+		Slot *slot = ring->slots[idx];
+		memcpy(&slot->sa, &sa, salen);
+		sqe->opcode = IORING_OP_CONNECT;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)&slot->sa;
+		sqe->off = (uint64_t)salen;
+	}
+	return push_slot(L, idx);
+}
+
+/*
+** slot, err = uring.poll(ring, fd, events)
+**
+** One-shot, the result is the returned events.
+*/
+static int luring_poll(lua_State *L)
+{
+	Ring *ring = ring_lcheck(L, 1);
+	int fd = (int)luaL_checkinteger(L, 2);
+	unsigned events = (unsigned)luaL_checkinteger(L, 3);
+	struct io_uring_sqe *sqe;
+	int idx = ring_prepare(ring, 0, &sqe);
+
+	if (idx >= 0) {
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		sqe->poll32_events = events;
+	}
+	return push_slot(L, idx);
+}
+
+/*
+** err = uring.cancel(ring, slot)
+**
+** The canceled operation still completes(usually with -ECANCELED), the slot
+** must be released as usual.
+*/
+static int luring_cancel(lua_State *L)
+{
+	Ring *ring = ring_lcheck(L, 1);
+	int target;
+	struct io_uring_sqe *sqe;
+
+	slot_lcheck(L, ring, 2, &target);
+	sqe = ring_getsqe(ring);
+	if (sqe == NULL) {
+		lua_pushinteger(L, EBUSY);
+	} else {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uint64_t)(target + 1);
+		sqe->user_data = 0;
+		lua_pushinteger(L, 0);
+	}
+	return 1;
+}
+
+/*
+** err = uring.submit(ring)
+**
+** Submit the prepared operations now instead of at the next 'wait', e.g. a
+** cancel that must reach the kernel before the fd is closed(and reused).
+*/
+static int luring_submit(lua_State *L)
+{
+	Ring *ring = ring_lcheck(L, 1);
+	lua_pushinteger(L, ring->to_submit > 0 ? ring_submit(ring, 0, NULL) : 0);
+	return 1;
+}
+
+/*
+** completions, err = uring.wait(ring, sec=-1)
+**
+** Submit all the prepared operations and wait at most 'sec' seconds for completions.
+** Return a table of {[slot] = res}, 'res' is the result of the operation(bytes
+** transferred, the accepted fd ...), or -errno if failed.
+** Return nil followed by an errno(ETIME, EINTR ...) if nothing completed.
+*/
+static int luring_wait(lua_State *L)
+{
+	Ring *ring = ring_lcheck(L, 1);
+	lua_Number sec = luaL_optnumber(L, 2, -1);
+	struct __kernel_timespec ts;
+	unsigned head, tail;
+	int err = 0, n = 0;
+
+	head = *ring->cq_head;
+	tail = load_acquire(ring->cq_tail);
+	if (head == tail || ring->to_submit > 0) {
+		if (head != tail || sec == 0) {
+			err = ring_submit(ring, 0, NULL);
+		} else if (sec > 0) {
+			ts.tv_sec = (long long)sec;
+			ts.tv_nsec = (long long)((sec - (lua_Number)ts.tv_sec) * 1000000000);
+			err = ring_submit(ring, 1, &ts);
+		} else {
+			err = ring_submit(ring, 1, NULL);
+		}
+		tail = load_acquire(ring->cq_tail);
+	}
+
+	lua_createtable(L, 0, (int)(tail - head));
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		int idx = (int)cqe->user_data - 1;
+		if (idx >= 0 && idx < ring->nslots && ring->slots[idx]->busy) {
+			ring->slots[idx]->res = cqe->res;
+			lua_pushinteger(L, cqe->res);
+			lua_rawseti(L, -2, idx + 1);
+			n++;
+		}
+		head++;
+	}
+	store_release(ring->cq_head, head);
+
+	if (n == 0) {
+		lua_pushnil(L);
+		lua_pushinteger(L, err != 0 ? err : ETIME);
+	} else {
+		lua_pushinteger(L, 0);
+	}
+	return 2;
+}
+
+/*
+** nread = uring.fetch(ring, slot, buffer)
+**
+** Append the data of a completed read into 'buffer' and release the slot.
+*/
+static int luring_fetch(lua_State *L)
+{
+	Ring *ring = ring_lcheck(L, 1);
+	Buffer *buffer = buffer_lcheck(L, 3);
+	int idx;
+	Slot *slot = slot_lcheck(L, ring, 2, &idx);
+	size_t nread = slot->res > 0 ? (size_t)slot->res : 0;
+
+	if (nread > 0)
+		buffer_push(buffer, slot->mem, nread);
+	ring_putslot(ring, idx);
+	lua_pushinteger(L, (lua_Integer)nread);
+	return 1;
+}
+
+/*
+** uring.release(ring, slot)
+**
+** Release the slot of a completed operation.
+*/
+static int luring_release(lua_State *L)
+{
+	Ring *ring = ring_lcheck(L, 1);
+	int idx;
+	slot_lcheck(L, ring, 2, &idx);
+	ring_putslot(ring, idx);
+	return 0;
+}
+
+static const luaL_Reg funcs[] = {
+	{"create", luring_create},
+	{"destroy", luring_destroy},
+	{"fd", luring_fd},
+	{"read", luring_read},
+	{"write", luring_write},
+	{"rewrite", luring_rewrite},
+	{"accept", luring_accept},
+	{"connect", luring_connect},
+	{"poll", luring_poll},
+	{"cancel", luring_cancel},
+	{"submit", luring_submit},
+	{"wait", luring_wait},
+	{"fetch", luring_fetch},
+	{"release", luring_release},
+	{NULL, NULL}
+};
+
+static const luaL_Reg ring_methods[] = {
+	{"__gc", luring_destroy},
+	{"destroy", luring_destroy},
+	{"fd", luring_fd},
+	{"read", luring_read},
+	{"write", luring_write},
+	{"rewrite", luring_rewrite},
+	{"accept", luring_accept},
+	{"connect", luring_connect},
+	{"poll", luring_poll},
+	{"cancel", luring_cancel},
+	{"submit", luring_submit},
+	{"wait", luring_wait},
+	{"fetch", luring_fetch},
+	{"release", luring_release},
+	{NULL, NULL}
+};
+
+#else
+
+/*
+** ring, err = uring.create(entries)
+*/
+static int luring_create(lua_State *L)
+{
+	lua_pushnil(L);
+	lua_pushinteger(L, ENOSYS);
+	return 2;
+}
+
+static const luaL_Reg funcs[] = {
+	{"create", luring_create},
+	{NULL, NULL}
+};
+
+static const luaL_Reg ring_methods[] = {
+	{NULL, NULL}
+};
+
+#endif /* HAVE_IO_URING */
+
+static const EnumReg enums[] = {
+	{"MAX_WRITE", RING_MAX_WRITE},
+	LENUM_NULL
+};
+
+int l_openuring(lua_State *L)
+{
+	l_register_lib(L, "uring", funcs, enums);
+	l_register_metatable2(L, RING_META, ring_methods);
+	return 0;
+}
@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) spyder
+ */
+
+/*
+** fs.walk: a recursive directory walker for directories of a huge number of
+** files.
+**
+** Entries are read by getdents64 into a large buffer, their d_type tells the
+** directories from the others without stat, and fstatat is done relative to
+** the directory fd only when asked to. A directory is read through before
+** the walker goes into its sub directories, so only one is open at a time.
+**
+** Entries are produced in batches by walker_fill, which touches no lua_State
+** and can run on an offload worker(see loffload.c). The lua side picks them
+** out of the filled batch by walker:next().
+*/
+
+#include "lstdimpl.h"
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define WALKER_META 			"meta(fs.walker)"
+
+#define WALK_DENTS_SIZE 		65536
+#define WALK_BATCH 				1024
+
+/* what getdents64 fills the buffer with */
+struct dirent64_t {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+typedef struct _WalkEntry {
+	size_t path;			/* offset in Walker.paths */
+	size_t pathlen;
+	int type;				/* DT_XXX */
+	int64 size;
+	int64 mtime;
+}WalkEntry;
+
+typedef struct _WalkDir {
+	char *path;				/* ended with '/' */
+	int depth;
+}WalkDir;
+
+struct _Walker {
+	uint32 refs;			/* the lua userdata and the offload job using it */
+	bool busy;				/* being filled by an offload worker */
+	bool stat;
+	int maxdepth;
+	size_t batch;
+
+	/* the directory being read */
+	int fd;
+	char *dirpath;
+	size_t dirpathlen;
+	int depth;
+	uint8 *dents;
+	size_t dentspos;
+	size_t dentslen;
+
+	/* the directories to be read */
+	WalkDir *pending;
+	size_t npending;
+	size_t cappending;
+
+	/* the batch */
+	WalkEntry *entries;
+	size_t nentries;
+	size_t next;
+	char *paths;
+	size_t pathssiz;
+	size_t cappaths;
+};
+
+static char* walker_strdup(const char *str, size_t len)
+{
+	char *p = (char*)MALLOC(len + 1);
+	memcpy(p, str, len);
+	p[len] = 0;
+	return p;
+}
+
+static void walker_push(Walker *w, const char *path, size_t len, int depth)
+{
+	WalkDir *dir;
+
+	if (w->npending == w->cappending) {
+		w->cappending = w->cappending > 0 ? w->cappending * 2 : 64;
+		w->pending = (WalkDir*)REALLOC(w->pending, w->cappending * sizeof(WalkDir));
+	}
+
+	dir = &w->pending[w->npending++];
+	dir->path = (char*)MALLOC(len + 2);
+	memcpy(dir->path, path, len);
+	dir->path[len] = '/';
+	dir->path[len + 1] = 0;
+	dir->depth = depth;
+}
+
+static void walker_closedir(Walker *w)
+{
+	if (w->fd >= 0) {
+		close(w->fd);
+		w->fd = -1;
+	}
+	if (w->dirpath != NULL) {
+		FREE(w->dirpath);
+		w->dirpath = NULL;
+	}
+}
+
+/* open the next pending directory, false if there is none */
+static bool walker_nextdir(Walker *w)
+{
+	while (w->npending > 0) {
+		WalkDir *dir = &w->pending[--w->npending];
+
+		/* a directory removed or not permitted is skipped */
+		w->fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (w->fd < 0) {
+			FREE(dir->path);
+			continue;
+		}
+		w->dirpath = dir->path;
+		w->dirpathlen = strlen(dir->path);
+		w->depth = dir->depth;
+		w->dentspos = w->dentslen = 0;
+		return true;
+	}
+	return false;
+}
+
+static WalkEntry* walker_add(Walker *w, const char *name, size_t namelen)
+{
+	size_t pathlen = w->dirpathlen + namelen;
+	WalkEntry *entry = &w->entries[w->nentries++];
+
+	if (w->pathssiz + pathlen > w->cappaths) {
+		while (w->pathssiz + pathlen > w->cappaths)
+			w->cappaths = w->cappaths > 0 ? w->cappaths * 2 : 65536;
+		w->paths = (char*)REALLOC(w->paths, w->cappaths);
+	}
+	memcpy(w->paths + w->pathssiz, w->dirpath, w->dirpathlen);
+	memcpy(w->paths + w->pathssiz + w->dirpathlen, name, namelen);
+
+	entry->path = w->pathssiz;
+	entry->pathlen = pathlen;
+	entry->type = DT_UNKNOWN;
+	entry->size = -1;
+	entry->mtime = -1;
+	w->pathssiz += pathlen;
+	return entry;
+}
+
+/*
+** read the next batch of entries, discarding the previous one.
+**
+** return the number of entries read, 0 if the walk is done.
+*/
+size_t walker_fill(Walker *w)
+{
+	w->nentries = w->next = 0;
+	w->pathssiz = 0;
+
+	while (w->nentries < w->batch) {
+		struct dirent64_t *d;
+		const char *name;
+		size_t namelen;
+		WalkEntry *entry;
+		struct stat st;
+		bool statted = false;
+		int type;
+
+		if (w->fd < 0 && !walker_nextdir(w))
+			break;
+
+		if (w->dentspos >= w->dentslen) {
+			long nread = syscall(SYS_getdents64, w->fd, w->dents, WALK_DENTS_SIZE);
+			if (nread <= 0) {
+				if (nread < 0 && errno == EINTR)
+					continue;
+				walker_closedir(w);
+				continue;
+			}
+			w->dentspos = 0;
+			w->dentslen = (size_t)nread;
+		}
+
+		d = (struct dirent64_t*)(w->dents + w->dentspos);
+		w->dentspos += d->d_reclen;
+		name = d->d_name;
+		if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+			continue;
+
+		/* not every file system fills d_type */
+		type = d->d_type;
+		if (w->stat || type == DT_UNKNOWN) {
+			if (fstatat(w->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+				type = IFTODT(st.st_mode);
+				statted = true;
+			} else if (errno == ENOENT) {
+				continue;
+			}
+		}
+
+		namelen = strlen(name);
+		entry = walker_add(w, name, namelen);
+		entry->type = type;
+		if (w->stat && statted) {
+			entry->size = (int64)st.st_size;
+			entry->mtime = (int64)st.st_mtime;
+		}
+
+		if (type == DT_DIR && (w->maxdepth < 0 || w->depth < w->maxdepth))
+			walker_push(w, w->paths + entry->path, entry->pathlen, w->depth + 1);
+	}
+
+	return w->nentries;
+}
+
+static void walker_close(Walker *w)
+{
+	walker_closedir(w);
+	while (w->npending > 0)
+		FREE(w->pending[--w->npending].path);
+	w->nentries = w->next = 0;
+}
+
+static Walker* walker_lcheck(lua_State *L, int idx)
+{
+	Walker *w = *(Walker**)luaL_checkudata(L, idx, WALKER_META);
+	if (w == NULL)
+		luaL_error(L, "the walker is released");
+	if (w->busy)
+		luaL_error(L, "the walker is being filled by offload");
+	return w;
+}
+
+/* taken by an offload job, see walker_release */
+Walker* walker_acquire(lua_State *L, int idx)
+{
+	Walker *w = walker_lcheck(L, idx);
+	w->refs++;
+	w->busy = true;
+	return w;
+}
+
+void walker_release(Walker *w)
+{
+	w->busy = false;
+	if (--w->refs == 0) {
+		walker_close(w);
+		FREE(w->pending);
+		FREE(w->entries);
+		FREE(w->paths);
+		FREE(w->dents);
+		FREE(w);
+	}
+}
+
+/******************************************************************************
+	lua-walker
+******************************************************************************/
+
+/*
+** walker, err = fs.walk(root, opts=nil)
+**
+** opts.stat    also fstatat each entry for its size and mtime, defaulted to false
+** opts.depth   the maximum depth to go into, the entries of 'root' are of depth 1,
+**              defaulted to unlimited
+** opts.batch   the number of entries read by each walker:fill(), defaulted to 1024
+**
+** sub directories failing to be opened are skipped, symbolic links are never followed.
+**
+** SAMPLE:
+**	local w = fs.walk('/var/cache', {stat = true})
+**	while w:fill() > 0 do   -- or tasklet.offload('walk', w) not to block the loop
+**		for path, type, size, mtime in w.next, w do
+**			...
+**		end
+**	end
+*/
+static int lfs_walk(lua_State *L)
+{
+	size_t rootlen;
+	const char *root = luaL_checklstring(L, 1, &rootlen);
+	bool dostat = false;
+	int maxdepth = -1;
+	size_t batch = WALK_BATCH;
+	Walker **pw;
+	Walker *w;
+	int fd;
+
+	if (!lua_isnoneornil(L, 2)) {
+		luaL_checktype(L, 2, LUA_TTABLE);
+		lua_getfield(L, 2, "stat");
+		dostat = lua_toboolean(L, -1);
+		lua_getfield(L, 2, "depth");
+		maxdepth = (int)luaL_optinteger(L, -1, -1);
+		lua_getfield(L, 2, "batch");
+		batch = (size_t)luaL_optinteger(L, -1, WALK_BATCH);
+		lua_pop(L, 3);
+		luaL_argcheck(L, batch > 0, 2, "batch must be positive");
+	}
+
+	fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		lua_pushnil(L);
+		lua_pushinteger(L, errno);
+		return 2;
+	}
+
+	pw = (Walker**)lua_newuserdata(L, sizeof(Walker*));
+	w = (Walker*)MALLOC(sizeof(Walker));
+	memset(w, 0, sizeof(Walker));
+	*pw = w;
+	l_setmetatable(L, -1, WALKER_META);
+
+	w->refs = 1;
+	w->stat = dostat;
+	w->maxdepth = maxdepth;
+	w->batch = batch;
+	w->entries = (WalkEntry*)MALLOC(batch * sizeof(WalkEntry));
+	w->dents = (uint8*)MALLOC(WALK_DENTS_SIZE);
+
+	while (rootlen > 1 && root[rootlen - 1] == '/')
+		rootlen--;
+	w->fd = fd;
+	w->depth = 1;
+	if (rootlen == 1 && root[0] == '/') {
+		w->dirpath = walker_strdup("/", 1);
+	} else {
+		w->dirpath = (char*)MALLOC(rootlen + 2);
+		memcpy(w->dirpath, root, rootlen);
+		w->dirpath[rootlen] = '/';
+		w->dirpath[rootlen + 1] = 0;
+	}
+	w->dirpathlen = strlen(w->dirpath);
+
+	lua_pushinteger(L, 0);
+	return 2;
+}
+
+/*
+** n = walker:fill()
+**
+** read the next batch of entries, 0 if the walk is done.
+*/
+static int lwalker_fill(lua_State *L)
+{
+	lua_pushinteger(L, (lua_Integer)walker_fill(walker_lcheck(L, 1)));
+	return 1;
+}
+
+/*
+** path, type, size, mtime = walker:next()
+**
+** the next entry of the batch read by the last fill, nil if all are picked.
+**
+** 'type' is fs.DT_XXX, 'size' and 'mtime' are -1 unless opts.stat is set.
+*/
+static int lwalker_next(lua_State *L)
+{
+	Walker *w = walker_lcheck(L, 1);
+	WalkEntry *entry;
+
+	if (w->next >= w->nentries)
+		return 0;
+
+	entry = &w->entries[w->next++];
+	lua_pushlstring(L, w->paths + entry->path, entry->pathlen);
+	lua_pushinteger(L, entry->type);
+	lua_pushinteger(L, (lua_Integer)entry->size);
+	lua_pushinteger(L, (lua_Integer)entry->mtime);
+	return 4;
+}
+
+/*
+** walker:close()
+**
+** stop walking and close the directory being read.
+*/
+static int lwalker_close(lua_State *L)
+{
+	walker_close(walker_lcheck(L, 1));
+	return 0;
+}
+
+static int lwalker_gc(lua_State *L)
+{
+	Walker **pw = (Walker**)luaL_checkudata(L, 1, WALKER_META);
+	if (*pw != NULL) {
+		walker_release(*pw);
+		*pw = NULL;
+	}
+	return 0;
+}
+
+static const luaL_Reg walker_methods[] = {
+	{"fill", lwalker_fill},
+	{"next", lwalker_next},
+	{"close", lwalker_close},
+	{"__gc", lwalker_gc},
+	{NULL, NULL}
+};
+
+static const luaL_Reg funcs[] = {
+	{"walk", lfs_walk},
+	{NULL, NULL}
+};
+
+static const EnumReg enums[] = {
+	LENUM(DT_UNKNOWN),
+	LENUM(DT_REG),
+	LENUM(DT_DIR),
+	LENUM(DT_LNK),
+	LENUM(DT_CHR),
+	LENUM(DT_BLK),
+	LENUM(DT_FIFO),
+	LENUM(DT_SOCK),
+	LENUM_NULL
+};
+
+int l_openwalk(lua_State *L)
+{
+	l_register_metatable2(L, WALKER_META, walker_methods);
+	l_register_lib(L, "fs", funcs, enums);
+	return 0;
+}
@@ -19,6 +19,7 @@ app.run({d=true}, function ()
 		doc_root = fs.getcwd() .. '/',
 		doc_pattern = '/static/(.+)',
 		follow_link = true,
+		metrics_path = '/metrics',
 		handler = function (req)
 			local path = req.urlinfo.path:match('^/([^/]*)')
 			if path == 'plaintext' then
@@ -0,0 +1,141 @@
+--[[
+Conditional and partial GETs of static files: ETag/If-None-Match,
+If-Modified-Since, Range/If-Range.
+Dates are GMT whatever TZ is, e.g. run with TZ=Asia/Shanghai.
+
+arg[1]  settings.etag, defaulted to nil(inode+mtime+size)
+]]
+
+local tasklet = require 'tasklet'
+local http = require 'httpd'
+local log = require 'log'
+
+local ETAG_MODE = arg[1]
+
+local DOC_ROOT = '/tmp/lask-static-' .. os.getpid() .. '/'
+local SIZE = 100000
+
+fs.mkdir(DOC_ROOT)
+local content = {}
+for i = 1, SIZE do
+	content[i] = string.char(i % 251)
+end
+content = table.concat(content)
+file_put_content(DOC_ROOT .. 'fw.bin', content)
+
+-- send a request and return status, headers, body
+local function get(ch, path, headers)
+	local buf = buffer.new():putstr('GET ', path, ' HTTP/1.1\r\nHost: 127.0.0.1\r\n')
+	for k, v in pairs(headers or {}) do
+		buf:putstr(k, ': ', v, '\r\n')
+	end
+	assert(ch:write(buf:putstr('\r\n')) == 0)
+
+	local status = tonumber(ch:read():match('^HTTP/1.1 (%d+)'))
+	local resp_headers = {}
+	while true do
+		local line = assert(ch:read())
+		if line == '' then
+			break
+		end
+		local k, v = line:match('^([^:]+):%s*(.*)$')
+		resp_headers[k:lower()] = v
+	end
+
+	local body = buffer.new()
+	local left = status ~= 304 and tonumber(resp_headers['content-length']) or 0
+	while left > 0 do
+		local rd, err = ch:read(left)
+		assert(err == 0, errno.strerror(err))
+		left = left - #rd
+		body:putreader(rd)
+	end
+	return status, resp_headers, body:str()
+end
+
+log.init({level = 'warn'})
+local server = http.start_server({
+	addr = '127.0.0.1',
+	port = 0,
+	doc_root = DOC_ROOT,
+	doc_pattern = '^/static/(.*)',
+	etag = ETAG_MODE,
+})
+local addr, port = socket.getsockname(server.ch_fd)
+
+tasklet.start_task(function ()
+	local ch = tasklet.stream_channel.new()
+	assert(ch:connect(addr, port) == 0)
+
+	local status, headers, body = get(ch, '/static/fw.bin')
+	assert(status == 200 and body == content)
+	assert(headers['accept-ranges'] == 'bytes')
+	local etag, last_modified = headers['etag'], headers['last-modified']
+	assert(etag and last_modified)
+	print('ETag: ' .. etag)
+	assert(last_modified == time.strftime('%a, %d %b %Y %H:%M:%S GMT', fs.stat(DOC_ROOT .. 'fw.bin').mtime, true))
+	if ETAG_MODE == 'hash' then
+		assert(etag == '"' .. hash.sum('xxh64', content) .. '"')
+	end
+
+	-- revalidation
+	status = get(ch, '/static/fw.bin', {['If-None-Match'] = '"nomatch", ' .. etag})
+	assert(status == 304)
+	status = get(ch, '/static/fw.bin', {['If-None-Match'] = '"nomatch"', ['If-Modified-Since'] = last_modified})
+	assert(status == 200, 'If-None-Match takes precedence')
+	status = get(ch, '/static/fw.bin', {['If-Modified-Since'] = last_modified})
+	assert(status == 304, status)
+
+	-- ranges
+	status, headers, body = get(ch, '/static/fw.bin', {['Range'] = 'bytes=1000-1999'})
+	assert(status == 206 and body == content:sub(1001, 2000))
+	assert(headers['content-range'] == 'bytes 1000-1999/' .. SIZE)
+	status, headers, body = get(ch, '/static/fw.bin', {['Range'] = 'bytes=99000-'})
+	assert(status == 206 and body == content:sub(99001))
+	status, headers, body = get(ch, '/static/fw.bin', {['Range'] = 'bytes=-10'})
+	assert(status == 206 and body == content:sub(-10))
+	status, headers, body = get(ch, '/static/fw.bin', {['Range'] = 'bytes=0-0,5-6'})
+	assert(status == 200 and #body == SIZE, 'multiple ranges are ignored')
+	status, headers = get(ch, '/static/fw.bin', {['Range'] = 'bytes=' .. SIZE .. '-'})
+	assert(status == 416 and headers['content-range'] == 'bytes */' .. SIZE, status .. ' ' .. tostring(headers['content-range']))
+
+	-- resuming with a validator
+	status, headers, body = get(ch, '/static/fw.bin', {['Range'] = 'bytes=50000-', ['If-Range'] = last_modified})
+	assert(status == 206 and body == content:sub(50001))
+	status, headers, body = get(ch, '/static/fw.bin', {['Range'] = 'bytes=50000-', ['If-Range'] = '"changed"'})
+	assert(status == 200 and body == content)
+	if not etag:find('^W/') then
+		status, headers, body = get(ch, '/static/fw.bin', {['Range'] = 'bytes=50000-', ['If-Range'] = etag})
+		assert(status == 206 and body == content:sub(50001))
+	end
+
+	-- requests for a file being hashed wait for the same hash
+	if ETAG_MODE == 'hash' then
+		file_put_content(DOC_ROOT .. 'fw2.bin', content:reverse())
+		local etags = {}
+		for i = 1, 3 do
+			tasklet.start_task(function ()
+				local ch = tasklet.stream_channel.new()
+				assert(ch:connect(addr, port) == 0)
+				local status, headers, body = get(ch, '/static/fw2.bin')
+				assert(status == 200 and body == content:reverse())
+				etags[i] = headers['etag']
+				ch:close()
+			end)
+		end
+		while not etags[3] do
+			tasklet.sleep(0.01)
+		end
+		local expected = '"' .. hash.sum('xxh64', content:reverse()) .. '"'
+		assert(etags[1] == expected and etags[2] == expected and etags[3] == expected)
+		os.remove(DOC_ROOT .. 'fw2.bin')
+	end
+
+	ch:close()
+	os.remove(DOC_ROOT .. 'fw.bin')
+	fs.rmdir(DOC_ROOT)
+	print('ok')
+	os.exit(0)
+end)
+
+tasklet.loop()
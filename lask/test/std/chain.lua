@@ -0,0 +1,133 @@
+--[[
+buffer.chain: append/prepend/split/shift across the page boundaries, sharing
+pages with slices and readers, and writing a chain by os.writeb/stream_channel.
+]]
+
+local tasklet = require 'tasklet'
+require 'tasklet.channel.stream'
+
+local PAGESIZ = 64
+
+-- a chain and the string it should hold, changed side by side
+local ch = buffer.chain(PAGESIZ)
+local expected = ''
+
+local function check()
+	assert(#ch == #expected, #ch .. ' ~= ' .. #expected)
+	assert(ch:str() == expected)
+	local parts = {}
+	for rd in ch:segments() do
+		assert(#rd > 0 and #rd <= PAGESIZ)
+		parts[#parts + 1] = rd:str()
+	end
+	assert(table.concat(parts) == expected)
+end
+
+for i = 1, 50 do
+	local s = string.rep(string.char(64 + i % 26), i * 3)
+	ch:putstr(s, i)
+	expected = expected .. s .. i
+	if i % 5 == 0 then
+		ch:prepend('<' .. i .. '>')
+		expected = '<' .. i .. '>' .. expected
+	end
+	if i % 7 == 0 then
+		ch:shift(i)
+		expected = expected:sub(i + 1)
+	end
+	check()
+end
+
+assert(ch:str(100, 50) == expected:sub(101, 150))
+assert(ch:str(#expected) == '' and ch:str(#expected - 1, 100) == expected:sub(-1))
+
+-- split shares the boundary page, and either part can grow afterwards
+local head = ch:split(1000)
+assert(head:str() == expected:sub(1, 1000))
+expected = expected:sub(1001)
+check()
+head:putstr('H')
+head:prepend('h')
+ch:putstr('T')
+ch:prepend('t')
+expected = 't' .. expected .. 'T'
+check()
+assert(#head == 1002 and head:str():find('^h') and head:str():find('H$'))
+
+-- a reader of a page stays valid whatever is done to the chain
+local pinned = {}
+for rd in ch:segments() do
+	pinned[#pinned + 1] = {rd, rd:str()}
+end
+ch:shift(#ch // 2):prepend(string.rep('p', 200)):putstr(string.rep('a', 200))
+head:reset()
+collectgarbage()
+for _, v in ipairs(pinned) do
+	assert(v[1]:str() == v[2])
+end
+
+-- readers reused by segments(rd)
+local parts = {}
+local rd = string.reader('')
+for r in ch:segments(rd) do
+	assert(r == rd)
+	parts[#parts + 1] = r:str()
+end
+assert(table.concat(parts) == ch:str())
+
+-- buffers, slices and chains put into a chain
+local big = string.rep('0123456789', 100)
+local buf = buffer.new():putstr(big, big)
+local other = buffer.chain(PAGESIZ)
+other:putreader(buf, 10, 20)
+other:putreader(buf:slice(#big))
+other:putreader(buf:reader())
+other:putreader(ch, 5, 300)
+other:prepend(buf, 0, 10)
+other:prepend(string.reader('xyz'))
+buf:rewind():putstr(string.rep('-', #big * 2))
+assert(other:str() == 'xyz' .. big:sub(1, 10) .. big:sub(11, 30) .. big .. big .. ch:str(5, 300))
+assert(buffer.new():putreader(other, 3, 10):str() == big:sub(1, 10))
+assert(not pcall(other.putreader, other, other))
+
+-- a few MB written through a pipe by stream_channel:write(os.writeb)
+local NUM_PIECES = 5000
+local body = buffer.chain()
+local sum = 0
+for i = 1, NUM_PIECES do
+	local s = string.format('%07d', i) .. string.rep('.', i % 1000)
+	body:putstr(s)
+	sum = sum + #s
+end
+assert(#body == sum)
+
+local rdfd, wrfd = os.pipe()
+local wch = tasklet.stream_channel.new(wrfd)
+local rch = tasklet.stream_channel.new(rdfd, 65536)
+
+tasklet.start_task(function ()
+	assert(wch:write(body) == 0)
+	wch:close()
+end)
+
+tasklet.start_task(function ()
+	local got = buffer.new()
+	while true do
+		local rd, err = rch:read(65536)
+		if not rd or #rd == 0 then
+			break
+		end
+		got:putreader(rd)
+	end
+	assert(#got == #body and got:str() == body:str())
+	print('ok')
+	os.exit(0)
+end)
+
+tasklet.start_task(function ()
+	tasklet.sleep(10)
+	print('timeout')
+	os.exit(1)
+end)
+
+tasklet.loop()
@@ -0,0 +1,59 @@
+--[[
+Known digests of the hash module, with and without the CPU instructions,
+updated in one go and in pieces of growing sizes.
+]]
+
+require 'std'
+
+local VECTORS = {
+	{'md5', '', 'd41d8cd98f00b204e9800998ecf8427e'},
+	{'md5', 'abc', '900150983cd24fb0d6963f7d28e17f72'},
+	{'sha1', '', 'da39a3ee5e6b4b0d3255bfef95601890afd80709'},
+	{'sha1', 'abc', 'a9993e364706816aba3e25717850c26c9cd0d89d'},
+	{'sha256', '', 'e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855'},
+	{'sha256', 'abc', 'ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad'},
+	{'crc32c', '123456789', 'e3069283'},
+	{'xxh64', '', 'ef46db3751d8e999'},
+	{'xxh64', 'abc', '44bc2cf5ad770999'},
+	{'xxh64', 'Nobody inspects the spammish repetition', 'fbcea83c8a378bf1'},
+}
+
+-- crosses the block(64 bytes) and stripe(32 bytes) boundaries in every way
+local LONG = string.rep('0123456789abcdefghijklmnopqrstuvwxyz', 100)
+
+print('accelerated:', hash.accelerated())
+
+local expected = {}
+for _, accel in ipairs({true, false}) do
+	hash.accel(accel)
+
+	for _, v in ipairs(VECTORS) do
+		local alg, msg, digest = v[1], v[2], v[3]
+		assert(hash.sum(alg, msg) == digest, alg .. '(' .. msg .. ')')
+		assert(hash.new(alg):update(msg):digest() == digest)
+	end
+
+	for _, alg in ipairs({'md5', 'sha1', 'sha256', 'crc32c', 'xxh64'}) do
+		local h = hash.new(alg)
+		local i, step = 1, 1
+		while i <= #LONG do
+			h:update(LONG:sub(i, i + step - 1))
+			i = i + step
+			step = step + 1
+		end
+		assert(h:size() == #LONG)
+
+		local buf = buffer.new():putstr(LONG)
+		local digest = h:digest()
+		assert(digest == hash.sum(alg, buf))
+		assert(digest == hash.sum(alg, buf:reader()))
+		assert(#hash.sum(alg, buf, true) * 2 == #digest)
+
+		-- the same with or without the CPU instructions
+		expected[alg] = expected[alg] or digest
+		assert(expected[alg] == digest, alg)
+		print(alg, digest)
+	end
+end
+assert(hash.sum('md5', LONG) == md5(LONG))
+print('ok')
@@ -0,0 +1,78 @@
+--[[
+fs.mmap: mapped files consumed as readers by os.writeb, hash, zlib, cjson
+and chains, at offsets not aligned to pages.
+]]
+
+require 'std'
+local cjson = require 'cjson'
+local zlib = require 'zlib'
+
+local PATH = '/tmp/lask-mmap-' .. os.getpid()
+
+local lines = {}
+for i = 1, 20000 do
+	lines[i] = string.format('line %d %s', i, string.rep('x', i % 50))
+end
+local content = table.concat(lines, '\n') .. '\n'
+assert(file_put_content(PATH, content) == 0)
+
+-- whole file, by path or fd
+local rd, err = fs.mmap(PATH)
+assert(err == 0 and #rd == #content and rd:str() == content)
+local fd = os.open(PATH, os.O_RDONLY)
+local rd2 = fs.mmap(fd, 0, nil, fs.MADV_RANDOM)
+os.close(fd)
+assert(rd2:str() == content)
+
+-- ranges, clamped to the end of the file
+for _, range in ipairs({{1, 100}, {4095, 2}, {4096, 4096}, {12345, 100000}, {#content - 1, 10}}) do
+	local offset, length = range[1], range[2]
+	local part = fs.mmap(PATH, offset, length)
+	assert(part:str() == content:sub(offset + 1, offset + length), offset)
+end
+assert(#fs.mmap(PATH, #content) == 0 and #fs.mmap(PATH, #content + 100) == 0)
+
+-- errors
+local none, e = fs.mmap('/nonexistent/file')
+assert(none == nil and e == errno.ENOENT)
+assert(select(2, fs.mmap('/tmp')) ~= 0)
+
+-- reading lines writes to the private mapping, not to the file
+local n = 0
+for line in fs.mmap(PATH):eachline() do
+	n = n + 1
+	assert(line == lines[n])
+end
+assert(n == #lines and file_get_content(PATH) == content)
+
+-- the consumers of readers
+assert(hash.sum('sha256', rd) == hash.sum('sha256', content))
+
+local rdfd, wrfd = os.pipe()
+assert(os.writeb(wrfd, rd, 100, 1000) == 1000)
+assert(os.read(rdfd, 1000) == content:sub(101, 1100))
+os.close(rdfd)
+os.close(wrfd)
+
+local zstream = zlib.deflate_init()
+local zbuf = buffer.new()
+zlib.deflate(zstream, rd, zbuf, 0)
+zlib.deflate_end(zstream)
+assert(#zbuf > 0 and #zbuf < #content)
+
+assert(file_put_content(PATH .. '.json', cjson.encode({lines = lines})) == 0)
+local json = fs.mmap(PATH .. '.json')
+assert(#cjson.decodeb(json).lines == #lines)
+os.remove(PATH .. '.json')
+
+-- a chain shares the mapping, a sub reader keeps it after fs.munmap
+local ch = buffer.chain():putstr('head:'):putreader(rd)
+local sub = rd:sub(5, 10)
+fs.munmap(rd)
+assert(#rd == 0)
+collectgarbage()
+assert(ch:str() == 'head:' .. content)
+assert(sub:str() == content:sub(6, 15))
+
+os.remove(PATH)
+print('ok')
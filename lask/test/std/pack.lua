@@ -0,0 +1,103 @@
+--[[
+buffer:pack/reader:unpack round trips, with and without a format, and the
+truncated/malformed data.
+]]
+
+require 'std'
+
+local function equal(a, b)
+	if type(a) ~= type(b) then
+		return false
+	elseif type(a) ~= 'table' then
+		return a == b and math.type(a) == math.type(b)
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local VALUES = {
+	0, 127, 128, -1, math.maxinteger, math.mininteger, 0.5, -1e300, 1/0,
+	'', 'x', string.rep('y', 63), string.rep('z', 64), string.rep('\0', 100000),
+	true, false,
+	{},
+	{1, 2, 3, 'four', {5}},
+	{a = 1, b = {c = 'd'}, [1.5] = true, [-3] = 'neg'},
+	{1, 2, nil, 4, x = 'mixed'},
+	{cmd = 'stat', argv = {'a', 'b'}, err = 0, retv = {uptime = 12.5, tasks = 42}},
+}
+
+local buf = buffer.new()
+for _, v in ipairs(VALUES) do
+	buf:pack(v)
+end
+buf:pack(nil)
+local rd = buf:reader()
+for i, v in ipairs(VALUES) do
+	local got, err = rd:unpack()
+	assert(err == 0 and equal(got, v), i)
+end
+local got, err = rd:unpack()
+assert(got == nil and err == 0 and #rd == 0)
+assert(select(2, rd:unpack()) == errno.ENODATA)
+
+-- with a format
+local fmt = buffer.packformat(' { id : u, name:s, score:d, delta:i, ok:b, tags:[s], any:*, pos:{x:i, y:i}? , list:[{a:s}] }')
+local msgs = {
+	{id = 1, name = 'one', score = 1.5, delta = -7, ok = true, tags = {'a', 'b'}, any = {k = 'v'}, pos = {x = -1, y = 2}, list = {{a = 'x'}}},
+	{id = 1 << 40, name = '', score = 0.0, delta = 0, ok = false, tags = {}, list = {}},
+}
+buf:rewind()
+for _, msg in ipairs(msgs) do
+	buf:pack(msg, fmt)
+end
+for _, msg in ipairs(msgs) do
+	local got, err = buf:unpack(fmt)
+	assert(err == 0 and equal(got, msg))
+end
+assert(#buf == 0)
+
+-- a spec string is compiled once and cached
+buf:pack({1, 2, 3}, '[u]')
+assert(equal(buf:unpack('[u]'), {1, 2, 3}))
+
+-- no field names or tags are written with a format
+local n = #buf:rewind():pack(msgs[2], fmt)
+assert(n < #buf:rewind():pack(msgs[2]) / 2)
+
+-- the buffer is left as it was by a failed pack
+buf:rewind():putstr('keep')
+assert(not pcall(buf.pack, buf, {id = 1}, fmt))
+assert(not pcall(buf.pack, buf, {id = -1, name = '', score = 0, delta = 0, tags = {}, list = {}}, fmt))
+assert(not pcall(buf.pack, buf, {print}))
+local loop = {}
+loop[1] = loop
+assert(not pcall(buf.pack, buf, loop))
+assert(buf:str() == 'keep')
+assert(not pcall(buffer.packformat, '{a:s'))
+assert(not pcall(buffer.packformat, '[x]'))
+assert(not pcall(buffer.packformat, '[{}]'))
+assert(not pcall(buffer.packformat, '{a:[ { } ]}'))
+
+-- truncated and malformed data is not consumed
+buf:rewind():pack(VALUES[#VALUES])
+local whole = buf:str()
+for i = 1, #whole - 1 do
+	local rd = buffer.new():putstr(whole:sub(1, i)):reader()
+	local got, err = rd:unpack()
+	assert(got == nil and err == errno.ENODATA and #rd == i)
+end
+buf:rewind():putstr('\x06\x01\x07')
+assert(select(2, buf:unpack()) == errno.EINVAL and #buf == 3)
+buf:rewind():putstr('\x03\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01')
+assert(select(2, buf:unpack()) == errno.EINVAL)
+
+print('ok')
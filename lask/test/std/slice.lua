@@ -0,0 +1,86 @@
+--[[
+Slices of a buffer stay valid whatever is done to the buffer afterwards, and
+so do the ones read by stream_channel:read_slice.
+]]
+
+local tasklet = require 'tasklet'
+require 'tasklet.channel.stream'
+
+local buf = buffer.new(64)
+local slices = {}
+for i = 1, 100 do
+	buf:putstr(string.format('%08d', i), 'tail')
+	slices[i] = buf:slice(8)
+	assert(#slices[i] == 8 and buf:str() == 'tail')
+	buf:shift(4)
+	-- grow, compact, start over or shrink the buffer
+	if i % 10 == 0 then
+		buf:rewind()
+	elseif i % 10 == 1 then
+		buf:reset()
+	else
+		buf:putstr(string.rep('x', i * 10)):shift(i * 10)
+	end
+end
+collectgarbage()
+for i, rd in ipairs(slices) do
+	assert(rd:str() == string.format('%08d', i))
+end
+
+-- a sub reader pins the memory as well
+local sub = slices[50]:sub(4, 4)
+slices = nil
+buf = nil
+collectgarbage()
+assert(sub:str() == '0050')
+
+-- a reader re-initialized drops what it pinned
+buf = buffer.new():putstr('abcdef')
+local rd = buf:slice(3)
+assert(rd:getlstr(1) == 'a' and rd:str() == 'bc' and buf:str() == 'def')
+buf:reader(rd)
+assert(rd:str() == 'def')
+string.reader('xyz', rd)
+assert(rd:str() == 'xyz')
+assert(#buf:slice(0) == 0 and #buffer.new():slice() == 0)
+
+-- stream_channel:read_slice
+local NUM_FRAMES = 1000
+local rdfd, wrfd = os.pipe()
+local ch = tasklet.stream_channel.new(rdfd, 4096)
+
+tasklet.start_task(function ()
+	local out = buffer.new()
+	for i = 1, NUM_FRAMES do
+		out:putstr(string.format('%099d\n', i))
+		if i % 7 == 0 then
+			assert(os.writeb(wrfd, out) == #out)
+			out:rewind()
+			tasklet.sleep(0.001)
+		end
+	end
+	os.writeb(wrfd, out)
+	os.close(wrfd)
+end)
+
+tasklet.start_task(function ()
+	local frames = {}
+	for i = 1, NUM_FRAMES do
+		-- mixed with reading lines
+		if i % 3 == 0 then
+			assert(ch:read() == string.format('%099d', i))
+		else
+			local frame, err = ch:read_slice(100)
+			assert(err == 0 and #frame == 100)
+			frames[i] = frame
+		end
+	end
+	collectgarbage()
+	for i, frame in pairs(frames) do
+		assert(frame:str() == string.format('%099d\n', i))
+	end
+	print('ok')
+	os.exit(0)
+end)
+
+tasklet.loop()
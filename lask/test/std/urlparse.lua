@@ -21,3 +21,58 @@ for _, v in ipairs(urls) do
 end
 print(urlparse.build_path({'节点1', '节点2', '叶子'}))
 print(urlparse.build_query({x='值1', y='值2', z='/'}))
+
+-- codec against the former Lua-side implementations, over the SSE2 block boundaries
+local RESERVED = ';/?:@&=+$,%'
+local function ref_encode(s)
+	return (s:gsub('.', function (c)
+		if c == ' ' then
+			return '+'
+		elseif c:byte() >= 128 or RESERVED:find(c, 1, true) then
+			return string.format('%%%02x', c:byte())
+		end
+	end))
+end
+
+local function ref_decode(s)
+	local t, i = {}, 1
+	while i <= #s do
+		local hex = s:match('^%%(%x%x)', i)
+		if hex then
+			t[#t + 1] = string.char(tonumber(hex, 16))
+			i = i + 3
+		else
+			local c = s:sub(i, i)
+			t[#t + 1] = c == '+' and ' ' or c
+			i = i + 1
+		end
+	end
+	return table.concat(t)
+end
+
+local CHARS = 'abcXYZ019-_.~ %+&=;/?:@$,\x80\xff'
+for len = 0, 70 do
+	for _ = 1, 20 do
+		local t = {}
+		for i = 1, len do
+			local k = math.random(#CHARS)
+			t[i] = CHARS:sub(k, k)
+		end
+		local s = table.concat(t)
+		local enc = codec.urlencode(s)
+		assert(enc == ref_encode(s), s)
+		assert(codec.urldecode(enc) == s, s)
+		assert(codec.urldecode(s) == ref_decode(s), s)
+		assert(codec.urlencode(buffer.new():putstr(s)) == enc)
+		assert(codec.urldecode(s, buffer.new():putstr('>')):str() == '>' .. codec.urldecode(s))
+	end
+end
+assert(codec.urldecode('%4') == '%4' and codec.urldecode('%zz%41') == '%zzA')
+assert(codec.urldecode('a%00b') == 'a\0b')
+
+local params = codec.parse_query(buffer.new():putstr('a=1&b=x+y%26z;=skipped&c=&d&e==3&a=2'):reader())
+assert(params.a == '2' and params.b == 'x y&z' and params.e == '=3')
+assert(params.c == nil and params.d == nil and params[''] == nil)
+local t = {}
+assert(urlparse.split_query('k=v', t) == t and t.k == 'v')
+print('ok')
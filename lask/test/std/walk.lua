@@ -0,0 +1,117 @@
+--[[
+fs.walk compared with a walk by fs.listdir+fs.lstat, with and without stat,
+limited in depth, in small batches, and filled by the offload workers.
+]]
+
+local tasklet = require 'tasklet'
+require 'tasklet.offload'
+
+local ROOT = '/tmp/lask-walk-' .. os.getpid()
+
+-- a tree of 3 levels, with empty directories and symbolic links
+local function mktree(dir, level)
+	fs.mkdir(dir)
+	for i = 1, 30 do
+		file_put_content(dir .. '/f' .. i, string.rep('x', i * level))
+	end
+	fs.symlink(dir .. '/f1', dir .. '/link')
+	fs.mkdir(dir .. '/empty')
+	if level < 3 then
+		for i = 1, 4 do
+			mktree(dir .. '/d' .. i, level + 1)
+		end
+	end
+end
+mktree(ROOT, 1)
+
+-- {[path] = {type, size, mtime}}
+local function reference(dir, depth, maxdepth, out)
+	for _, name in ipairs(fs.listdir(dir)) do
+		local path = dir .. '/' .. name
+		local st = fs.lstat(path)
+		local type = stat.isdir(st.mode) and fs.DT_DIR or stat.islnk(st.mode) and fs.DT_LNK or fs.DT_REG
+		out[path] = {type, st.size, st.mtime}
+		if type == fs.DT_DIR and (not maxdepth or depth < maxdepth) then
+			reference(path, depth + 1, maxdepth, out)
+		end
+	end
+	return out
+end
+
+local function count(t)
+	local n = 0
+	for _ in pairs(t) do
+		n = n + 1
+	end
+	return n
+end
+
+-- walk with 'fill' and compare
+local function check(opts, fill)
+	local expected = reference(ROOT, 1, opts.depth, {})
+	local w = assert(fs.walk(ROOT .. '/', opts))
+	local seen = {}
+	while true do
+		local n = fill(w)
+		if n == 0 then
+			break
+		end
+		assert(n <= (opts.batch or 1024))
+		for path, type, size, mtime in w.next, w do
+			n = n - 1
+			local e = assert(expected[path], path)
+			assert(not seen[path] and type == e[1], path)
+			if opts.stat then
+				assert(size == e[2] and mtime == e[3], path)
+			else
+				assert(size == -1 and mtime == -1)
+			end
+			seen[path] = true
+		end
+		assert(n == 0)
+	end
+	assert(count(seen) == count(expected))
+	return count(seen)
+end
+
+local sync_fill = function (w) return w:fill() end
+local total = check({}, sync_fill)
+assert(total == check({stat = true, batch = 7}, sync_fill))
+assert(check({depth = 1}, sync_fill) == 30 + 2 + 4)
+assert(check({depth = 2, stat = true, batch = 1}, sync_fill) == 36 + 4 * 36)
+print('entries:', total)
+
+local w, err = fs.walk(ROOT .. '/nonexistent')
+assert(w == nil and err == errno.ENOENT)
+w = fs.walk(ROOT)
+assert(w:fill() > 0)
+w:close()
+assert(w:fill() == 0 and w:next() == nil)
+
+tasklet.start_task(function ()
+	local offload_fill = function (w)
+		local n = tasklet.offload('walk', w)
+		return n
+	end
+	assert(check({stat = true, batch = 100}, offload_fill) == total)
+
+	-- the walker is not to be touched while being filled
+	local w = fs.walk(ROOT)
+	tasklet.start_task(function ()
+		assert(not pcall(w.next, w))
+	end)
+	assert(tasklet.offload('walk', w) > 0)
+	assert(w:next())
+
+	os.execute('rm -rf ' .. ROOT)
+	print('ok')
+	os.exit(0)
+end)
+
+tasklet.start_task(function ()
+	tasklet.sleep(10)
+	print('timeout')
+	os.exit(1)
+end)
+
+tasklet.loop()
@@ -0,0 +1,64 @@
+
+--[[
+    x        +------------------+
+   --->      |                  |
+   <---      |                  |
+    2*x      |      DOUBLE      |
+	         |   (batch mode)   |
+   ...       |                  |
+             +------------------+
+
+
+arg[1]  number of clients, defaulted to 1000
+arg[2]  number of requests for each client, defaulted to 1000
+arg[3]  seconds the handler sleeps for each batch, defaulted to 0(no sleep)
+]]
+
+local NUM_CLIENTS = tonumber(arg[1]) or 1000
+local NUM_REQUESTS = tonumber(arg[2]) or 1000
+local HANDLER_SLEEP = tonumber(arg[3]) or 0
+
+local tasklet = require 'tasklet.service'
+
+local total = 0
+local nbatch = 0
+local maxdepth = 0
+
+local svc = tasklet.create_batch_service(
+	'double',
+	function (req, resp, err, num)
+		if HANDLER_SLEEP > 0 then
+			tasklet.sleep(HANDLER_SLEEP)
+		end
+		for i = 1, num do
+			resp[i] = req[i] * 2
+		end
+		total = total + num
+		nbatch = nbatch + 1
+	end)
+
+local assert = assert
+local done = 0
+local tm_start = time.uptime()
+
+for i = 1, NUM_CLIENTS do
+	tasklet.start_task(function ()
+		for j = 1, NUM_REQUESTS do
+			assert(tasklet.request(svc, j) == 2 * j)
+			local depth = tasklet.service_load(svc)
+			if depth > maxdepth then
+				maxdepth = depth
+			end
+		end
+		done = done + 1
+		if done == NUM_CLIENTS then
+			assert(total == NUM_CLIENTS * NUM_REQUESTS)
+			local depth, secperreq = tasklet.service_load(svc)
+			print(string.format('%d requests in %d batches(max depth %d) in %.3f seconds, %.2fus per request handled',
+				total, nbatch, maxdepth, time.uptime() - tm_start, secperreq * 1e6))
+			os.exit(0)
+		end
+	end)
+end
+
+tasklet.loop()
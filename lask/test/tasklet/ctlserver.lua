@@ -0,0 +1,66 @@
+--[[
+Several requests in flight on one ctlserver connection, the response of a
+quick command overtakes the one of a slow command sent before it.
+]]
+
+local tasklet = require 'tasklet'
+local app = require 'app'
+local appctl = require 'appctl'
+
+local APPNAME = 'ctlserver-test-' .. os.getpid()
+local SOCKPATH = '/tmp/' .. APPNAME .. '.sock'
+
+fs.unlink(SOCKPATH)
+local pid = os.fork()
+if pid == 0 then
+	app.start_ctlserver_task({
+		add = function (argv)
+			local sum = 0
+			for _, v in ipairs(argv) do
+				sum = sum + tonumber(v)
+			end
+			return 0, sum
+		end,
+		slow = function (argv)
+			tasklet.sleep(tonumber(argv[1]))
+			return 0, {'slept', argv[1]}
+		end,
+		echo = function (argv)
+			return 0, argv
+		end,
+	}, SOCKPATH)
+	-- in case the parent aborts
+	tasklet.start_task(function ()
+		tasklet.sleep(5)
+		os.exit(0)
+	end)
+	tasklet.loop()
+	os.exit(0)
+end
+
+while fs.access(SOCKPATH, fs.F_OK) ~= 0 do
+	time.sleep(0.01)
+end
+
+appctl.APPNAME = APPNAME
+local id_slow = appctl.send('slow', {'0.2'})
+local id_add = appctl.send('add', {1, 20, 300})
+
+local t0 = time.uptime()
+local err, retv = appctl.recv(id_add)
+assert(err == 0 and retv[1] == '321')
+assert(time.uptime() - t0 < 0.15, 'the quick response waited for the slow one')
+
+err, retv = appctl.recv(id_slow)
+assert(err == 0 and retv[1] == 'slept' and retv[2] == '0.2')
+
+err, retv = appctl.invoke('echo', {'', 'a\r\nb', string.rep('x', 10000)})
+assert(err == 0 and retv[1] == '' and retv[2] == 'a\r\nb' and #retv[3] == 10000)
+
+err = appctl.invoke('nonexistent')
+assert(err == errno.ENOSYS)
+
+print('ok')
+signal.kill(pid, signal.SIGKILL)
+os.waitpid(pid)
+fs.unlink(SOCKPATH)
@@ -10,7 +10,11 @@ local help = [[
 arg[1]   10x10  (number-of-connections x queries-for-each-connection)
 arg[2]   lower_bound,upper_bound
 arg[3]   ip/port/ip:port, port defaulted to 60001, ip defaulted to 127.0.0.1
-arg[4]   ssl/tcp, defaulted to tcp
+arg[4]   ssl/tcp/uring, defaulted to tcp(uring: tcp over the io_uring backend)
+
+compare the backends by the elapsed time printed at the end, e.g.
+	lua echo1000000-server.lua 60001 tcp & lua echo1000000-client.lua 10x10 1,10 60001 tcp
+	lua echo1000000-server.lua 60002 uring & lua echo1000000-client.lua 10x10 1,10 60002 uring
 ]]
 if arg[1] == 'help' then
     print(help)
@@ -63,12 +67,17 @@ if arg[4] == 'ssl' then
 else
     tasklet = require 'tasklet.channel.stream'
     channel_type = tasklet.stream_channel
+    if arg[4] == 'uring' then
+        log.info('backend: ', tasklet.set_backend('uring'))
+    end
 end
 
 local log = require 'log'
 
 local index = 1
 local done = 0
+local nbytes = 0
+local tm_start = time.uptime()
 
 io.stdout:setvbuf('no')
 
@@ -96,6 +105,7 @@ local function client_task()
 			local rd, err = ch:read(left)
             assert(err == 0, errno.strerror(err))
 			left = left - #rd
+            nbytes = nbytes + #rd
             io.stdout:write('\r', nresp - left, '/', nresp)
 		end
 
@@ -104,6 +114,9 @@ local function client_task()
 	ch:close()
 	done = done + 1
     if done == NUM_CONNS then
+        local elapsed = time.uptime() - tm_start
+        io.stdout:write(string.format('\n%d bytes received in %.3f seconds, %.2f MB/s\n',
+            nbytes, elapsed, nbytes / elapsed / 1048576))
         os.exit(0)
     end
 end
@@ -9,7 +9,7 @@ local help = [[
 
 
 arg[1]   port, defaulted to 60001
-arg[2]   ssl/tcp, defaulted to tcp
+arg[2]   ssl/tcp/uring, defaulted to tcp(uring: tcp over the io_uring backend)
 ]]
 if arg[1] == 'help' then
     print(help)
@@ -51,6 +51,9 @@ if arg[2] == 'ssl' then
 else
     tasklet = require 'tasklet.channel.stream'
     channel_type = tasklet.stream_channel
+	if arg[2] == 'uring' then
+		log.info('backend: ', tasklet.set_backend('uring'))
+	end
 end
 
 
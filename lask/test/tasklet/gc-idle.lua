@@ -0,0 +1,34 @@
+--[[
+A task allocates garbage in bursts and sleeps in between, the GC cycles should
+be mostly finished by the idle steps run by the loop before polling.
+
+arg[1]  KB per idle step, defaulted to 64
+arg[2]  number of bursts, defaulted to 100
+]]
+
+local tasklet = require 'tasklet'
+
+local IDLE = tonumber(arg[1]) or 64
+local NUM_BURSTS = tonumber(arg[2]) or 100
+
+assert(tasklet.set_gc({idle = IDLE}) == 0)
+assert(tasklet.set_gc({mode = 'nonsense'}) == errno.EINVAL)
+
+tasklet.start_task(function ()
+	local keep = {}
+	for i = 1, NUM_BURSTS do
+		for j = 1, 2000 do
+			keep[j] = {i, j, tostring(j)}
+		end
+		tasklet.sleep(0.01)
+	end
+
+	local st = tasklet.gc_stats()
+	print(string.format('%d cycles(%d idle) in %d steps, %.3f seconds, the longest step %.6f seconds, %d KB in use',
+		st.cycles, st.idle_cycles, st.steps, st.seconds, st.maxstep, st.kbytes))
+	assert(st.idle_cycles > 0 and st.steps > 0)
+	assert(st.idle_cycles * 2 >= st.cycles)
+	os.exit(0)
+end)
+
+tasklet.loop()
@@ -0,0 +1,102 @@
+--[[
+tasklet.inotify_channel: bursts coalesced per path, recursive watches following the
+directories created/moved into the tree, unwatch, timeout and close.
+]]
+
+local tasklet = require 'tasklet'
+require 'tasklet.channel.inotify'
+
+local ROOT = '/tmp/lask-inotify-' .. os.getpid()
+local band = bit32.band
+
+local IN_MODIFY, IN_CREATE, IN_DELETE = inotify.IN_MODIFY, inotify.IN_CREATE, inotify.IN_DELETE
+local IN_CLOSE_WRITE, IN_ISDIR = inotify.IN_CLOSE_WRITE, inotify.IN_ISDIR
+local IN_MOVED_FROM, IN_MOVED_TO = inotify.IN_MOVED_FROM, inotify.IN_MOVED_TO
+
+fs.mkdir(ROOT)
+fs.mkdir(ROOT .. '/a')
+fs.mkdir(ROOT .. '/a/b')
+
+local function has(mask, bits)
+	return band(mask, bits) == bits
+end
+
+-- read until 'path' is reported, merging what is read
+local function wait(ch, path)
+	local all = {}
+	while not all[path] do
+		local events, err = ch:read(2)
+		assert(err == 0, path)
+		for p, mask in pairs(events) do
+			all[p] = bit32.bor(all[p] or 0, mask)
+		end
+	end
+	return all
+end
+
+tasklet.start_task(function ()
+	local ch = assert(tasklet.inotify_channel.new())
+	assert(ch:watch(ROOT .. '/', nil, true) == 0)
+	assert(ch:watch(ROOT .. '/nonexistent') == errno.ENOENT)
+
+	-- a burst of writes is one event
+	local fd = os.open(ROOT .. '/a/b/f', os.O_WRONLY + os.O_CREAT, 420)
+	for i = 1, 100 do
+		os.write(fd, 'x')
+	end
+	os.close(fd)
+	tasklet.sleep(0.05)
+	local events = ch:read()
+	local mask = events[ROOT .. '/a/b/f']
+	assert(has(mask, IN_CREATE + IN_MODIFY + IN_CLOSE_WRITE))
+
+	-- created subdirectories are watched, their entries created before are reported
+	fs.mkdir(ROOT .. '/c')
+	fs.mkdir(ROOT .. '/c/d')
+	file_put_content(ROOT .. '/c/d/g', 'g')
+	events = wait(ch, ROOT .. '/c/d/g')
+	assert(has(events[ROOT .. '/c'], IN_CREATE + IN_ISDIR))
+	file_put_content(ROOT .. '/c/d/h', 'h')
+	assert(has(wait(ch, ROOT .. '/c/d/h')[ROOT .. '/c/d/h'], IN_CREATE))
+
+	-- directories moved inside the tree are watched at their new paths
+	assert(fs.rename(ROOT .. '/c', ROOT .. '/a/e') == 0)
+	events = wait(ch, ROOT .. '/a/e')
+	assert(has(events[ROOT .. '/c'], IN_MOVED_FROM + IN_ISDIR))
+	assert(has(events[ROOT .. '/a/e'], IN_MOVED_TO + IN_ISDIR))
+	file_put_content(ROOT .. '/a/e/d/i', 'i')
+	events = wait(ch, ROOT .. '/a/e/d/i')
+	assert(not events[ROOT .. '/c/d/i'])
+
+	-- removed
+	os.remove(ROOT .. '/a/b/f')
+	assert(has(wait(ch, ROOT .. '/a/b/f')[ROOT .. '/a/b/f'], IN_DELETE))
+
+	-- unwatch
+	assert(ch:unwatch(ROOT) == 0 and ch:unwatch(ROOT) == errno.ENOENT)
+	assert(next(ch.ch_watches) == nil)
+	file_put_content(ROOT .. '/a/j', 'j')
+	local none, err = ch:read(0.1)
+	assert(none == nil and err == errno.ETIMEDOUT)
+
+	-- close wakes the reader up
+	assert(ch:watch(ROOT, IN_CREATE) == 0)
+	tasklet.start_task(function ()
+		tasklet.sleep(0.01)
+		ch:close()
+	end)
+	none, err = ch:read()
+	assert(none == nil and err == errno.EBADF)
+
+	os.execute('rm -rf ' .. ROOT)
+	print('ok')
+	os.exit(0)
+end)
+
+tasklet.start_task(function ()
+	tasklet.sleep(10)
+	print('timeout')
+	os.exit(1)
+end)
+
+tasklet.loop()
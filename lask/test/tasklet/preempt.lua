@@ -0,0 +1,74 @@
+
+--[[
+Tasks spinning without ever blocking are force-yielded by the preemption
+budget, so a task sleeping periodically still wakes up in time.
+
+arg[1]  budget in seconds, defaulted to 0.01
+arg[2]  number of spinning tasks, defaulted to 2
+]]
+
+local tasklet = require 'tasklet'
+
+local BUDGET = tonumber(arg[1]) or 0.01
+local NUM_SPIN = tonumber(arg[2]) or 2
+
+tasklet.set_preemption(BUDGET)
+
+local spins = {}
+for i = 1, NUM_SPIN do
+	spins[i] = 0
+	tasklet.start_task(function ()
+		while true do
+			spins[i] = spins[i] + 1
+		end
+	end, 'spin' .. i)
+end
+
+-- coroutines created by a task are not preempted, a generator yields all its values
+local generated = 0
+tasklet.start_task(function ()
+	local gen = coroutine.wrap(function ()
+		for i = 1, 100 do
+			local x = 0
+			for j = 1, 100000 do
+				x = x + j
+			end
+			coroutine.yield(i)
+		end
+	end)
+	for i = 1, 100 do
+		assert(gen() == i)
+		generated = i
+	end
+end, 'generator')
+
+-- a task yielding by itself is not taken as preempted
+local nyields = 0
+local yielder = tasklet.start_task(function ()
+	nyields = nyields + 1
+	coroutine.yield()
+	nyields = nyields + 1
+end, 'yielder')
+
+tasklet.start_task(function ()
+	local maxlate = 0
+	for i = 1, 20 do
+		local t0 = time.uptime()
+		tasklet.sleep(0.05)
+		local late = time.uptime() - t0 - 0.05
+		if late > maxlate then
+			maxlate = late
+		end
+	end
+
+	print(string.format('%d preemptions, sleeping task woke up at most %.3f seconds late', preempt.count(), maxlate))
+	for i = 1, NUM_SPIN do
+		assert(spins[i] > 0)
+	end
+	assert(generated == 100)
+	assert(nyields == 1 and yielder.t_npreempted == 0)
+	assert(maxlate < BUDGET * (NUM_SPIN + 1) + 0.02)
+	os.exit(0)
+end)
+
+tasklet.loop()
@@ -0,0 +1,63 @@
+
+--[[
+A flood of busy tasks(each one keeps re-scheduling itself) must not starve a
+high-priority task waking up periodically, and the low-priority tasks still
+make progress thanks to the budgets.
+
+arg[1]  number of busy tasks, defaulted to 10000
+arg[2]  seconds to run, defaulted to 2
+]]
+
+local tasklet = require 'tasklet'
+
+local NUM_BUSY = tonumber(arg[1]) or 10000
+local DURATION = tonumber(arg[2]) or 2
+
+local resume_task, block_task, current_task = tasklet._resume_task, tasklet._block_task, tasklet.current_task
+local uptime = time.uptime
+
+local function busy()
+	local task = current_task()
+	while true do
+		for i = 1, 100 do end
+		resume_task(task)
+		block_task()
+	end
+end
+
+for i = 1, NUM_BUSY do
+	tasklet.start_task(busy)
+end
+
+local nlow = 0
+tasklet.start_task(function ()
+	local task = current_task()
+	while true do
+		nlow = nlow + 1
+		resume_task(task)
+		block_task()
+	end
+end, {t_name = 'low', t_prio = tasklet.PRIO_LOW})
+
+tasklet.start_task(function ()
+	local tm_start = uptime()
+	local maxlate = 0
+	while uptime() - tm_start < DURATION do
+		local t0 = uptime()
+		tasklet.sleep(0.01)
+		local late = uptime() - t0 - 0.01
+		if late > maxlate then
+			maxlate = late
+		end
+	end
+
+	for _, st in ipairs(tasklet.sched_stats()) do
+		print(string.format('%-6s resumed=%d deferred=%d maxwait=%.6f', st.name, st.resumed, st.deferred, st.maxwait))
+	end
+	print(string.format('high-priority task woke up at most %.3f seconds late, the low-priority task ran %d times',
+		maxlate, nlow))
+	assert(nlow > 0)
+	os.exit(0)
+end, {t_name = 'high', t_prio = tasklet.PRIO_HIGH})
+
+tasklet.loop()
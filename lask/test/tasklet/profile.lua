@@ -0,0 +1,80 @@
+--[[
+tasklet.set_profiling: resumes, CPU time and the time blocked by each kind of
+object(timer, channel, service) accumulated by task name.
+]]
+
+local tasklet = require 'tasklet.service'
+require 'tasklet.channel.message'
+
+tasklet.set_profiling(true)
+
+local svc = tasklet.create_service('slow-double', function (svc, x)
+	tasklet.sleep(0.05)
+	return x * 2
+end)
+local ch = tasklet.message_channel.new()
+local done = 0
+
+tasklet.start_task(function ()
+	for i = 1, 5 do
+		tasklet.sleep(0.01)
+	end
+	done = done + 1
+end, 'sleeper')
+
+tasklet.start_task(function ()
+	for i = 1, 3 do
+		assert(ch:read() == i)
+	end
+	done = done + 1
+end, 'reader')
+
+tasklet.start_task(function ()
+	for i = 1, 3 do
+		tasklet.sleep(0.02)
+		ch:write(i)
+	end
+	done = done + 1
+end, 'writer')
+
+tasklet.start_task(function ()
+	assert(tasklet.request(svc, 21) == 42)
+	done = done + 1
+end, 'requester')
+
+tasklet.start_task(function ()
+	while done < 4 do
+		tasklet.sleep(0.01)
+	end
+
+	local stats = tasklet.profile_stats()
+	for _, name in ipairs({'sleeper', 'reader', 'writer', 'requester'}) do
+		local entry = stats[name]
+		assert(entry, name)
+		assert(entry.resumes > 0, name)
+		assert(entry.cpu >= 0 and entry.maxcpu >= 0 and entry.maxcpu <= entry.cpu, name)
+	end
+	assert(stats.sleeper.resumes >= 6)
+	assert(stats.sleeper.blocked.timer >= 0.04)
+	assert(stats.reader.blocked.channel >= 0.04)
+	assert(stats.requester.blocked.service >= 0.04)
+
+	-- once turned off, only the resume of this task already measured is accumulated
+	tasklet.set_profiling(false)
+	tasklet.profile_reset()
+	tasklet.sleep(0.01)
+	for name in pairs(tasklet.profile_stats()) do
+		assert(name == 'checker', name)
+	end
+
+	print('ok')
+	os.exit(0)
+end, 'checker')
+
+tasklet.start_task(function ()
+	tasklet.sleep(10)
+	print('timeout')
+	os.exit(1)
+end)
+
+tasklet.loop()
@@ -0,0 +1,73 @@
+--[[
+The object of a finished or reaped task started again: the scheduler fields
+are reset, a task restarted as non-joinable no longer counts in its old parent.
+]]
+
+local tasklet = require 'tasklet'
+
+local runs = 0
+local function child()
+	runs = runs + 1
+	tasklet.sleep(0.001)
+end
+
+tasklet.start_task(function ()
+	local parent = tasklet.current_task()
+
+	-- joinable, then finished
+	local task = tasklet.start_task(child, {t_name = 'child'}, true)
+	assert(task.t_parent == parent and parent.t_nsubs == 1)
+	assert(tasklet.join_tasks() == 0)
+	assert(parent.t_nsubs == 0 and runs == 1)
+
+	-- restarted as non-joinable from another task, the old parent is left alone
+	tasklet.start_task(function ()
+		assert(tasklet.start_task(child, task) == task)
+		assert(task.t_parent == false and task.rb_key == false and task.t_err == 0)
+	end)
+	tasklet.sleep(0.05)
+	assert(runs == 2 and parent.t_nsubs == 0)
+
+	-- a task reaped while sleeping on a timer, then restarted
+	local handled = 0
+	local sleeper = tasklet.start_task(function ()
+		tasklet.sleep(0.001)
+	end, {
+		sighandler = function ()
+			handled = handled + 1
+		end,
+	})
+	local reaped = tasklet.start_task(function () tasklet.sleep(100) end, 'reaped')
+	tasklet.sleep(0.001)
+	assert(reaped.rb_key)
+	tasklet.reap_task(reaped)
+	tasklet.sleep(0.01)
+	assert(not reaped.t_co)
+
+	tasklet.start_task(function ()
+		tasklet.sleep()
+	end, reaped)
+	assert(reaped.rb_key == false and reaped.sighandler == nil)
+	tasklet.kill_task(reaped)
+
+	-- the handler given by the prototype is kept
+	tasklet.sleep(0.01)
+	tasklet.start_task(function ()
+		tasklet.sleep()
+	end, sleeper)
+	tasklet.sleep(0.001)
+	tasklet.kill_task(sleeper, 'hi')
+	tasklet.sleep(0.001)
+	assert(handled == 1)
+
+	print('ok')
+	os.exit(0)
+end)
+
+tasklet.start_task(function ()
+	tasklet.sleep(10)
+	print('timeout')
+	os.exit(1)
+end)
+
+tasklet.loop()
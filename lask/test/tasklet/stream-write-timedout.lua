@@ -0,0 +1,82 @@
+--[[
+Writes timed out while the peer doesn't read: the bytes taken are reported and
+written exactly once, a write done with sec=0 is still written after close.
+
+arg[1]  backend, 'epoll'(default) or 'uring'
+]]
+
+local tasklet = require 'tasklet.channel.streamserver'
+require 'tasklet.channel.stream'
+
+local BACKEND = tasklet.set_backend(arg[1] or 'epoll')
+local ETIMEDOUT = errno.ETIMEDOUT
+local SERVER_ADDR = '/tmp/test-stream-write-timedout-' .. os.getpid() .. '.sock'
+
+local DATA = {}
+for i = 1, 4 * 1024 * 1024 / 16 do
+	DATA[i] = string.format('%015d\n', i)
+end
+DATA = table.concat(DATA)
+
+print('backend: ' .. BACKEND)
+
+local ch_server = assert(tasklet.create_unserver_channel(SERVER_ADDR))
+
+local received = buffer.new()
+
+-- read until EOF
+local function read_all(ch)
+	while true do
+		local rd = ch:read(-1)
+		if not rd or #rd == 0 then
+			break
+		end
+		received:putreader(rd)
+	end
+	return received:str()
+end
+
+tasklet.start_task(function ()
+	local fd = ch_server:accept()
+	assert(fd >= 0)
+	local peer = tasklet.stream_channel.new(fd)
+
+	-- not read until the writer times out
+	tasklet.sleep(0.3)
+	local data = read_all(peer)
+	assert(data == DATA .. 'x', 'received ' .. #data)
+	peer:close()
+
+	ch_server:close()
+	os.remove(SERVER_ADDR)
+	print('ok')
+	os.exit(0)
+end)
+
+tasklet.start_task(function ()
+	local ch = tasklet.stream_channel.new()
+	assert(ch:connect(SERVER_ADDR) == 0)
+
+	local err, n = ch:write(buffer.new():putstr(DATA), 0.1)
+	assert(err == ETIMEDOUT and n > 0 and n < #DATA, tostring(err) .. ' ' .. tostring(n))
+	print('taken before timeout: ' .. n)
+
+	err, n = ch:write(buffer.new():putstr(DATA:sub(n + 1)))
+	assert(err == 0)
+
+	-- taken at once, closing doesn't drop it
+	while #received < #DATA do
+		tasklet.sleep(0.01)
+	end
+	err, n = ch:write(buffer.new():putstr('x'), 0)
+	assert(err == 0 and n == 1, tostring(err))
+	ch:close()
+end)
+
+tasklet.start_task(function ()
+	tasklet.sleep(10)
+	print('timeout')
+	os.exit(1)
+end)
+
+tasklet.loop()
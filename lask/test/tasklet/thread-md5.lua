@@ -0,0 +1,59 @@
+--[[
+hash messages on worker threads and collect the results through a thread channel
+
+arg[1]   number of worker threads, defaulted to 2
+arg[2]   number of messages, defaulted to 100000
+ ]]
+
+require 'std'
+local tasklet = require 'tasklet.channel.thread'
+
+local NUM_THREADS = tonumber(arg[1]) or 2
+local NUM_MSGS = tonumber(arg[2]) or 100000
+
+local req, resp = thread.queue(256), thread.queue(256)
+for i = 1, NUM_THREADS do
+	thread.start(function (req, resp)
+		require 'std'
+		local buf = buffer.new()
+		while req:pop(buf:rewind(), -1) do
+			if #buf == 0 then
+				break
+			end
+			local digest = md5(buf:str())
+			while not resp:push(digest) do
+				time.sleep(0.001)
+			end
+		end
+	end, req, resp)
+end
+
+local ch = tasklet.thread_channel.new(resp, req)
+
+tasklet.start_task(function ()
+	for i = 1, NUM_MSGS do
+		while ch:write('message ' .. i) ~= 0 do
+			tasklet.sleep(0.01)
+		end
+	end
+end)
+
+tasklet.start_task(function ()
+	local buf = buffer.new()
+	local start = time.time()
+	for i = 1, NUM_MSGS do
+		local err = ch:read(buf:rewind(), 3)
+		if err ~= 0 then
+			print('read error -> ', errno.strerror(err))
+			break
+		end
+	end
+	print('elapsed -> ', time.time() - start)
+	for i = 1, NUM_THREADS do
+		ch:write('')
+	end
+	tasklet.sleep(0.1)
+	tasklet.quit()
+end)
+
+tasklet.loop()
@@ -0,0 +1,107 @@
+#!/usr/bin/lua
+
+--
+-- Copyright (C) spyder
+--
+
+local usage = [[
+usage:
+	logdump file1 file2 ...
+render log files written with the binary format(log.init{format='binary'})
+as text, rotated files compressed into '.gz' are accepted as well.
+e.g.
+	logdump /tmp/myapp.log.2.gz /tmp/myapp.log.1.gz /tmp/myapp.log
+]]
+
+require 'std'
+
+local stdout = io.stdout
+local stderr = io.stderr
+
+local MAGIC = 'LASKLOG1'
+
+local LEVEL_NAME_PREFIX = {
+	'debug*** ',
+	'info *** ',
+	'warn *** ',
+	'error*** ',
+	'fatal*** ',
+}
+
+local function getlstr(rd)
+	local len = rd:getu()
+	if not len or len > #rd then
+		return
+	end
+	return len > 0 and rd:getlstr(len) or ''
+end
+
+local function dump(path)
+	local data, err = file_get_content(path)
+	if not data then
+		stderr:write(path, ': ', errno.strerror(err), '\n')
+		return false
+	end
+
+	if path:find('%.gz$') then
+		local zlib = require 'zlib'
+		local buf = buffer.new():putstr(data)
+		if zlib.uncompress(buf) ~= 0 then
+			stderr:write(path, ': corrupted gzip file\n')
+			return false
+		end
+		data = buf:str()
+	end
+
+	if data:sub(1, #MAGIC) ~= MAGIC then
+		stderr:write(path, ': not a binary log file\n')
+		return false
+	end
+
+	local rd = string.reader(data)
+	local formats = {}
+	local out = buffer.new()
+	rd:skip(#MAGIC)
+
+	while #rd > 0 do
+		local rtype = rd:getc()
+		if rtype == 70 then			-- 'F'
+			local id = rd:getw()
+			formats[id] = getlstr(rd)
+		elseif rtype == 82 and #rd >= 10 then	-- 'R'
+			local sec, msec, level, id, nargs = rd:getlist('uwcwc')
+			out:rewind()
+			out:putstr(time.strftime('%m-%d %H:%M:%S', sec), string.format('.%03d ', msec))
+			out:putstr(LEVEL_NAME_PREFIX[level] or '?????*** ')
+			if id > 0 then
+				out:putstr(formats[id] or '<unknown format>')
+			end
+			for i = 1, nargs do
+				local arg = getlstr(rd)
+				if not arg then
+					break
+				end
+				out:putstr(arg)
+			end
+			out:putstr('\n')
+			stdout:write(out:str())
+		else
+			stderr:write(path, ': truncated or corrupted at offset ', #data - #rd, '\n')
+			return false
+		end
+	end
+	return true
+end
+
+if #arg == 0 or arg[1] == 'help' then
+	print(usage)
+	os.exit(0)
+end
+
+local exitcode = 0
+for _, path in ipairs(arg) do
+	if not dump(path) then
+		exitcode = 1
+	end
+end
+os.exit(exitcode)
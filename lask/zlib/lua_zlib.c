@@ -22,22 +22,27 @@ typedef struct _Stream {
 */
 static int l_deflate_init(lua_State *L)
 {
-	z_stream stream = {
-		.zalloc = Z_NULL,
-		.zfree = Z_NULL,
-		.opaque = Z_NULL,
-	};
 	int wbits = (int)luaL_optinteger(L, 1, MAX_WBITS + 16);
 	int level = (int)luaL_optinteger(L, 2, Z_DEFAULT_COMPRESSION);
 	int memlevel = (int)luaL_optinteger(L, 3, DEF_MEM_LEVEL);
-	int result = deflateInit2(&stream, level, Z_DEFLATED, wbits, memlevel, Z_DEFAULT_STRATEGY);
+	int result;
+
+	/* zlib keeps a back pointer to the z_stream in its internal state, so the
+	stream must be initialized where it's going to live. */
+	Stream *p = (Stream*)calloc(1, sizeof(Stream));
+	if (p == NULL) {
+		lua_pushnil(L);
+		lua_pushinteger(L, Z_MEM_ERROR);
+		return 2;
+	}
+
+	result = deflateInit2(&p->zstrm, level, Z_DEFLATED, wbits, memlevel, Z_DEFAULT_STRATEGY);
 	if (result == Z_OK) {
-		Stream *p = (Stream*)malloc(sizeof(z_stream));
 		p->magic = DEFLATE_MAGIC;
-		memcpy(&p->zstrm, &stream, sizeof(stream));
 		lua_pushlightuserdata(L, p);
 		lua_pushinteger(L, 0);
 	} else {
+		free(p);
 		lua_pushnil(L);
 		lua_pushinteger(L, result);
 	}
@@ -153,22 +158,23 @@ static int l_deflate_end(lua_State *L)
 */
 static int l_inflate_init(lua_State *L)
 {
-	z_stream stream = {
-		.zalloc = Z_NULL,
-		.zfree = Z_NULL,
-		.opaque = Z_NULL,
-		.avail_in = 0,
-		.next_in = Z_NULL,
-	};
 	int wbits = (int)luaL_optinteger(L, 1, MAX_WBITS + 16);
-	int result = inflateInit2(&stream, wbits);
+	int result;
+
+	Stream *p = (Stream*)calloc(1, sizeof(Stream));
+	if (p == NULL) {
+		lua_pushnil(L);
+		lua_pushinteger(L, Z_MEM_ERROR);
+		return 2;
+	}
+
+	result = inflateInit2(&p->zstrm, wbits);
 	if (result == Z_OK) {
-		Stream *p = (Stream*)malloc(sizeof(z_stream));
 		p->magic = INFLATE_MAGIC;
-		memcpy(&p->zstrm, &stream, sizeof(stream));
 		lua_pushlightuserdata(L, p);
 		lua_pushinteger(L, 0);
 	} else {
+		free(p);
 		lua_pushnil(L);
 		lua_pushinteger(L, result);
 	}